@@ -0,0 +1,62 @@
+/*
+    Espada - A retro 2D space shooter
+    Copyright (C) 2011  Justin Jacobs
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SDL/SDL.h"
+#include "SDL/SDL_ttf.h"
+#include "SDL/SDL_mixer.h"
+
+#include "main.h"
+#include "clips.h"
+#include "anim.h"
+
+// Indexed by the ANIM_ ids
+animation animations[] = {
+    {clipPlayerNorm,2,3,true},
+    {clipEnemyType1,2,3,true},
+    {clipEnemyType2,2,3,true},
+    {clipExplosion,8,3,false}
+};
+
+int anim_frame(int id, int start) // Frame showing on the current tick
+{
+    return anim_frameat(id, start, game_tick);
+}
+
+int anim_frameat(int id, int start, int tick) // For games that keep their own tick (the batched environments)
+{
+    const animation* a = &animations[id];
+    int frame = (tick - start) / a->ticks;
+    
+    if(frame < 0)
+        return 0;
+    if(a->loop == true)
+        return frame % a->count;
+    return frame < a->count ? frame : a->count-1;
+}
+
+SDL_Rect* anim_clip(int id, int start)
+{
+    return &animations[id].clips[anim_frame(id, start)];
+}
+
+bool anim_done(int id, int start) // True once a one-shot animation has shown its last frame
+{
+    const animation* a = &animations[id];
+    
+    return a->loop == false && game_tick - start >= a->count*a->ticks ? true : false;
+}
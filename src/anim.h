@@ -0,0 +1,26 @@
+//------------------------------
+// Animations
+//------------------------------
+// Each animation plays a run of clips at its own rate. Entities store
+// which animation they play and the game tick it started on, and the frame
+// is worked out from the current tick whenever it is needed, so drawing
+// never changes the game state.
+
+#define ANIM_PLAYER 0
+#define ANIM_ENEMY1 1
+#define ANIM_ENEMY2 2
+#define ANIM_EXPLOSION 3
+
+typedef struct animation{
+    SDL_Rect* clips;
+    int count;
+    int ticks;  // Logic ticks per frame
+    bool loop;  // Otherwise it holds the last frame once done
+}animation;
+
+extern animation animations[];
+
+int anim_frame(int id, int start);
+int anim_frameat(int id, int start, int tick);
+SDL_Rect* anim_clip(int id, int start);
+bool anim_done(int id, int start);
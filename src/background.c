@@ -0,0 +1,179 @@
+/*
+    Espada - A retro 2D space shooter
+    Copyright (C) 2011  Justin Jacobs
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SDL/SDL.h"
+#include "SDL/SDL_ttf.h"
+#include "SDL/SDL_mixer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "compose.h"
+#include "background.h"
+
+typedef struct background_run{
+    Uint16 x;
+    Uint16 w;
+}background_run;
+
+typedef struct background_cache{
+    SDL_Surface* image;
+    int w;
+    int h;
+    bool solid;
+    int* rowruns;          // Index of each row's first run, h+1 entries
+    background_run* runs;
+}background_cache;
+
+static background_cache background_caches[MAXLAYERS];
+static int background_count = 0;
+static int background_offsets[MAXLAYERS];
+
+static bool background_buildruns(background_cache* c) // Find the opaque parts of each row
+{
+    SDL_Surface* s = c->image;
+    int bpp = s->format->BytesPerPixel;
+    Uint32 key = s->format->colorkey;
+    int x,y,n,total = 0;
+    
+    c->rowruns = malloc((c->h+1)*sizeof(int));
+    // At most one run for every other pixel
+    c->runs = malloc(((c->w+1)/2)*c->h*sizeof(background_run));
+    if(c->rowruns == NULL || c->runs == NULL)
+        return false;
+    
+    if(SDL_MUSTLOCK(s))
+        SDL_LockSurface(s);
+    for(y=0;y<c->h;y++)
+    {
+        Uint8* row = (Uint8*)s->pixels + y*s->pitch;
+        
+        c->rowruns[y] = total;
+        for(x=0;x<c->w;x++)
+        {
+            Uint32 p = 0;
+            memcpy(&p, row + x*bpp, bpp);
+            if(p == key)
+                continue;
+            
+            for(n=1;x+n<c->w;n++)
+            {
+                p = 0;
+                memcpy(&p, row + (x+n)*bpp, bpp);
+                if(p == key)
+                    break;
+            }
+            c->runs[total].x = x;
+            c->runs[total].w = n;
+            total++;
+            x += n;
+        }
+    }
+    c->rowruns[c->h] = total;
+    if(SDL_MUSTLOCK(s))
+        SDL_UnlockSurface(s);
+    
+    // A colorkey that is never used
+    c->solid = total == c->h ? true : false;
+    for(y=0;y<total;y++)
+        if(c->runs[y].w != c->w)
+            c->solid = false;
+    return true;
+}
+
+bool background_load(const background_layer* layers, int count)
+{
+    int i;
+    
+    if(count > MAXLAYERS)
+        count = MAXLAYERS;
+    
+    for(i=0;i<count;i++)
+    {
+        background_cache* c = &background_caches[i];
+        
+        // Layers above the first see through to the ones below on magenta
+        memset(c, 0, sizeof(background_cache));
+        c->image = image_load(layers[i].file, i > 0 ? true : false);
+        background_count = i+1;
+        if(c->image == NULL || c->image->h != layers[i].height)
+            return false;
+        
+        c->w = c->image->w < SCREEN_WIDTH ? c->image->w : SCREEN_WIDTH;
+        c->h = c->image->h;
+        if((c->image->flags & SDL_SRCCOLORKEY) == 0)
+        {
+            c->solid = true;
+            continue;
+        }
+        if(background_buildruns(c) == false)
+            return false;
+    }
+    
+    return true;
+}
+
+static void background_row(Uint8* dest, int y, void* data)
+{
+    int i,j;
+    
+    for(i=0;i<background_count;i++)
+    {
+        background_cache* c = &background_caches[i];
+        int bpp = c->image->format->BytesPerPixel;
+        int row = (y - background_offsets[i]) % c->h;
+        const Uint8* src;
+        
+        if(row < 0)
+            row += c->h;
+        src = (const Uint8*)c->image->pixels + row*c->image->pitch;
+        
+        if(c->solid == true)
+            memcpy(dest, src, c->w*bpp);
+        else
+        {
+            for(j=c->rowruns[row];j<c->rowruns[row+1];j++)
+                memcpy(dest + c->runs[j].x*bpp, src + c->runs[j].x*bpp, c->runs[j].w*bpp);
+        }
+    }
+}
+
+void background_draw(const int* offsets)
+{
+    memcpy(background_offsets, offsets, background_count*sizeof(int));
+    
+    // Only a background with holes needs the frame cleared first
+    if(background_count == 0 || background_caches[0].solid == false || background_caches[0].w < SCREEN_WIDTH)
+        compose_fill(0x000000);
+    if(background_count > 0)
+        compose_rows(background_row, NULL);
+}
+
+void background_cleanup()
+{
+    int i;
+    
+    for(i=0;i<background_count;i++)
+    {
+        image_free(background_caches[i].image);
+        free(background_caches[i].rowruns);
+        free(background_caches[i].runs);
+    }
+    background_count = 0;
+}
@@ -0,0 +1,14 @@
+//------------------------------
+// Scrolling background
+//------------------------------
+// Each layer is an image that repeats vertically and scrolls at its own
+// speed, drawn back to front. The images stay in the display format and
+// wrap like a ring, so a scrolled frame is just rows copied from a new
+// offset. For layers with a colorkey, the opaque runs of every row are
+// found once at load time and copied with memcpy, so the see-through parts
+// cost nothing. When the first layer is solid and as wide as the screen,
+// nothing else needs to clear the frame.
+
+bool background_load(const background_layer* layers, int count);
+void background_draw(const int* offsets);
+void background_cleanup();
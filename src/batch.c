@@ -0,0 +1,631 @@
+/*
+    Espada - A retro 2D space shooter
+    Copyright (C) 2011  Justin Jacobs
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SDL/SDL.h"
+#include "SDL/SDL_image.h"
+#include "SDL/SDL_ttf.h"
+#include "SDL/SDL_mixer.h"
+
+#include <stdlib.h>
+
+#include "main.h"
+#include "clips.h"
+#include "espada.h"
+#include "vm.h"
+#include "anim.h"
+
+//------------------------------
+// Batched environments
+//------------------------------
+// N games are stored as structure-of-arrays, one int per game for every
+// field. Fields of pooled objects are stored slot-major, so that slot k of
+// every game is contiguous. batch_logic() follows the rules of game_logic()
+// tick for tick, including the order of sys_rand() calls, so a batched game
+// plays out exactly like the single environment with the same seed.
+// Enemy scripts keep their vm_context per slot, also slot-major. Each game
+// counts its own ticks, which pick the animation frame and so the mask that
+// collisions test against.
+
+#define PLAYER_W 64
+#define PLAYER_H 64
+#define LASER_W 8
+#define LASER_H 16
+
+enum {
+    // per game
+    F_RNG, F_OVER, F_ENEMYTOTAL, F_ENEMYWAVES, F_SPAWNTIMER,
+    F_P_ALIVE, F_P_X, F_P_Y, F_P_SCORE, F_P_HEALTH, F_P_LASERTIMER,
+    F_P_INVULN, F_P_INVULNTIMER, F_P_VX, F_P_VY, F_LASTSCORE, F_TICK,
+    // per player laser
+    F_PL_ALIVE, F_PL_X = F_PL_ALIVE + MAXLASERS, F_PL_Y = F_PL_X + MAXLASERS,
+    // per enemy
+    F_E_ALIVE = F_PL_Y + MAXLASERS, F_E_TYPE = F_E_ALIVE + MAXENEMIES,
+    F_E_X = F_E_TYPE + MAXENEMIES, F_E_Y = F_E_X + MAXENEMIES,
+    F_E_W = F_E_Y + MAXENEMIES, F_E_H = F_E_W + MAXENEMIES,
+    F_E_LASERTIMER = F_E_H + MAXENEMIES, F_E_ANIMSTART = F_E_LASERTIMER + MAXENEMIES,
+    // per enemy laser
+    F_EL_ALIVE = F_E_ANIMSTART + MAXENEMIES,
+    F_EL_X = F_EL_ALIVE + MAXENEMIES*MAXLASERS,
+    F_EL_Y = F_EL_X + MAXENEMIES*MAXLASERS,
+    F_TOTAL = F_EL_Y + MAXENEMIES*MAXLASERS
+};
+
+struct espada_batch{
+    int n;
+    Sint32* data;
+    vm_context* vm;
+    float* obs;
+    float* reward;
+    unsigned char* done;
+};
+
+// Row of field f; pooled objects pass the field plus their slot
+#define ROW(b,f) ((b)->data + (size_t)(f)*(b)->n)
+
+static int batch_rand(Uint32* state, int low, int high) // Same generator as sys_rand()
+{
+    Uint32 s = *state;
+    s ^= s << 13;
+    s ^= s >> 17;
+    s ^= s << 5;
+    *state = s;
+    return s % (high - low + 1) + low;
+}
+
+static SDL_Rect batch_rect(int x, int y, int w, int h)
+{
+    SDL_Rect r;
+    r.x = x;
+    r.y = y;
+    r.w = w;
+    r.h = h;
+    return r;
+}
+
+static const mask* batch_playermask(espada_batch* b, int e) // The player spawns at tick 0
+{
+    return &mask_player[anim_frameat(ANIM_PLAYER,0,b->data[F_TICK*b->n+e])];
+}
+
+static const mask* batch_enemymask(espada_batch* b, int e, int j) // As game_enemymask()
+{
+    int n = b->n;
+    Sint32* d = b->data;
+    int start = d[(F_E_ANIMSTART+j)*n+e];
+    
+    if(d[(F_E_TYPE+j)*n+e] == 0)
+        return &mask_enemy[anim_frameat(ANIM_ENEMY1,start,d[F_TICK*n+e])];
+    return &mask_enemy2[anim_frameat(ANIM_ENEMY2,start,d[F_TICK*n+e])];
+}
+
+static void batch_enemyspawn(espada_batch* b, int e)
+{
+    int i;
+    int n = b->n;
+    Sint32* d = b->data;
+    Uint32* rng = (Uint32*)ROW(b,F_RNG);
+    
+    if(d[F_ENEMYTOTAL*n+e] == 0)
+    {
+        if(d[F_SPAWNTIMER*n+e] == 0)
+        {
+            for(i=0;i<MAXENEMIES;i++)
+            {
+                if(d[(F_E_ALIVE+i)*n+e] == 0)
+                {
+                    int w = 64;
+                    int h = d[F_ENEMYWAVES*n+e] < 5 ? 32 : 64;
+                    d[(F_E_TYPE+i)*n+e] = d[F_ENEMYWAVES*n+e] < 5 ? 0 : 1;
+                    d[(F_E_W+i)*n+e] = w;
+                    d[(F_E_H+i)*n+e] = h;
+                    d[(F_E_ALIVE+i)*n+e] = 1;
+                    d[F_ENEMYTOTAL*n+e] += 1;
+                    d[(F_E_LASERTIMER+i)*n+e] = 0;
+                    d[(F_E_ANIMSTART+i)*n+e] = d[F_TICK*n+e];
+                    vm_start(&b->vm[i*n+e],enemy_entry[d[(F_E_TYPE+i)*n+e]]);
+                    d[(F_E_X+i)*n+e] = batch_rand(&rng[e],0,SCREEN_WIDTH - w);
+                    d[(F_E_Y+i)*n+e] = batch_rand(&rng[e],-192,-64);
+                }
+            }
+        }
+        if(d[F_SPAWNTIMER*n+e] > 0)
+            d[F_SPAWNTIMER*n+e] -= 1;
+    }
+    else
+    {
+        d[F_SPAWNTIMER*n+e] = 180;
+    }
+    
+    if(d[F_SPAWNTIMER*n+e] == 179 && d[F_ENEMYTOTAL*n+e] == 0)
+        d[F_ENEMYWAVES*n+e] += 1;
+}
+
+static void batch_newgame(espada_batch* b, int e, Uint32 seed) // Mirrors game_newgame()
+{
+    int i;
+    int n = b->n;
+    Sint32* d = b->data;
+    
+    for(i=0;i<F_TOTAL;i++)
+        d[i*n+e] = 0;
+    for(i=0;i<MAXENEMIES;i++)
+        vm_start(&b->vm[i*n+e],0);
+    
+    if(seed == 0)
+        seed = 0x9E3779B9;
+    d[F_RNG*n+e] = (Sint32)seed;
+    
+    d[F_P_ALIVE*n+e] = 1;
+    d[F_P_HEALTH*n+e] = 5;
+    d[F_P_X*n+e] = 295;
+    d[F_P_Y*n+e] = SCREEN_BOTTOM - PLAYER_H;
+    d[F_SPAWNTIMER*n+e] = 180;
+    batch_enemyspawn(b,e);
+}
+
+static void batch_observe(espada_batch* b, int e)
+{
+    int i;
+    int n = b->n;
+    Sint32* d = b->data;
+    float* s = b->obs + (size_t)e*ESPADA_STATE_SIZE;
+    const float sx = SCREEN_WIDTH;
+    const float sy = SCREEN_HEIGHT;
+    
+    s[0] = d[F_P_ALIVE*n+e];
+    s[1] = d[F_P_X*n+e] / sx;
+    s[2] = d[F_P_Y*n+e] / sy;
+    s[3] = d[F_P_HEALTH*n+e] / 5.0f;
+    s[4] = d[F_P_INVULN*n+e];
+    s += 5;
+    
+    for(i=0;i<MAXLASERS;i++, s += 3)
+    {
+        int alive = d[(F_PL_ALIVE+i)*n+e];
+        s[0] = alive;
+        s[1] = alive ? d[(F_PL_X+i)*n+e] / sx : 0;
+        s[2] = alive ? d[(F_PL_Y+i)*n+e] / sy : 0;
+    }
+    
+    for(i=0;i<MAXENEMIES;i++, s += 4)
+    {
+        int alive = d[(F_E_ALIVE+i)*n+e];
+        s[0] = alive;
+        s[1] = alive ? d[(F_E_TYPE+i)*n+e] : 0;
+        s[2] = alive ? d[(F_E_X+i)*n+e] / sx : 0;
+        s[3] = alive ? d[(F_E_Y+i)*n+e] / sy : 0;
+    }
+    
+    for(i=0;i<MAXENEMIES*MAXLASERS;i++, s += 3)
+    {
+        int alive = d[(F_EL_ALIVE+i)*n+e];
+        s[0] = alive;
+        s[1] = alive ? d[(F_EL_X+i)*n+e] / sx : 0;
+        s[2] = alive ? d[(F_EL_Y+i)*n+e] / sy : 0;
+    }
+}
+
+static int batch_enemyshoot(espada_batch* b, int e, int j) // As game_enemyshoot()
+{
+    int i;
+    int n = b->n;
+    Sint32* d = b->data;
+    
+    for(i=0;i<MAXLASERS;i++)
+    {
+        int k = j*MAXLASERS+i;
+        if(d[(F_EL_ALIVE+k)*n+e] == 0)
+        {
+            d[(F_EL_ALIVE+k)*n+e] = 1;
+            d[(F_EL_X+k)*n+e] = d[(F_E_X+j)*n+e] + d[(F_E_W+j)*n+e]/2;
+            d[(F_EL_Y+k)*n+e] = d[(F_E_Y+j)*n+e] + LASER_H;
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+static void batch_playerdamage(espada_batch* b, int e, int dmg)
+{
+    int n = b->n;
+    Sint32* d = b->data;
+    
+    d[F_P_INVULN*n+e] = 1;
+    d[F_P_INVULNTIMER*n+e] = 100;
+    d[F_P_HEALTH*n+e] -= dmg;
+    if(d[F_P_HEALTH*n+e] <= 0)
+    {
+        d[F_P_HEALTH*n+e] = 0;
+        d[F_P_ALIVE*n+e] = 0;
+        d[F_OVER*n+e] = 1;
+    }
+}
+
+void batch_logic(espada_batch* b, const int* actions) // One game_logic() tick for every game
+{
+    SDL_Rect body,target;
+    int i,j,e;
+    int n = b->n;
+    Sint32* d = b->data;
+    Uint32* rng = (Uint32*)ROW(b,F_RNG);
+    Sint32* over = ROW(b,F_OVER);
+    
+    // Player invulnerability, movement and firing
+    {
+        Sint32* inv = ROW(b,F_P_INVULN);
+        Sint32* invt = ROW(b,F_P_INVULNTIMER);
+        Sint32* vx = ROW(b,F_P_VX);
+        Sint32* vy = ROW(b,F_P_VY);
+        Sint32* px = ROW(b,F_P_X);
+        Sint32* py = ROW(b,F_P_Y);
+        
+        for(e=0;e<n;e++)
+        {
+            int a = actions[e];
+            int left = (a & ESPADA_ACTION_LEFT) != 0;
+            int right = (a & ESPADA_ACTION_RIGHT) != 0 && !left;
+            int up = (a & ESPADA_ACTION_UP) != 0;
+            int down = (a & ESPADA_ACTION_DOWN) != 0 && !up;
+            int rightheld = (a & ESPADA_ACTION_RIGHT) != 0;
+            int downheld = (a & ESPADA_ACTION_DOWN) != 0;
+            int x,y;
+            
+            if(over[e])
+                continue;
+            
+            if(invt[e] != 0)
+                invt[e]--;
+            else
+                inv[e] = 0;
+            
+            vx[e] -= left && vx[e] > -8;
+            vx[e] += right && vx[e] < 8;
+            vy[e] -= up && vy[e] > -4;
+            vy[e] += down && vy[e] < 4;
+            vx[e] += !left && vx[e] < 0;
+            vx[e] -= !rightheld && vx[e] > 0;
+            vy[e] += !up && vy[e] < 0;
+            vy[e] -= !downheld && vy[e] > 0;
+            
+            x = px[e] + vx[e];
+            y = py[e] + vy[e];
+            x = x < 0 ? 0 : x;
+            y = y < 0 ? 0 : y;
+            x = x + PLAYER_W > SCREEN_WIDTH ? SCREEN_WIDTH - PLAYER_W : x;
+            y = y + PLAYER_H > SCREEN_BOTTOM ? SCREEN_BOTTOM - PLAYER_H : y;
+            px[e] = x;
+            py[e] = y;
+        }
+        
+        for(e=0;e<n;e++)
+        {
+            Sint32* lt = &d[F_P_LASERTIMER*n+e];
+            
+            if(over[e])
+                continue;
+            
+            if((actions[e] & ESPADA_ACTION_FIRE) && *lt == 0)
+            {
+                for(i=0;i<MAXLASERS;i++)
+                {
+                    if(d[(F_PL_ALIVE+i)*n+e] == 0)
+                    {
+                        d[(F_PL_ALIVE+i)*n+e] = 1;
+                        d[(F_PL_X+i)*n+e] = px[e] + PLAYER_W/2;
+                        d[(F_PL_Y+i)*n+e] = py[e] - LASER_H;
+                        *lt = 15;
+                        break;
+                    }
+                }
+            }
+            if(*lt > 0)
+                (*lt)--;
+        }
+    }
+    
+    // Collisions, as in game_resolvecontacts(). A laser that hits marks
+    // itself and its enemy 2, so that neither hits again, and both are
+    // taken out after, so that all hits are found against the same state
+    for(i=0;i<MAXLASERS;i++)
+    {
+        Sint32* la = ROW(b,F_PL_ALIVE+i);
+        Sint32* lx = ROW(b,F_PL_X+i);
+        Sint32* ly = ROW(b,F_PL_Y+i);
+        
+        for(j=0;j<MAXENEMIES;j++)
+        {
+            Sint32* ea = ROW(b,F_E_ALIVE+j);
+            Sint32* ex = ROW(b,F_E_X+j);
+            Sint32* ey = ROW(b,F_E_Y+j);
+            Sint32* ew = ROW(b,F_E_W+j);
+            Sint32* eh = ROW(b,F_E_H+j);
+            
+            for(e=0;e<n;e++)
+            {
+                int hit = !over[e] && d[F_P_ALIVE*n+e] && la[e] == 1 && ea[e] == 1 && ey[e] + eh[e] >= 0 &&
+                          sys_collidemask(batch_rect(lx[e],ly[e],LASER_W,LASER_H),&mask_laser,
+                                          batch_rect(ex[e],ey[e],ew[e],eh[e]),batch_enemymask(b,e,j)) == true;
+                la[e] = hit ? 2 : la[e];
+                ea[e] = hit ? 2 : ea[e];
+            }
+        }
+    }
+    for(i=0;i<MAXLASERS;i++)
+    {
+        Sint32* la = ROW(b,F_PL_ALIVE+i);
+        
+        for(e=0;e<n;e++)
+            la[e] &= 1;
+    }
+    for(j=0;j<MAXENEMIES;j++)
+    {
+        Sint32* ea = ROW(b,F_E_ALIVE+j);
+        Sint32* et = ROW(b,F_E_TYPE+j);
+        
+        for(e=0;e<n;e++)
+        {
+            int hit = ea[e] == 2;
+            d[F_ENEMYTOTAL*n+e] -= hit;
+            d[F_P_SCORE*n+e] += hit ? (et[e] == 0 ? 50 : 100) : 0;
+            ea[e] &= 1;
+        }
+    }
+    
+    for(e=0;e<n;e++)
+    {
+        int damage = 0;
+        SDL_Rect player;
+        
+        if(over[e] || !d[F_P_ALIVE*n+e] || d[F_P_INVULN*n+e])
+            continue;
+        
+        player = batch_rect(d[F_P_X*n+e],d[F_P_Y*n+e],PLAYER_W,PLAYER_H);
+        
+        for(j=0;j<MAXENEMIES;j++)
+        {
+            for(i=0;i<MAXLASERS;i++)
+            {
+                int k = j*MAXLASERS+i;
+                if(d[(F_EL_ALIVE+k)*n+e] &&
+                   sys_collidemask(player,batch_playermask(b,e),
+                                   batch_rect(d[(F_EL_X+k)*n+e],d[(F_EL_Y+k)*n+e],LASER_W,LASER_H),&mask_laser_enemy) == true)
+                {
+                    d[(F_EL_ALIVE+k)*n+e] = 0;
+                    damage += 1;
+                    break;
+                }
+            }
+        }
+        for(j=0;j<MAXENEMIES;j++)
+        {
+            if(d[(F_E_ALIVE+j)*n+e] &&
+               sys_collidemask(batch_rect(d[(F_E_X+j)*n+e],d[(F_E_Y+j)*n+e],d[(F_E_W+j)*n+e],d[(F_E_H+j)*n+e]),
+                               batch_enemymask(b,e,j),player,batch_playermask(b,e)) == true)
+            {
+                d[(F_E_ALIVE+j)*n+e] = 0;
+                d[F_ENEMYTOTAL*n+e] -= 1;
+                damage += 2;
+            }
+        }
+        if(damage > 0)
+            batch_playerdamage(b,e,damage);
+    }
+    
+    // Enemies, as in game_enemyspawn(), game_enemymove() and game_enemyfire()
+    for(e=0;e<n;e++)
+    {
+        batch_enemyspawn(b,e);
+        
+        // As in vm_run(), scripts first and then the moves
+        target.x = d[F_P_X*n+e];
+        target.y = d[F_P_Y*n+e];
+        target.w = PLAYER_W;
+        target.h = PLAYER_H;
+        for(i=0;i<MAXENEMIES;i++)
+        {
+            vm_context* c = &b->vm[i*n+e];
+            if(d[(F_E_ALIVE+i)*n+e] && c->wait <= 0)
+            {
+                body.x = d[(F_E_X+i)*n+e];
+                body.y = d[(F_E_Y+i)*n+e];
+                body.w = d[(F_E_W+i)*n+e];
+                body.h = d[(F_E_H+i)*n+e];
+                vm_think(c,&body,&target,d[F_P_ALIVE*n+e],&rng[e]);
+            }
+        }
+        for(i=0;i<MAXENEMIES;i++)
+        {
+            if(d[(F_E_ALIVE+i)*n+e])
+            {
+                body.x = d[(F_E_X+i)*n+e];
+                body.y = d[(F_E_Y+i)*n+e];
+                body.w = d[(F_E_W+i)*n+e];
+                vm_move(&b->vm[i*n+e],&body);
+                d[(F_E_X+i)*n+e] = body.x;
+                d[(F_E_Y+i)*n+e] = body.y;
+            }
+        }
+        for(j=0;j<MAXENEMIES;j++)
+        {
+            for(;b->vm[j*n+e].fire > 0;b->vm[j*n+e].fire--)
+                batch_enemyshoot(b,e,j);
+        }
+        
+        for(i=0;i<MAXENEMIES;i++)
+        {
+            Sint32* x = &d[(F_E_X+i)*n+e];
+            Sint32* y = &d[(F_E_Y+i)*n+e];
+            int h = d[(F_E_H+i)*n+e];
+            int type = d[(F_E_TYPE+i)*n+e];
+            
+            if(*y > SCREEN_BOTTOM+h)
+            {
+                d[(F_E_ALIVE+i)*n+e] = 0;
+                d[F_ENEMYTOTAL*n+e] -= 1;
+                *x = 0;
+                *y = 0;
+                if(!over[e])
+                    d[F_P_SCORE*n+e] -= type == 0 ? 100 : 200;
+                if(d[F_P_SCORE*n+e] < 0)
+                    d[F_P_SCORE*n+e] = 0;
+                break;
+            }
+        }
+        
+        for(j=0;j<MAXENEMIES;j++)
+        {
+            Sint32* lt = &d[(F_E_LASERTIMER+j)*n+e];
+            
+            if(*lt == 0 && d[(F_E_ALIVE+j)*n+e] && d[(F_E_Y+j)*n+e] + d[(F_E_H+j)*n+e] >= 0)
+            {
+                if(batch_enemyshoot(b,e,j))
+                {
+                    if(d[(F_E_TYPE+j)*n+e] == 0)
+                        *lt = batch_rand(&rng[e],100,250);
+                    else
+                        *lt = batch_rand(&rng[e],50,100);
+                }
+            }
+            if(*lt > 0)
+                (*lt)--;
+        }
+    }
+    
+    // Lasers, as in game_lasersmove()
+    for(i=0;i<MAXLASERS;i++)
+    {
+        Sint32* la = ROW(b,F_PL_ALIVE+i);
+        Sint32* ly = ROW(b,F_PL_Y+i);
+        
+        for(e=0;e<n;e++)
+        {
+            ly[e] -= la[e] ? 10 : 0;
+            la[e] = ly[e] < 0 ? 0 : la[e];
+        }
+    }
+    for(i=0;i<MAXENEMIES*MAXLASERS;i++)
+    {
+        Sint32* la = ROW(b,F_EL_ALIVE+i);
+        Sint32* ly = ROW(b,F_EL_Y+i);
+        
+        for(e=0;e<n;e++)
+        {
+            ly[e] += la[e] ? 5 : 0;
+            la[e] = ly[e] > SCREEN_HEIGHT ? 0 : la[e];
+        }
+    }
+    
+    // As game_tick at the end of game_logic()
+    for(e=0;e<n;e++)
+        d[F_TICK*n+e] += 1;
+}
+
+espada_batch* espada_batch_create(int n)
+{
+    espada_batch* b;
+    
+    if(n <= 0)
+        return NULL;
+    
+    set_clips();
+    if(game_loadscripts() == false || game_loadmasks() == false)
+        return NULL;
+    
+    b = calloc(1,sizeof(espada_batch));
+    if(b == NULL)
+        return NULL;
+    
+    b->n = n;
+    b->data = calloc((size_t)F_TOTAL*n,sizeof(Sint32));
+    b->vm = calloc((size_t)MAXENEMIES*n,sizeof(vm_context));
+    b->obs = calloc((size_t)ESPADA_STATE_SIZE*n,sizeof(float));
+    b->reward = calloc(n,sizeof(float));
+    b->done = calloc(n,1);
+    if(b->data == NULL || b->vm == NULL || b->obs == NULL || b->reward == NULL || b->done == NULL)
+    {
+        espada_batch_destroy(b);
+        return NULL;
+    }
+    
+    return b;
+}
+
+void espada_batch_destroy(espada_batch* b)
+{
+    if(b == NULL)
+        return;
+    
+    free(b->data);
+    free(b->vm);
+    free(b->obs);
+    free(b->reward);
+    free(b->done);
+    free(b);
+}
+
+const float* espada_batch_reset(espada_batch* b, const unsigned int* seeds)
+{
+    int e;
+    int n = b->n;
+    Sint32* d = b->data;
+    
+    for(e=0;e<n;e++)
+    {
+        batch_newgame(b,e,seeds != NULL ? seeds[e] : (Uint32)d[F_RNG*n+e]);
+        b->reward[e] = 0;
+        b->done[e] = 0;
+        batch_observe(b,e);
+    }
+    
+    return b->obs;
+}
+
+const float* espada_batch_step(espada_batch* b, const int* actions, const unsigned int* seeds)
+{
+    int e;
+    int n = b->n;
+    Sint32* d = b->data;
+    
+    batch_logic(b,actions);
+    
+    for(e=0;e<n;e++)
+    {
+        b->reward[e] = d[F_P_SCORE*n+e] - d[F_LASTSCORE*n+e];
+        d[F_LASTSCORE*n+e] = d[F_P_SCORE*n+e];
+        b->done[e] = d[F_OVER*n+e] != 0;
+        
+        // Finished games start over straight away
+        if(b->done[e])
+            batch_newgame(b,e,seeds != NULL ? seeds[e] : (Uint32)d[F_RNG*n+e]);
+        
+        batch_observe(b,e);
+    }
+    
+    return b->obs;
+}
+
+const float* espada_batch_rewards(espada_batch* b)
+{
+    return b->reward;
+}
+
+const unsigned char* espada_batch_dones(espada_batch* b)
+{
+    return b->done;
+}
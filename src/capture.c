@@ -0,0 +1,394 @@
+/*
+    Espada - A retro 2D space shooter
+    Copyright (C) 2011  Justin Jacobs
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SDL/SDL.h"
+#include "SDL/SDL_ttf.h"
+#include "SDL/SDL_mixer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "pacer.h"
+#include "capture.h"
+#include "trace.h"
+
+#define CAPTURE_SLOTS 8
+
+#define CAPTURE_RAW 0
+#define CAPTURE_Y4M 1
+#define CAPTURE_RLE 2
+
+static FILE* capture_file = NULL;
+static int capture_format;
+static int capture_w;
+static int capture_h;
+
+// Frames are kept as 0x00RRGGBB so the writer doesn't need the surface format
+static Uint32* capture_slots[CAPTURE_SLOTS];
+static int capture_head;
+static int capture_tail;
+static int capture_count;
+static bool capture_stopping;
+
+static SDL_mutex* capture_lock = NULL;
+static SDL_cond* capture_ready = NULL;
+static SDL_Thread* capture_thread = NULL;
+
+// Writer thread only
+static Uint8* capture_out = NULL;
+static Uint32* capture_prev = NULL;
+
+static capture_stats capture_st;
+
+//------------------------------
+// Encoders
+//------------------------------
+static int capture_encoderaw(const Uint32* src)
+{
+    Uint8* out = capture_out;
+    int i;
+    
+    for(i=0;i<capture_w*capture_h;i++)
+    {
+        *out++ = src[i] >> 16;
+        *out++ = src[i] >> 8;
+        *out++ = src[i];
+    }
+    return out - capture_out;
+}
+
+static int capture_encodey4m(const Uint32* src) // Full-range BT.601, chroma averaged over 2x2
+{
+    Uint8* y = capture_out + 6;
+    Uint8* cb = y + capture_w*capture_h;
+    Uint8* cr = cb + (capture_w/2)*(capture_h/2);
+    int i,j;
+    
+    memcpy(capture_out, "FRAME\n", 6);
+    
+    for(i=0;i<capture_w*capture_h;i++)
+    {
+        int r = (src[i] >> 16) & 0xFF;
+        int g = (src[i] >> 8) & 0xFF;
+        int b = src[i] & 0xFF;
+        y[i] = (77*r + 150*g + 29*b) >> 8;
+    }
+    
+    for(j=0;j<capture_h/2;j++)
+    {
+        const Uint32* row = src + j*2*capture_w;
+        for(i=0;i<capture_w/2;i++)
+        {
+            Uint32 p0 = row[i*2];
+            Uint32 p1 = row[i*2+1];
+            Uint32 p2 = row[capture_w+i*2];
+            Uint32 p3 = row[capture_w+i*2+1];
+            int r = (((p0 >> 16) & 0xFF) + ((p1 >> 16) & 0xFF) + ((p2 >> 16) & 0xFF) + ((p3 >> 16) & 0xFF)) >> 2;
+            int g = (((p0 >> 8) & 0xFF) + ((p1 >> 8) & 0xFF) + ((p2 >> 8) & 0xFF) + ((p3 >> 8) & 0xFF)) >> 2;
+            int b = ((p0 & 0xFF) + (p1 & 0xFF) + (p2 & 0xFF) + (p3 & 0xFF)) >> 2;
+            *cb++ = ((-43*r - 85*g + 128*b) >> 8) + 128;
+            *cr++ = ((128*r - 107*g - 21*b) >> 8) + 128;
+        }
+    }
+    
+    return cr - capture_out;
+}
+
+static int capture_encoderle(Uint32* src)
+{
+    Uint8* out = capture_out + 4;
+    int n = capture_w*capture_h;
+    int i = 0;
+    int len;
+    
+    // XOR against the previous frame so that unchanged areas become long zero runs
+    for(i=0;i<n;i++)
+    {
+        Uint32 p = src[i];
+        src[i] = p ^ capture_prev[i];
+        capture_prev[i] = p;
+    }
+    
+    i = 0;
+    while(i < n)
+    {
+        int run = 1;
+        while(i+run < n && run < 128 && src[i+run] == src[i])
+            run++;
+        
+        if(run > 1)
+        {
+            *out++ = run-1;
+            *out++ = src[i] >> 16;
+            *out++ = src[i] >> 8;
+            *out++ = src[i];
+            i += run;
+        }
+        else
+        {
+            // Literals up to the next pair of equal pixels
+            int lit = 1;
+            Uint8* ctl = out++;
+            while(i+lit < n && lit < 128 && !(i+lit+1 < n && src[i+lit] == src[i+lit+1]))
+                lit++;
+            *ctl = 127+lit;
+            for(run=0;run<lit;run++)
+            {
+                *out++ = src[i+run] >> 16;
+                *out++ = src[i+run] >> 8;
+                *out++ = src[i+run];
+            }
+            i += lit;
+        }
+    }
+    
+    len = out - capture_out - 4;
+    capture_out[0] = len & 0xFF;
+    capture_out[1] = (len >> 8) & 0xFF;
+    capture_out[2] = (len >> 16) & 0xFF;
+    capture_out[3] = (len >> 24) & 0xFF;
+    return len + 4;
+}
+
+//------------------------------
+// Writer thread
+//------------------------------
+static int capture_writer(void* data)
+{
+    int len;
+    
+    TRACE_THREAD("capture");
+    while(1)
+    {
+        SDL_LockMutex(capture_lock);
+        while(capture_count == 0 && capture_stopping == false)
+            SDL_CondWait(capture_ready, capture_lock);
+        if(capture_count == 0)
+        {
+            SDL_UnlockMutex(capture_lock);
+            break;
+        }
+        SDL_UnlockMutex(capture_lock);
+        
+        // The slot at the tail is ours until the count goes down
+        TRACE_BEGIN("capture_encode");
+        if(capture_format == CAPTURE_Y4M)
+            len = capture_encodey4m(capture_slots[capture_tail]);
+        else if(capture_format == CAPTURE_RLE)
+            len = capture_encoderle(capture_slots[capture_tail]);
+        else
+            len = capture_encoderaw(capture_slots[capture_tail]);
+        fwrite(capture_out, 1, len, capture_file);
+        TRACE_END("capture_encode");
+        
+        SDL_LockMutex(capture_lock);
+        capture_st.bytes += len;
+        capture_tail = (capture_tail+1) % CAPTURE_SLOTS;
+        capture_count--;
+        SDL_UnlockMutex(capture_lock);
+    }
+    
+    return 0;
+}
+
+bool capture_start(const char* filename, int w, int h, int fps)
+{
+    const char* ext = strrchr(filename, '.');
+    bool allocated = true;
+    int i;
+    
+    capture_format = CAPTURE_RAW;
+    if(ext != NULL && strcmp(ext, ".y4m") == 0)
+        capture_format = CAPTURE_Y4M;
+    if(ext != NULL && strcmp(ext, ".rle") == 0)
+        capture_format = CAPTURE_RLE;
+    
+    capture_file = fopen(filename, "wb");
+    if(capture_file == NULL)
+    {
+        fprintf(stderr, "Unable to open %s for capture\n", filename);
+        return false;
+    }
+    
+    capture_w = w;
+    capture_h = h;
+    for(i=0;i<CAPTURE_SLOTS;i++)
+    {
+        // Touch the buffers now so the first frames don't take the page faults
+        capture_slots[i] = malloc(w*h*sizeof(Uint32));
+        if(capture_slots[i] == NULL)
+            allocated = false;
+        else
+            memset(capture_slots[i], 0, w*h*sizeof(Uint32));
+    }
+    // Worst-case RLE is 4 bytes per pixel, a lone literal with its control
+    // byte, plus the frame header
+    capture_out = malloc(w*h*4 + 64);
+    capture_prev = calloc(w*h, sizeof(Uint32));
+    if(allocated == false || capture_out == NULL || capture_prev == NULL)
+    {
+        fprintf(stderr, "Unable to allocate the capture buffers\n");
+        capture_stop();
+        return false;
+    }
+    
+    if(capture_format == CAPTURE_Y4M)
+        fprintf(capture_file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", w, h, fps);
+    if(capture_format == CAPTURE_RLE)
+        fprintf(capture_file, "ESPADARLE %d %d %d\n", w, h, fps);
+    
+    capture_head = 0;
+    capture_tail = 0;
+    capture_count = 0;
+    capture_stopping = false;
+    memset(&capture_st, 0, sizeof(capture_st));
+    
+    capture_lock = SDL_CreateMutex();
+    capture_ready = SDL_CreateCond();
+    if(capture_lock != NULL && capture_ready != NULL)
+        capture_thread = SDL_CreateThread(capture_writer, NULL);
+    if(capture_thread == NULL)
+    {
+        fprintf(stderr, "Unable to start the capture thread\n");
+        capture_stop();
+        return false;
+    }
+    
+    return true;
+}
+
+void capture_frame(SDL_Surface* s)
+{
+    Uint64 start;
+    Uint64 elapsed;
+    Uint32* dst;
+    SDL_PixelFormat* fmt = s->format;
+    int x,y;
+    bool full;
+    
+    if(capture_thread == NULL)
+        return;
+    
+    start = pacer_now();
+    
+    SDL_LockMutex(capture_lock);
+    full = capture_count == CAPTURE_SLOTS ? true : false;
+    SDL_UnlockMutex(capture_lock);
+    if(full == true)
+    {
+        TRACE_INSTANT("capture drop");
+        capture_st.dropped++;
+        return;
+    }
+    
+    // The slot at the head is ours until the count goes up
+    dst = capture_slots[capture_head];
+    if(SDL_MUSTLOCK(s))
+        SDL_LockSurface(s);
+    if(fmt->BytesPerPixel == 4 && fmt->Rmask == 0xFF0000 && fmt->Gmask == 0xFF00 && fmt->Bmask == 0xFF)
+    {
+        for(y=0;y<capture_h;y++)
+            memcpy(dst + y*capture_w, (Uint8*)s->pixels + y*s->pitch, capture_w*4);
+    }
+    else
+    {
+        for(y=0;y<capture_h;y++)
+        {
+            Uint8* row = (Uint8*)s->pixels + y*s->pitch;
+            for(x=0;x<capture_w;x++)
+            {
+                Uint32 p = 0;
+                Uint8 r,g,b;
+                memcpy(&p, row + x*fmt->BytesPerPixel, fmt->BytesPerPixel);
+                SDL_GetRGB(p, fmt, &r, &g, &b);
+                dst[y*capture_w+x] = (r << 16) | (g << 8) | b;
+            }
+        }
+    }
+    if(SDL_MUSTLOCK(s))
+        SDL_UnlockSurface(s);
+    
+    SDL_LockMutex(capture_lock);
+    capture_head = (capture_head+1) % CAPTURE_SLOTS;
+    capture_count++;
+    SDL_CondSignal(capture_ready);
+    SDL_UnlockMutex(capture_lock);
+    
+    elapsed = pacer_now() - start;
+    capture_st.frames++;
+    capture_st.copy_total += elapsed;
+    if(elapsed > capture_st.copy_max)
+        capture_st.copy_max = elapsed;
+}
+
+void capture_stop()
+{
+    int i;
+    
+    if(capture_thread != NULL)
+    {
+        // The writer drains what is queued before it exits
+        SDL_LockMutex(capture_lock);
+        capture_stopping = true;
+        SDL_CondSignal(capture_ready);
+        SDL_UnlockMutex(capture_lock);
+        SDL_WaitThread(capture_thread, NULL);
+        capture_thread = NULL;
+    }
+    
+    if(capture_ready != NULL)
+        SDL_DestroyCond(capture_ready);
+    if(capture_lock != NULL)
+        SDL_DestroyMutex(capture_lock);
+    capture_ready = NULL;
+    capture_lock = NULL;
+    
+    if(capture_file != NULL)
+        fclose(capture_file);
+    capture_file = NULL;
+    
+    for(i=0;i<CAPTURE_SLOTS;i++)
+    {
+        free(capture_slots[i]);
+        capture_slots[i] = NULL;
+    }
+    free(capture_out);
+    free(capture_prev);
+    capture_out = NULL;
+    capture_prev = NULL;
+}
+
+void capture_getstats(capture_stats* s)
+{
+    *s = capture_st;
+}
+
+void capture_report(FILE* f)
+{
+    if(capture_st.frames == 0)
+        return;
+    
+    fprintf(f,
+    "Captured frames: %llu, dropped: %llu, written: %.1f MB\n"
+    "Capture copy avg/max: %.3f/%.3f ms\n",
+    (unsigned long long)capture_st.frames, (unsigned long long)capture_st.dropped,
+    capture_st.bytes/1048576.0,
+    capture_st.copy_total/(double)capture_st.frames/1000000.0, capture_st.copy_max/1000000.0);
+}
@@ -0,0 +1,29 @@
+//------------------------------
+// Video capture
+//------------------------------
+// Copies each drawn frame into a ring of preallocated buffers; a writer
+// thread turns them into a file while the game keeps running. When the
+// writer falls behind, frames are dropped rather than stalling the game.
+//
+// The format follows the file name:
+//   .y4m  YUV4MPEG2, 4:2:0, playable by most video tools
+//   .rle  Frames XORed against the previous one and run-length coded.
+//         Header "ESPADARLE W H FPS\n", then per frame a little-endian
+//         Uint32 byte count and the data. A control byte c < 128 repeats
+//         the next RGB pixel c+1 times; c >= 128 is followed by c-127
+//         literal RGB pixels.
+//   other Raw RGB24 frames back to back
+
+typedef struct capture_stats{
+    Uint64 frames;
+    Uint64 dropped;
+    Uint64 bytes;
+    Uint64 copy_total;
+    Uint64 copy_max;
+}capture_stats;
+
+bool capture_start(const char* filename, int w, int h, int fps);
+void capture_frame(SDL_Surface* s);
+void capture_stop();
+void capture_getstats(capture_stats* s);
+void capture_report(FILE* f);
@@ -0,0 +1,480 @@
+/*
+    Espada - A retro 2D space shooter
+    Copyright (C) 2011  Justin Jacobs
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//------------------------------
+// Regression check
+//------------------------------
+// espada-check plays replays back headless, with the library build of the
+// game, and fails if the game no longer does the same thing or has become
+// slower at it:
+//
+// - The state after every tick must match the replay's golden file. The
+//   first tick that differs is reported along with which parts of the
+//   state (see STATE_ in main.h) differ.
+// - The logic time per tick, the best of several runs, must stay within
+//   the tolerance of the baseline file. A second set of runs with tracing
+//   on times each TRACE_SPAN in game_logic(), less the cost of tracing, and
+//   the phases that grew past the tolerance are reported with it.
+//
+// Timings depend on the machine, so the baseline is written on the first
+// run when the file does not exist yet, and again with --save-baseline.
+// --bless rewrites the goldens after a deliberate change to the gameplay.
+
+#include "SDL/SDL.h"
+#include "SDL/SDL_ttf.h"
+#include "SDL/SDL_mixer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "clips.h"
+#include "pacer.h"
+#include "events.h"
+#include "trace.h"
+#include "replay.h"
+
+#define CHECK_MAXPHASES 32
+#define CHECK_MAXBASELINE 1024
+#define CHECK_NAMESIZE 64
+#define CHECK_SHARE 10  // Percent of a slowdown that a phase must explain to be named
+#define CHECK_RUNTIME 100000000  // Nanoseconds, the least a timed run takes
+
+typedef struct check_timing{
+    char file[256];
+    char name[CHECK_NAMESIZE];  // "logic" for the whole tick, otherwise a traced call
+    double ns;                  // Per tick
+}check_timing;
+
+static const char* check_partnames[STATEPARTS] = {"players","enemies","lasers","world"};
+
+static check_timing check_baseline[CHECK_MAXBASELINE];
+static int check_baselinecount = 0;
+static check_timing check_measured[CHECK_MAXBASELINE];
+static int check_measuredcount = 0;
+
+static bool check_bless = false;
+static bool check_savebaseline = false;
+static const char* check_baselinefile = NULL;
+static double check_tolerance = 10;  // Percent
+static int check_runs = 5;
+
+//------------------------------
+// Playing
+//------------------------------
+static void check_newgame(const replay_game* g)
+{
+    sys_seed(g->seed);
+    game_newgame();
+}
+
+static bool check_determinism(const char* file, const replay* r) // Against the golden file, or writes it
+{
+    char golden[300];
+    FILE* f;
+    replay_hash got,want;
+    int i,t,p;
+    bool ok = true;
+    
+    snprintf(golden, sizeof(golden), "%s.golden", file);
+    f = fopen(golden, check_bless == true ? "w" : "r");
+    if(f == NULL)
+    {
+        printf("FAIL %s: unable to open %s\n", file, golden);
+        return false;
+    }
+    
+    for(i=0;i<r->gamecount && ok == true;i++)
+    {
+        const replay_game* g = &r->games[i];
+        
+        check_newgame(g);
+        for(t=0;t<g->ticks;t++)
+        {
+            game_input[0] = r->inputs[g->first + t];
+            game_logic();
+            replay_hashstate(&got);
+            
+            if(check_bless == true)
+            {
+                replay_writehash(f, &got);
+                continue;
+            }
+            
+            if(replay_readhash(f, &want) == false)
+            {
+                printf("FAIL %s: the golden file ends after %d of %d ticks\n", file, g->first + t, r->ticks);
+                ok = false;
+                break;
+            }
+            if(memcmp(got.parts, want.parts, sizeof(got.parts)) == 0)
+                continue;
+            
+            printf("FAIL %s: diverged at tick %d (game %d, tick %d)\n", file, g->first + t + 1, i+1, t+1);
+            for(p=0;p<STATEPARTS;p++)
+                if(got.parts[p] != want.parts[p])
+                    printf("     %s differ\n", check_partnames[p]);
+            printf("     score %d, expected %d; wave %d, expected %d\n", got.score, want.score, got.wave, want.wave);
+            ok = false;
+            break;
+        }
+    }
+    
+    if(ok == true && check_bless == false && replay_readhash(f, &want) == true)
+    {
+        printf("FAIL %s: the golden file is longer than the %d ticks played\n", file, r->ticks);
+        ok = false;
+    }
+    
+    fclose(f);
+    return ok;
+}
+
+static Uint64 check_play(const replay* r, trace_total* totals, int* count) // Logic time for the whole replay
+{
+    Uint64 ns = 0;
+    Uint64 start;
+    int i,t;
+    
+    for(i=0;i<r->gamecount;i++)
+    {
+        const replay_game* g = &r->games[i];
+        const Uint8* in = r->inputs + g->first;
+        
+        check_newgame(g);
+        if(totals != NULL)
+            *count = trace_totals(totals, *count, CHECK_MAXPHASES);
+        
+        start = pacer_now();
+        for(t=0;t<g->ticks;t++)
+        {
+            game_input[0] = in[t];
+            game_logic();
+            
+            // Often enough that the trace ring never wraps
+            if(totals != NULL)
+                *count = trace_totals(totals, *count, CHECK_MAXPHASES);
+        }
+        ns += pacer_now() - start;
+    }
+    
+    return ns;
+}
+
+static double check_spancost() // What tracing adds to each span it times
+{
+    trace_total t;
+    int i;
+    
+    for(i=0;i<1000;i++)
+    {
+        TRACE_BEGIN("check");
+        TRACE_END("check");
+    }
+    return trace_totals(&t, 0, 1) > 0 ? (double)t.ns / t.count : 0;
+}
+
+static void check_measure(const char* file, const replay* r)
+{
+    trace_total totals[CHECK_MAXPHASES];
+    double best[CHECK_MAXPHASES];
+    double logic = -1;
+    double cost;
+    Uint64 ns,ticks,until;
+    int count = 0;
+    int n = 0;
+    int i,j;
+    
+    // The untraced runs give the logic time. Short replays are played over
+    // until a run is long enough to time.
+    for(i=0;i<check_runs;i++)
+    {
+        ns = ticks = 0;
+        for(until=pacer_now()+CHECK_RUNTIME;ticks == 0 || pacer_now() < until;ticks+=r->ticks)
+            ns += check_play(r, NULL, NULL);
+        if(logic < 0 || (double)ns/ticks < logic)
+            logic = (double)ns/ticks;
+    }
+    
+    // The traced ones show how it splits up, less what the tracing costs
+    trace_start(NULL);
+    cost = check_spancost();
+    for(i=0;i<check_runs;i++)
+    {
+        count = 0;
+        ticks = 0;
+        for(until=pacer_now()+CHECK_RUNTIME;ticks == 0 || pacer_now() < until;ticks+=r->ticks)
+            check_play(r, totals, &count);
+        
+        // The spans come in the same order on every run
+        for(j=0;j<count;j++)
+        {
+            double phase = (totals[j].ns - cost*totals[j].count) / ticks;
+            if(phase < 0)
+                phase = 0;
+            if(j >= n)
+                best[n++] = phase;
+            else if(phase < best[j])
+                best[j] = phase;
+        }
+    }
+    trace_stop();
+    
+    for(i=-1;i<n && check_measuredcount < CHECK_MAXBASELINE;i++)
+    {
+        check_timing* m = &check_measured[check_measuredcount++];
+        snprintf(m->file, sizeof(m->file), "%s", file);
+        snprintf(m->name, sizeof(m->name), "%s", i < 0 ? "logic" : totals[i].name);
+        m->ns = i < 0 ? logic : best[i];
+    }
+}
+
+//------------------------------
+// Comparing
+//------------------------------
+static const check_timing* check_find(const check_timing* list, int count, const char* file, const char* name)
+{
+    int i;
+    
+    for(i=0;i<count;i++)
+        if(strcmp(list[i].file, file) == 0 && strcmp(list[i].name, name) == 0)
+            return &list[i];
+    return NULL;
+}
+
+static double check_growth(double ns, double base) // Percent
+{
+    return base > 0 ? (ns - base) * 100 / base : 0;
+}
+
+static bool check_performance(const char* file)
+{
+    const check_timing* logic = check_find(check_measured, check_measuredcount, file, "logic");
+    const check_timing* base = check_find(check_baseline, check_baselinecount, file, "logic");
+    static bool shown[CHECK_MAXBASELINE];
+    bool listed = false;
+    int i;
+    
+    if(logic == NULL)
+        return false;
+    if(base == NULL)
+    {
+        printf("ok   %s: %.0f ns/tick, no baseline\n", file, logic->ns);
+        return true;
+    }
+    
+    if(check_growth(logic->ns, base->ns) <= check_tolerance)
+    {
+        printf("ok   %s: %.0f ns/tick, baseline %.0f (%+.1f%%)\n", file, logic->ns, base->ns, check_growth(logic->ns, base->ns));
+        return true;
+    }
+    
+    printf("FAIL %s: %.0f ns/tick, baseline %.0f (%+.1f%%, tolerance %g%%)\n",
+           file, logic->ns, base->ns, check_growth(logic->ns, base->ns), check_tolerance);
+    
+    // The phases that account for the slowdown, the worst first
+    memset(shown, 0, sizeof(shown));
+    for(;;)
+    {
+        const check_timing* b = NULL;
+        const check_timing* m;
+        double most = 0;
+        int worst = -1;
+        
+        for(i=0;i<check_measuredcount;i++)
+        {
+            const check_timing* mb;
+            double more;
+            
+            m = &check_measured[i];
+            if(strcmp(m->file, file) != 0 || m == logic || shown[i] == true)
+                continue;
+            mb = check_find(check_baseline, check_baselinecount, file, m->name);
+            more = mb != NULL ? m->ns - mb->ns : m->ns;
+            if(worst < 0 || more > most)
+            {
+                worst = i;
+                b = mb;
+                most = more;
+            }
+        }
+        if(worst < 0)
+            break;
+        
+        // Small phases vary a lot, so only those with a real share of it count
+        m = &check_measured[worst];
+        if(listed == true && (most < (logic->ns - base->ns) * CHECK_SHARE / 100
+                              || (b != NULL && check_growth(m->ns, b->ns) <= check_tolerance)))
+            break;
+        if(b != NULL)
+            printf("     %s: %.0f ns/tick, baseline %.0f (%+.1f%%)\n", m->name, m->ns, b->ns, check_growth(m->ns, b->ns));
+        else
+            printf("     %s: %.0f ns/tick, new\n", m->name, m->ns);
+        shown[worst] = true;
+        listed = true;
+    }
+    if(listed == false)
+        printf("     no phase timings, built with NOTRACE?\n");
+    
+    return false;
+}
+
+static bool check_loadbaseline(const char* file) // False if there is none yet
+{
+    FILE* f = fopen(file, "r");
+    char line[512];
+    
+    if(f == NULL)
+        return false;
+    
+    while(fgets(line, sizeof(line), f) != NULL && check_baselinecount < CHECK_MAXBASELINE)
+    {
+        check_timing* b = &check_baseline[check_baselinecount];
+        if(line[0] != '#' && sscanf(line, "%255s %63s %lf", b->file, b->name, &b->ns) == 3)
+            check_baselinecount++;
+    }
+    
+    fclose(f);
+    return true;
+}
+
+static bool check_writebaseline(const char* file)
+{
+    FILE* f = fopen(file, "w");
+    int i;
+    
+    if(f == NULL)
+    {
+        printf("Unable to write the baseline to %s\n", file);
+        return false;
+    }
+    
+    fprintf(f, "# espada-check baseline: replay, phase, nanoseconds per tick\n");
+    for(i=0;i<check_measuredcount;i++)
+        fprintf(f, "%s %s %.1f\n", check_measured[i].file, check_measured[i].name, check_measured[i].ns);
+    fclose(f);
+    
+    printf("Saved the baseline to %s\n", file);
+    return true;
+}
+
+//------------------------------
+// Main
+//------------------------------
+static void check_usage()
+{
+    printf("Usage: espada-check [options] REPLAY...\n"
+           "  --baseline FILE    Compare the timings with FILE, and write it if it is missing\n"
+           "  --save-baseline    Write the timings to the baseline file instead\n"
+           "  --tolerance PCT    How much slower than the baseline is still a pass (%g)\n"
+           "  --runs N           Runs per replay to take the best timings from (%d)\n"
+           "  --bless            Write the golden files instead of comparing\n", check_tolerance, check_runs);
+}
+
+int main(int argc, char* argv[])
+{
+    replay r;
+    bool ok = true;
+    int files = 0;
+    int i;
+    
+    for(i=1;i<argc;i++)
+    {
+        if(strcmp(argv[i],"--baseline") == 0 && i+1 < argc)
+            check_baselinefile = argv[++i];
+        else if(strcmp(argv[i],"--save-baseline") == 0)
+            check_savebaseline = true;
+        else if(strcmp(argv[i],"--tolerance") == 0 && i+1 < argc)
+            check_tolerance = atof(argv[++i]);
+        else if(strcmp(argv[i],"--runs") == 0 && i+1 < argc)
+            check_runs = atoi(argv[++i]) > 0 ? atoi(argv[i]) : 1;
+        else if(strcmp(argv[i],"--bless") == 0)
+            check_bless = true;
+        else if(argv[i][0] == '-')
+        {
+            check_usage();
+            return 2;
+        }
+        else
+            files++;
+    }
+    if(files == 0)
+    {
+        check_usage();
+        return 2;
+    }
+    
+    if(check_baselinefile != NULL && check_savebaseline == false && check_loadbaseline(check_baselinefile) == false)
+        check_savebaseline = true;
+    
+    // The same setup as the library, nothing drains the game events and
+    // collisions test the same masks
+    sound_enabled = false;
+    events_mute(true);
+    set_clips();
+    if(game_loadscripts() == false || game_loadmasks() == false)
+        return 2;
+    
+    for(i=1;i<argc;i++)
+    {
+        const char* file = argv[i];
+        
+        if(strcmp(file,"--baseline") == 0 || strcmp(file,"--tolerance") == 0 || strcmp(file,"--runs") == 0)
+        {
+            i++;
+            continue;
+        }
+        if(file[0] == '-')
+            continue;
+        
+        if(replay_load(file, &r) == false)
+        {
+            ok = false;
+            continue;
+        }
+        if(r.ticks == 0)
+        {
+            printf("ok   %s: empty\n", file);
+            replay_free(&r);
+            continue;
+        }
+        
+        if(check_determinism(file, &r) == false)
+            ok = false;
+        else if(check_bless == true)
+            printf("Blessed %s, %d ticks\n", file, r.ticks);
+        else
+        {
+            // Timings of a game that went differently mean nothing
+            check_measure(file, &r);
+            if(check_savebaseline == false && check_performance(file) == false)
+                ok = false;
+            else if(check_savebaseline == true)
+                printf("ok   %s: %.0f ns/tick\n", file, check_find(check_measured, check_measuredcount, file, "logic")->ns);
+        }
+        
+        replay_free(&r);
+    }
+    
+    if(check_savebaseline == true && check_baselinefile != NULL && check_bless == false && ok == true)
+        if(check_writebaseline(check_baselinefile) == false)
+            ok = false;
+    
+    return ok == true ? 0 : 1;
+}
@@ -1,6 +1,12 @@
 #include "SDL/SDL.h"
 #include "clips.h"
 
+SDL_Rect clipPlayerNorm[2];
+SDL_Rect clipPlayerInvuln[2];
+SDL_Rect clipEnemyType1[2];
+SDL_Rect clipEnemyType2[2];
+SDL_Rect clipExplosion[8];
+
 void set_clips()
 {
     // normal player
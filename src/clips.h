@@ -1,7 +1,7 @@
 void set_clips();
 
-SDL_Rect clipPlayerNorm[2];
-SDL_Rect clipPlayerInvuln[2];
-SDL_Rect clipEnemyType1[2];
-SDL_Rect clipEnemyType2[2];
-SDL_Rect clipExplosion[8];
+extern SDL_Rect clipPlayerNorm[2];
+extern SDL_Rect clipPlayerInvuln[2];
+extern SDL_Rect clipEnemyType1[2];
+extern SDL_Rect clipEnemyType2[2];
+extern SDL_Rect clipExplosion[8];
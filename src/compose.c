@@ -0,0 +1,378 @@
+/*
+    Espada - A retro 2D space shooter
+    Copyright (C) 2011  Justin Jacobs
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SDL/SDL.h"
+#include "SDL/SDL_ttf.h"
+#include "SDL/SDL_mixer.h"
+
+#include <string.h>
+
+#include "main.h"
+#include "pool.h"
+#include "compose.h"
+#include "trace.h"
+
+#define COMPOSE_FILL 0
+#define COMPOSE_COPY 1
+#define COMPOSE_KEY 2
+#define COMPOSE_BLEND 3
+#define COMPOSE_PALETTE 4
+#define COMPOSE_ROWS 5
+
+typedef struct compose_item{
+    int type;
+    SDL_Surface* src;  // NULL for fills
+    SDL_Rect from;     // Source rectangle, already clipped
+    SDL_Rect to;       // Destination rectangle, same size as from
+    int alpha;
+    bool haskey;
+    Uint32 key;
+    Uint32 color;
+    const Uint32* palette;
+    void (*rows)(Uint8* row, int y, void* data);
+    void* data;
+}compose_item;
+
+typedef struct compose_palette{
+    SDL_Palette* pal;
+    Uint32 map[256];
+}compose_palette;
+
+static SDL_Surface* compose_dest = NULL;
+static bool compose_serial = false;
+static bool compose_destserial = false;
+static compose_item compose_items[MAXCOMPOSEITEMS];
+static int compose_count = 0;
+static compose_palette compose_palettes[MAXCOMPOSEPALETTES];
+static int compose_palettecount = 0;
+static SDL_Surface* compose_frees[MAXCOMPOSEITEMS];
+static int compose_freecount = 0;
+
+//------------------------------
+// Rasterizing
+//------------------------------
+static inline Uint32 compose_blend(Uint32 s, Uint32 d, Uint32 a) // Same arithmetic as SDL's per-surface alpha
+{
+    Uint32 s1 = s & 0xff00ff;
+    Uint32 d1 = d & 0xff00ff;
+    
+    d1 = (d1 + ((s1 - d1) * a >> 8)) & 0xff00ff;
+    s &= 0xff00;
+    d &= 0xff00;
+    d = (d + ((s - d) * a >> 8)) & 0xff00;
+    return d1 | d;
+}
+
+static void compose_row(const compose_item* it, Uint32* d, const Uint8* s, int n)
+{
+    const Uint32* s32 = (const Uint32*)s;
+    Uint32 a = it->alpha;
+    int x;
+    
+    switch(it->type)
+    {
+        case COMPOSE_FILL:
+            for(x=0;x<n;x++)
+                d[x] = it->color;
+            break;
+        case COMPOSE_COPY:
+            memcpy(d, s, n*sizeof(Uint32));
+            break;
+        case COMPOSE_KEY:
+            for(x=0;x<n;x++)
+                if(s32[x] != it->key)
+                    d[x] = s32[x];
+            break;
+        case COMPOSE_BLEND:
+            for(x=0;x<n;x++)
+                if(it->haskey == false || s32[x] != it->key)
+                    d[x] = compose_blend(s32[x], d[x], a);
+            break;
+        case COMPOSE_PALETTE:
+            for(x=0;x<n;x++)
+            {
+                if(it->haskey == true && s[x] == it->key)
+                    continue;
+                d[x] = a == 255 ? it->palette[s[x]] : compose_blend(it->palette[s[x]], d[x], a);
+            }
+            break;
+    }
+}
+
+static void compose_band(int band, int bands, void* data)
+{
+    SDL_Surface* dest = data;
+    int y0 = dest->h*band/bands;
+    int y1 = dest->h*(band+1)/bands;
+    int i,y;
+    
+    TRACE_BEGIN("compose_band");
+    for(i=0;i<compose_count;i++)
+    {
+        const compose_item* it = &compose_items[i];
+        int top = it->to.y > y0 ? it->to.y : y0;
+        int bottom = it->to.y+it->to.h < y1 ? it->to.y+it->to.h : y1;
+        
+        if(it->type == COMPOSE_ROWS)
+        {
+            for(y=top;y<bottom;y++)
+                it->rows((Uint8*)dest->pixels + y*dest->pitch + it->to.x*4, y, it->data);
+            continue;
+        }
+        
+        for(y=top;y<bottom;y++)
+        {
+            Uint32* d = (Uint32*)((Uint8*)dest->pixels + y*dest->pitch) + it->to.x;
+            const Uint8* s = NULL;
+            
+            if(it->src != NULL)
+                s = (const Uint8*)it->src->pixels + (it->from.y+y-it->to.y)*it->src->pitch
+                    + it->from.x*it->src->format->BytesPerPixel;
+            compose_row(it, d, s, it->to.w);
+        }
+    }
+    TRACE_END("compose_band");
+}
+
+static void compose_flush() // Draw everything recorded so far
+{
+    int i,y;
+    
+    if(compose_serial == true)
+    {
+        for(i=0;i<compose_count;i++)
+        {
+            compose_item* it = &compose_items[i];
+            if(it->type == COMPOSE_ROWS)
+            {
+                SDL_Surface* d = compose_dest;
+                if(SDL_MUSTLOCK(d))
+                    SDL_LockSurface(d);
+                for(y=it->to.y;y<it->to.y+it->to.h;y++)
+                    it->rows((Uint8*)d->pixels + y*d->pitch + it->to.x*d->format->BytesPerPixel, y, it->data);
+                if(SDL_MUSTLOCK(d))
+                    SDL_UnlockSurface(d);
+            }
+            else if(it->src == NULL)
+                SDL_FillRect(compose_dest, &it->to, it->color);
+            else
+            {
+                SDL_SetAlpha(it->src, SDL_SRCALPHA, it->alpha);
+                SDL_BlitSurface(it->src, &it->from, compose_dest, &it->to);
+            }
+        }
+    }
+    else if(compose_count > 0)
+    {
+        if(SDL_MUSTLOCK(compose_dest))
+            SDL_LockSurface(compose_dest);
+        pool_run(compose_band, compose_dest);
+        if(SDL_MUSTLOCK(compose_dest))
+            SDL_UnlockSurface(compose_dest);
+    }
+    
+    compose_count = 0;
+    compose_serial = compose_destserial;
+}
+
+//------------------------------
+// Recording
+//------------------------------
+static const Uint32* compose_getpalette(SDL_Palette* pal)
+{
+    int i;
+    
+    for(i=0;i<compose_palettecount;i++)
+        if(compose_palettes[i].pal == pal)
+            return compose_palettes[i].map;
+    
+    if(compose_palettecount == MAXCOMPOSEPALETTES)
+        return NULL;
+    
+    compose_palette* p = &compose_palettes[compose_palettecount++];
+    p->pal = pal;
+    memset(p->map, 0, sizeof(p->map));
+    for(i=0;i<pal->ncolors && i<256;i++)
+        p->map[i] = SDL_MapRGB(compose_dest->format, pal->colors[i].r, pal->colors[i].g, pal->colors[i].b);
+    return p->map;
+}
+
+static bool compose_classify(compose_item* it) // Pick a kernel for the source, false if there is none
+{
+    SDL_PixelFormat* sf = it->src->format;
+    SDL_PixelFormat* df = compose_dest->format;
+    
+    if(SDL_MUSTLOCK(it->src))
+        return false;
+    
+    it->haskey = (it->src->flags & SDL_SRCCOLORKEY) ? true : false;
+    it->key = sf->colorkey;
+    
+    if(sf->BitsPerPixel == 8 && sf->palette != NULL)
+    {
+        it->palette = compose_getpalette(sf->palette);
+        it->type = COMPOSE_PALETTE;
+        return it->palette != NULL ? true : false;
+    }
+    
+    if(sf->BytesPerPixel != 4 || sf->Amask != 0
+       || sf->Rmask != df->Rmask || sf->Gmask != df->Gmask || sf->Bmask != df->Bmask)
+        return false;
+    
+    if(it->alpha != 255)
+        it->type = COMPOSE_BLEND;
+    else if(it->haskey == true)
+        it->type = COMPOSE_KEY;
+    else
+        it->type = COMPOSE_COPY;
+    return true;
+}
+
+static compose_item* compose_next()
+{
+    if(compose_count == MAXCOMPOSEITEMS)
+        compose_flush();
+    return &compose_items[compose_count];
+}
+
+void compose_begin(SDL_Surface* dest)
+{
+    SDL_PixelFormat* df = dest->format;
+    
+    compose_dest = dest;
+    compose_count = 0;
+    compose_palettecount = 0;
+    
+    // The kernels blend bytes 0-2 of 32bpp pixels
+    compose_destserial = false;
+    if(df->BytesPerPixel != 4 || (df->Rmask|df->Gmask|df->Bmask) != 0xffffff)
+        compose_destserial = true;
+    compose_serial = compose_destserial;
+}
+
+SDL_Surface* compose_target()
+{
+    return compose_dest;
+}
+
+void compose_fill(Uint32 color)
+{
+    compose_item* it = compose_next();
+    
+    memset(it, 0, sizeof(compose_item));
+    it->type = COMPOSE_FILL;
+    it->color = color;
+    it->to = compose_dest->clip_rect;
+    compose_count++;
+}
+
+void compose_rows(void (*fn)(Uint8* row, int y, void* data), void* data)
+{
+    compose_item* it = compose_next();
+    
+    memset(it, 0, sizeof(compose_item));
+    it->type = COMPOSE_ROWS;
+    it->rows = fn;
+    it->data = data;
+    it->to = compose_dest->clip_rect;
+    compose_count++;
+}
+
+void compose_add(SDL_Surface* source, SDL_Rect* clip, int x, int y, int alpha)
+{
+    compose_item* it = compose_next();
+    SDL_Rect* c = &compose_dest->clip_rect;
+    int sx,sy,w,h,d;
+    
+    // Clip the same way SDL_BlitSurface() does, first to the source...
+    if(clip != NULL)
+    {
+        sx = clip->x;
+        sy = clip->y;
+        w = clip->w;
+        h = clip->h;
+    }
+    else
+    {
+        sx = 0;
+        sy = 0;
+        w = source->w;
+        h = source->h;
+    }
+    if(sx < 0) { w += sx; x -= sx; sx = 0; }
+    if(sy < 0) { h += sy; y -= sy; sy = 0; }
+    if(w > source->w-sx) w = source->w-sx;
+    if(h > source->h-sy) h = source->h-sy;
+    
+    // ...then to the destination
+    d = c->x - x;
+    if(d > 0) { w -= d; x += d; sx += d; }
+    d = x + w - (c->x+c->w);
+    if(d > 0) w -= d;
+    d = c->y - y;
+    if(d > 0) { h -= d; y += d; sy += d; }
+    d = y + h - (c->y+c->h);
+    if(d > 0) h -= d;
+    
+    if(w <= 0 || h <= 0)
+        return;
+    
+    memset(it, 0, sizeof(compose_item));
+    it->src = source;
+    it->from.x = sx;
+    it->from.y = sy;
+    it->from.w = w;
+    it->from.h = h;
+    it->to.x = x;
+    it->to.y = y;
+    it->to.w = w;
+    it->to.h = h;
+    it->alpha = alpha;
+    if(compose_classify(it) == false)
+        compose_serial = true;
+    compose_count++;
+}
+
+void compose_free(SDL_Surface* s)
+{
+    if(compose_dest == NULL)
+    {
+        image_free(s);
+        return;
+    }
+    
+    // Once everything recorded is drawn, nothing refers to the older ones
+    if(compose_freecount == MAXCOMPOSEITEMS)
+    {
+        compose_flush();
+        while(compose_freecount > 0)
+            image_free(compose_frees[--compose_freecount]);
+        compose_palettecount = 0;
+    }
+    compose_frees[compose_freecount++] = s;
+}
+
+void compose_end()
+{
+    compose_flush();
+    
+    while(compose_freecount > 0)
+        image_free(compose_frees[--compose_freecount]);
+    
+    compose_dest = NULL;
+}
@@ -0,0 +1,26 @@
+//------------------------------
+// Banded compositor
+//------------------------------
+// Between compose_begin() and compose_end(), image_apply() calls aimed at
+// the target surface are recorded instead of blitted. compose_end() splits
+// the target into one horizontal band per pool thread, clips the draw list
+// to each band and rasterizes the bands in parallel, back to front within
+// each band. Sources must be 32bpp in the target's format or 8bpp
+// palettized (TTF text); if anything else turns up, the frame is drawn
+// with plain SDL blits in the same order instead.
+//
+// compose_rows() records a callback that fills whole rows of the target
+// itself, called once per row from whichever band the row is in.
+//
+// Surfaces handed to compose_free() are freed once the frame is drawn.
+
+#define MAXCOMPOSEITEMS 1024
+#define MAXCOMPOSEPALETTES 16
+
+void compose_begin(SDL_Surface* dest);
+SDL_Surface* compose_target();
+void compose_fill(Uint32 color);
+void compose_add(SDL_Surface* source, SDL_Rect* clip, int x, int y, int alpha);
+void compose_rows(void (*fn)(Uint8* row, int y, void* data), void* data);
+void compose_free(SDL_Surface* s);
+void compose_end();
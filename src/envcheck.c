@@ -0,0 +1,221 @@
+/*
+    Espada - A retro 2D space shooter
+    Copyright (C) 2011  Justin Jacobs
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//------------------------------
+// Environment check
+//------------------------------
+// espada-envcheck plays one game with the same seed and the same made up
+// inputs through every kind of environment in the library, and fails if
+// they do not play out the same:
+//
+// - The state environment is the reference. Its state after every tick
+//   is kept, along with its observation.
+// - The pixel and gray environments must reach the same state on every
+//   tick. They load their images differently, but collide on the same
+//   masks.
+// - A batch of one game must give the same observations and end on the
+//   same tick.
+//
+// The check stops at the end of the game or after --ticks ticks.
+
+#include "SDL/SDL.h"
+#include "SDL/SDL_ttf.h"
+#include "SDL/SDL_mixer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "replay.h"
+#include "espada.h"
+
+#define ENVCHECK_HOLD 8  // Ticks each made up input is held for
+
+static const char* envcheck_partnames[STATEPARTS] = {"players","enemies","lasers","world"};
+
+static unsigned int envcheck_seed = 1;
+static int envcheck_ticks = 7200;
+
+static replay_hash* envcheck_hashes = NULL;  // Of the state environment, per tick
+static float* envcheck_obs = NULL;           // Of the state environment, per tick
+static int* envcheck_actions = NULL;
+static int envcheck_played = 0;              // Ticks until the game ended
+
+//------------------------------
+// Playing
+//------------------------------
+static void envcheck_makeactions()
+{
+    Uint32 s = envcheck_seed * 2654435761u + 1;
+    int t,a = 0;
+    
+    for(t=0;t<envcheck_ticks;t++)
+    {
+        if(t % ENVCHECK_HOLD == 0)
+        {
+            s ^= s << 13;
+            s ^= s >> 17;
+            s ^= s << 5;
+            a = s % 32;
+        }
+        envcheck_actions[t] = a;
+    }
+}
+
+static void envcheck_reference(espada_env* env)
+{
+    int t;
+    
+    espada_reset(env, envcheck_seed);
+    for(t=0;t<envcheck_ticks;t++)
+    {
+        const float* obs = espada_step(env, envcheck_actions[t]);
+        
+        replay_hashstate(&envcheck_hashes[t]);
+        memcpy(envcheck_obs + (size_t)t*ESPADA_STATE_SIZE, obs, ESPADA_STATE_SIZE*sizeof(float));
+        if(espada_done(env))
+        {
+            t++;
+            break;
+        }
+    }
+    envcheck_played = t;
+}
+
+static bool envcheck_compare(const char* name, espada_env* env) // Against the state environment
+{
+    replay_hash got;
+    int t,p;
+    
+    espada_reset(env, envcheck_seed);
+    for(t=0;t<envcheck_played;t++)
+    {
+        espada_step(env, envcheck_actions[t]);
+        replay_hashstate(&got);
+        if(memcmp(got.parts, envcheck_hashes[t].parts, sizeof(got.parts)) == 0)
+            continue;
+        
+        printf("FAIL %s: diverged from the state environment at tick %d\n", name, t+1);
+        for(p=0;p<STATEPARTS;p++)
+            if(got.parts[p] != envcheck_hashes[t].parts[p])
+                printf("     %s differ\n", envcheck_partnames[p]);
+        printf("     score %d, expected %d; wave %d, expected %d\n", got.score, envcheck_hashes[t].score, got.wave, envcheck_hashes[t].wave);
+        return false;
+    }
+    if(espada_done(env) != (envcheck_played < envcheck_ticks))
+    {
+        printf("FAIL %s: the game %s after %d ticks\n", name, espada_done(env) ? "ended" : "did not end", envcheck_played);
+        return false;
+    }
+    
+    printf("ok   %s: %d ticks\n", name, envcheck_played);
+    return true;
+}
+
+static bool envcheck_batch(espada_batch* b)
+{
+    unsigned int seed = envcheck_seed;
+    int t;
+    
+    espada_batch_reset(b, &seed);
+    for(t=0;t<envcheck_played;t++)
+    {
+        const float* obs = espada_batch_step(b, &envcheck_actions[t], &seed);
+        int done = espada_batch_dones(b)[0];
+        
+        if(done != (t+1 == envcheck_played && envcheck_played < envcheck_ticks))
+        {
+            printf("FAIL batch: the game %s at tick %d\n", done ? "ended" : "did not end", t+1);
+            return false;
+        }
+        // A game that ended has started over, there is nothing to compare
+        if(done == 0 && memcmp(obs, envcheck_obs + (size_t)t*ESPADA_STATE_SIZE, ESPADA_STATE_SIZE*sizeof(float)) != 0)
+        {
+            printf("FAIL batch: observation differs from the state environment at tick %d\n", t+1);
+            return false;
+        }
+    }
+    
+    printf("ok   batch: %d ticks\n", envcheck_played);
+    return true;
+}
+
+static void envcheck_usage()
+{
+    printf("Usage: espada-envcheck [options]\n"
+           "  --seed N           Seed of the game (%u)\n"
+           "  --ticks N          Most ticks to play (%d)\n", envcheck_seed, envcheck_ticks);
+}
+
+int main(int argc, char* argv[])
+{
+    espada_env* env;
+    espada_batch* b;
+    bool ok = true;
+    int i;
+    
+    for(i=1;i<argc;i++)
+    {
+        if(strcmp(argv[i],"--seed") == 0 && i+1 < argc)
+            envcheck_seed = strtoul(argv[++i], NULL, 10);
+        else if(strcmp(argv[i],"--ticks") == 0 && i+1 < argc)
+            envcheck_ticks = atoi(argv[++i]) > 0 ? atoi(argv[i]) : 1;
+        else
+        {
+            envcheck_usage();
+            return 2;
+        }
+    }
+    
+    envcheck_hashes = malloc(envcheck_ticks*sizeof(replay_hash));
+    envcheck_obs = malloc((size_t)envcheck_ticks*ESPADA_STATE_SIZE*sizeof(float));
+    envcheck_actions = malloc(envcheck_ticks*sizeof(int));
+    if(envcheck_hashes == NULL || envcheck_obs == NULL || envcheck_actions == NULL)
+        return 2;
+    envcheck_makeactions();
+    
+    // One environment at a time, the game state is global
+    if((env = espada_create(ESPADA_OBS_STATE)) == NULL)
+        return 2;
+    envcheck_reference(env);
+    espada_destroy(env);
+    
+    if((env = espada_create(ESPADA_OBS_PIXELS)) == NULL)
+        return 2;
+    if(envcheck_compare("pixels", env) == false)
+        ok = false;
+    espada_destroy(env);
+    
+    if((env = espada_create(ESPADA_OBS_GRAY)) == NULL)
+        return 2;
+    if(envcheck_compare("gray", env) == false)
+        ok = false;
+    espada_destroy(env);
+    
+    if((b = espada_batch_create(1)) == NULL)
+        return 2;
+    if(envcheck_batch(b) == false)
+        ok = false;
+    espada_batch_destroy(b);
+    
+    free(envcheck_hashes);
+    free(envcheck_obs);
+    free(envcheck_actions);
+    return ok == true ? 0 : 1;
+}
@@ -0,0 +1,256 @@
+/*
+    Espada - A retro 2D space shooter
+    Copyright (C) 2011  Justin Jacobs
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SDL/SDL.h"
+#include "SDL/SDL_image.h"
+#include "SDL/SDL_ttf.h"
+#include "SDL/SDL_mixer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "clips.h"
+#include "obs.h"
+#include "events.h"
+#include "espada.h"
+
+struct espada_env{
+    int obstype;
+    int obsw;
+    int obsh;
+    int obsstack;
+    int lastscore;
+    float reward;
+    float state[ESPADA_STATE_SIZE];
+};
+
+// The action bits and state layout in espada.h have to match the game
+typedef char espada_actions_check[(ESPADA_ACTION_LEFT == ACTION_LEFT && ESPADA_ACTION_RIGHT == ACTION_RIGHT &&
+                                   ESPADA_ACTION_UP == ACTION_UP && ESPADA_ACTION_DOWN == ACTION_DOWN &&
+                                   ESPADA_ACTION_FIRE == ACTION_FIRE) ? 1 : -1];
+typedef char espada_statesize_check[(5 + MAXLASERS*3 + MAXENEMIES*4 + MAXENEMIES*MAXLASERS*3 == ESPADA_STATE_SIZE) ? 1 : -1];
+
+static espada_env* espada_instance = NULL;
+
+static void espada_filllaser(float** s, laser* laz)
+{
+    float* p = *s;
+    
+    if(laz->alive == true)
+    {
+        p[0] = 1;
+        p[1] = laz->dim.x / (float)SCREEN_WIDTH;
+        p[2] = laz->dim.y / (float)SCREEN_HEIGHT;
+    }
+    else
+    {
+        p[0] = p[1] = p[2] = 0;
+    }
+    *s = p+3;
+}
+
+static const void* espada_observe(espada_env* env)
+{
+    int i,j;
+    float* s = env->state;
+    
+    if(env->obstype == ESPADA_OBS_PIXELS)
+    {
+        draw_everything();
+        return screen->pixels;
+    }
+    else if(env->obstype == ESPADA_OBS_GRAY)
+    {
+        return obs_render();
+    }
+    
+    s[0] = obj_player[0].alive == true;
+    s[1] = obj_player[0].dim.x / (float)SCREEN_WIDTH;
+    s[2] = obj_player[0].dim.y / (float)SCREEN_HEIGHT;
+    s[3] = obj_player[0].health / 5.0f;
+    s[4] = obj_player[0].invuln == true;
+    s += 5;
+    
+    for(i=0;i<MAXLASERS;i++)
+        espada_filllaser(&s,&obj_player[0].laz[i]);
+    
+    for(j=0;j<MAXENEMIES;j++)
+    {
+        if(obj_enemy[j].alive == true)
+        {
+            s[0] = 1;
+            s[1] = obj_enemy[j].type;
+            s[2] = obj_enemy[j].dim.x / (float)SCREEN_WIDTH;
+            s[3] = obj_enemy[j].dim.y / (float)SCREEN_HEIGHT;
+        }
+        else
+        {
+            s[0] = s[1] = s[2] = s[3] = 0;
+        }
+        s += 4;
+    }
+    
+    for(j=0;j<MAXENEMIES;j++)
+        for(i=0;i<MAXLASERS;i++)
+            espada_filllaser(&s,&obj_enemy[j].laz[i]);
+    
+    return env->state;
+}
+
+static espada_env* espada_createenv(int obstype, int w, int h, int stack)
+{
+    espada_env* env;
+    
+    if(espada_instance != NULL)
+        return NULL;
+    
+    env = calloc(1,sizeof(espada_env));
+    if(env == NULL)
+        return NULL;
+    env->obstype = obstype;
+    env->obsw = w;
+    env->obsh = h;
+    env->obsstack = stack < 1 ? 1 : stack;
+    
+    // Nothing drains the game events in the library
+    sound_enabled = false;
+    events_mute(true);
+    set_clips();
+    if(game_loadscripts() == false || game_loadmasks() == false)
+    {
+        free(env);
+        return NULL;
+    }
+    
+    if(obstype == ESPADA_OBS_PIXELS)
+    {
+        // Render offscreen unless the caller picked a video driver
+        setenv("SDL_VIDEODRIVER","dummy",0);
+        
+        if(SDL_Init(SDL_INIT_VIDEO) == -1 ||
+           (screen = SDL_SetVideoMode(SCREEN_WIDTH,SCREEN_HEIGHT,SCREEN_BPP,SDL_SWSURFACE)) == NULL ||
+           TTF_Init() == -1 ||
+           sys_loadfiles() == false ||
+           game_loadmasks() == false) // The same masks as the other modes, not the screen's
+        {
+            SDL_Quit();
+            free(env);
+            return NULL;
+        }
+    }
+    
+    else if(obstype == ESPADA_OBS_GRAY)
+    {
+        if(obs_init(w,h,env->obsstack) == 0)
+        {
+            free(env);
+            return NULL;
+        }
+    }
+    
+    espada_instance = env;
+    return env;
+}
+
+espada_env* espada_create(int obstype)
+{
+    if(obstype == ESPADA_OBS_GRAY)
+        return espada_createenv(ESPADA_OBS_GRAY,84,84,4);
+    if(obstype == ESPADA_OBS_PIXELS)
+        return espada_createenv(ESPADA_OBS_PIXELS,SCREEN_WIDTH,SCREEN_HEIGHT,1);
+    
+    return espada_createenv(ESPADA_OBS_STATE,0,0,0);
+}
+
+espada_env* espada_create_gray(int w, int h, int stack)
+{
+    if(w <= 0 || h <= 0)
+        return NULL;
+    
+    return espada_createenv(ESPADA_OBS_GRAY,w,h,stack);
+}
+
+void espada_destroy(espada_env* env)
+{
+    if(env == NULL || env != espada_instance)
+        return;
+    
+    if(env->obstype == ESPADA_OBS_PIXELS)
+        sys_cleanup();
+    else if(env->obstype == ESPADA_OBS_GRAY)
+        obs_cleanup();
+    
+    free(env);
+    espada_instance = NULL;
+}
+
+const void* espada_reset(espada_env* env, unsigned int seed)
+{
+    sys_seed(seed);
+    game_newgame();
+    memset(background_y, 0, sizeof(background_y));
+    obs_reset();
+    
+    env->lastscore = 0;
+    env->reward = 0;
+    return espada_observe(env);
+}
+
+const void* espada_step(espada_env* env, int actions)
+{
+    game_input[0] = actions & (ACTION_LEFT|ACTION_RIGHT|ACTION_UP|ACTION_DOWN|ACTION_FIRE);
+    
+    game_logic();
+    
+    env->reward = obj_player[0].score - env->lastscore;
+    env->lastscore = obj_player[0].score;
+    return espada_observe(env);
+}
+
+float espada_reward(espada_env* env)
+{
+    return env->reward;
+}
+
+int espada_done(espada_env* env)
+{
+    return gamestate_over == true;
+}
+
+void espada_obsshape(espada_env* env, int* w, int* h, int* pitch)
+{
+    if(env->obstype == ESPADA_OBS_PIXELS)
+    {
+        *w = screen->w;
+        *h = screen->h;
+        *pitch = screen->pitch;
+    }
+    else if(env->obstype == ESPADA_OBS_GRAY)
+    {
+        *w = env->obsw;
+        *h = env->obsh * env->obsstack;
+        *pitch = env->obsw;
+    }
+    else
+    {
+        *w = ESPADA_STATE_SIZE;
+        *h = 1;
+        *pitch = ESPADA_STATE_SIZE * sizeof(float);
+    }
+}
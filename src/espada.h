@@ -0,0 +1,75 @@
+#ifndef ESPADA_H
+#define ESPADA_H
+
+//------------------------------
+// libespada
+//------------------------------
+// C API for driving the game from automated agents. The game state is
+// global, so there can only be one environment per process. Images and
+// fonts are loaded from "res/" relative to the working directory.
+//
+// The state observation is ESPADA_STATE_SIZE floats, with positions
+// divided by the screen size:
+//   player:        alive, x, y, health/5, invulnerable
+//   player lasers: MAXLASERS * (alive, x, y)
+//   enemies:       MAXENEMIES * (alive, type, x, y)
+//   enemy lasers:  MAXENEMIES * MAXLASERS * (alive, x, y)
+//
+// The pixel observation is the 640x480 32bpp screen surface. The gray
+// observation is a stack of small 8-bit frames, oldest first, drawn without
+// any SDL video surface; espada_create() uses 84x84 with 4 frames, and
+// espada_create_gray() returns NULL unless the width and height are at
+// least 1. All of them point into buffers owned by the environment, which
+// stay valid until the next call to espada_step(), espada_reset() or
+// espada_destroy().
+//
+// A batch runs N independent games in lockstep without any SDL state, so
+// there can be any number of them. Every environment and batch collides on
+// the same pixel masks, loaded from the sprite sheets. Observations are
+// written to one contiguous N x ESPADA_STATE_SIZE buffer. A game that ends reports done
+// for that step and starts over from seeds[i], or from its own random state
+// when seeds is NULL; the observation returned is the first of the new game.
+// espada_batch_reset() takes seeds the same way; a batch that has not run
+// yet has no random state of its own, so its games would all start alike.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ESPADA_ACTION_LEFT 1
+#define ESPADA_ACTION_RIGHT 2
+#define ESPADA_ACTION_UP 4
+#define ESPADA_ACTION_DOWN 8
+#define ESPADA_ACTION_FIRE 16
+
+#define ESPADA_OBS_STATE 0
+#define ESPADA_OBS_PIXELS 1
+#define ESPADA_OBS_GRAY 2
+
+#define ESPADA_STATE_SIZE 96
+
+typedef struct espada_env espada_env;
+
+espada_env* espada_create(int obstype);
+espada_env* espada_create_gray(int w, int h, int stack);
+void espada_destroy(espada_env* env);
+const void* espada_reset(espada_env* env, unsigned int seed);
+const void* espada_step(espada_env* env, int actions);
+float espada_reward(espada_env* env);
+int espada_done(espada_env* env);
+void espada_obsshape(espada_env* env, int* w, int* h, int* pitch);
+
+typedef struct espada_batch espada_batch;
+
+espada_batch* espada_batch_create(int n);
+void espada_batch_destroy(espada_batch* b);
+const float* espada_batch_reset(espada_batch* b, const unsigned int* seeds);
+const float* espada_batch_step(espada_batch* b, const int* actions, const unsigned int* seeds);
+const float* espada_batch_rewards(espada_batch* b);
+const unsigned char* espada_batch_dones(espada_batch* b);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,101 @@
+/*
+    Espada - A retro 2D space shooter
+    Copyright (C) 2011  Justin Jacobs
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SDL/SDL.h"
+#include "SDL/SDL_ttf.h"
+#include "SDL/SDL_mixer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "main.h"
+#include "events.h"
+
+static game_event events_ring[GAMEEVENTS];
+static Uint32 events_head = 0; // Written by the producer only
+static Uint32 events_tail = 0; // Written by the consumer only
+static bool events_muted = false;
+static events_stats events_st;
+
+void events_push(int type, int a, int b)
+{
+    Uint32 head = events_head;
+    Uint32 tail = __atomic_load_n(&events_tail, __ATOMIC_ACQUIRE);
+    game_event* e;
+    
+    if(events_muted == true)
+        return;
+    if(head - tail == GAMEEVENTS)
+    {
+        events_st.dropped++;
+        return;
+    }
+    
+    e = &events_ring[head & (GAMEEVENTS-1)];
+    e->type = type;
+    e->a = a;
+    e->b = b;
+    
+    // The event must be complete before the consumer can see it
+    __atomic_store_n(&events_head, head+1, __ATOMIC_RELEASE);
+}
+
+bool events_pop(game_event* e)
+{
+    Uint32 tail = events_tail;
+    Uint32 head = __atomic_load_n(&events_head, __ATOMIC_ACQUIRE);
+    
+    if(tail == head)
+        return false;
+    
+    *e = events_ring[tail & (GAMEEVENTS-1)];
+    __atomic_store_n(&events_tail, tail+1, __ATOMIC_RELEASE);
+    
+    if(e->type >= 0 && e->type < GAMEEVENT_TYPES)
+        events_st.count[e->type]++;
+    return true;
+}
+
+void events_mute(bool mute)
+{
+    events_muted = mute;
+}
+
+bool events_live() // False while the logic's side effects are to be left out
+{
+    return events_muted == true ? false : true;
+}
+
+void events_getstats(events_stats* s)
+{
+    *s = events_st;
+}
+
+void events_report(FILE* f)
+{
+    if(events_st.count[GAMEEVENT_STATE] == 0)
+        return;
+    
+    fprintf(f,
+    "Game events: %llu shots, %llu explosions, %llu hits, %llu waves, %llu dropped\n",
+    (unsigned long long)events_st.count[GAMEEVENT_FIRE],
+    (unsigned long long)events_st.count[GAMEEVENT_EXPLOSION],
+    (unsigned long long)events_st.count[GAMEEVENT_DAMAGE],
+    (unsigned long long)events_st.count[GAMEEVENT_WAVE],
+    (unsigned long long)events_st.dropped);
+}
@@ -0,0 +1,47 @@
+//------------------------------
+// Game events
+//------------------------------
+// The game logic reports what happens as typed events instead of calling
+// into SDL_mixer. Events go into a lock-free ring with one producer (the
+// logic) and one consumer, which drains it once per frame and hands the
+// events to the audio. Logic ticks never wait on anything, and a full ring
+// drops events rather than stall. While muted, as during a netplay
+// re-simulation or in the headless library, events are not recorded, and
+// the logic's other side effects (trace instants, counters) check
+// events_live() so that re-simulated ticks are not counted twice.
+
+#define GAMEEVENTS 1024 // A power of two
+
+#define GAMEEVENT_FIRE 0      // a: player, or -1 for enemy b
+#define GAMEEVENT_EXPLOSION 1 // a,b: position
+#define GAMEEVENT_DAMAGE 2    // a: player, b: health lost
+#define GAMEEVENT_WAVE 3      // a: wave number
+#define GAMEEVENT_STATE 4     // a: one of the GAMESTATE_ values below
+#define GAMEEVENT_TYPES 5
+
+// A trace instant for something the logic did, left out while muted
+#define EVENTS_INSTANT(name) do{ if(events_live() == true) TRACE_INSTANT(name); }while(0)
+
+#define GAMESTATE_NEWGAME 0
+#define GAMESTATE_TITLE 1
+#define GAMESTATE_PAUSE 2
+#define GAMESTATE_RESUME 3
+#define GAMESTATE_OVER 4
+
+typedef struct game_event{
+    int type;
+    int a;
+    int b;
+}game_event;
+
+typedef struct events_stats{
+    Uint64 count[GAMEEVENT_TYPES];
+    Uint64 dropped;
+}events_stats;
+
+void events_push(int type, int a, int b);
+bool events_pop(game_event* e);
+void events_mute(bool mute);
+bool events_live();
+void events_getstats(events_stats* s);
+void events_report(FILE* f);
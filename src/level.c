@@ -0,0 +1,466 @@
+/*
+    Espada - A retro 2D space shooter
+    Copyright (C) 2011  Justin Jacobs
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SDL/SDL.h"
+#include "SDL/SDL_ttf.h"
+#include "SDL/SDL_mixer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "main.h"
+#include "pacer.h"
+#include "compose.h"
+#include "events.h"
+#include "level.h"
+#include "trace.h"
+
+#define LEVEL_PLACEMENTSIZE 8
+#define LEVEL_EVENTSIZE 32
+#define LEVEL_TEXTSIZE 28
+#define LEVEL_LISTS (LEVELROWS*LEVELCOLS)  // Where the counts start in a chunk
+
+typedef struct level_slot{
+    SDL_Surface* scenery;
+    int chunk;   // -1 for none
+    bool ready;  // Scenery drawn, safe to use until the chunk changes
+}level_slot;
+
+static const Uint8* level_map = NULL;
+static size_t level_size = 0;
+static int level_chunks = 0;
+static int level_speed = 1;
+static SDL_Surface* level_tileset = NULL;
+static level_stats level_st;
+
+// Shared with the prefetch thread, under level_lock
+static level_slot level_slots[LEVELSLOTS];
+static int level_current = 0;  // First chunk still in view
+static bool level_quit = false;
+static SDL_mutex* level_lock = NULL;
+static SDL_cond* level_wake = NULL;
+static SDL_Thread* level_thread = NULL;
+
+//------------------------------
+// Reading
+//------------------------------
+static int level_u16(const Uint8* p)
+{
+    Uint16 v;
+    memcpy(&v, p, sizeof(v));
+    return SDL_SwapLE16(v);
+}
+
+static Uint32 level_u32(const Uint8* p)
+{
+    Uint32 v;
+    memcpy(&v, p, sizeof(v));
+    return SDL_SwapLE32(v);
+}
+
+static const Uint8* level_chunk(int k, int* placements, int* events) // NULL for a chunk that does not fit
+{
+    const Uint8* c = level_map + (size_t)(k+1)*LEVELCHUNKSIZE;
+    
+    *placements = level_u16(c + LEVEL_LISTS);
+    *events = level_u16(c + LEVEL_LISTS + 2);
+    if(LEVEL_LISTS + 4 + *placements*LEVEL_PLACEMENTSIZE + *events*LEVEL_EVENTSIZE > LEVELCHUNKSIZE)
+        return NULL;
+    return c;
+}
+
+//------------------------------
+// Prefetching
+//------------------------------
+#ifndef _WIN32
+static void level_advise(int k, int advice) // Page size permitting
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    
+    if(LEVELCHUNKSIZE % page == 0)
+        madvise((void*)(level_map + (size_t)(k+1)*LEVELCHUNKSIZE), LEVELCHUNKSIZE, advice);
+}
+
+static void level_decode(int k, SDL_Surface* s) // Draw a chunk's scenery
+{
+    const Uint8* c;
+    SDL_Rect from,to;
+    int perrow = level_tileset->w / LEVELTILE;
+    int count = perrow * (level_tileset->h / LEVELTILE);
+    int placements,events;
+    int x,y;
+    
+    level_advise(k, MADV_WILLNEED);
+    SDL_FillRect(s, NULL, s->format->colorkey);
+    c = level_chunk(k, &placements, &events);
+    if(c == NULL)
+        return;
+    
+    from.w = to.w = LEVELTILE;
+    from.h = to.h = LEVELTILE;
+    for(y=0;y<LEVELROWS;y++)
+    {
+        for(x=0;x<LEVELCOLS;x++)
+        {
+            int t = c[y*LEVELCOLS + x] - 1;
+            if(t < 0 || t >= count)
+                continue;
+            
+            from.x = (t % perrow) * LEVELTILE;
+            from.y = (t / perrow) * LEVELTILE;
+            to.x = x * LEVELTILE;
+            to.y = LEVELCHUNKHEIGHT - (y+1)*LEVELTILE;
+            SDL_BlitSurface(level_tileset, &from, s, &to);
+        }
+    }
+}
+
+static bool level_held(int k)
+{
+    int i;
+    
+    for(i=0;i<LEVELSLOTS;i++)
+        if(level_slots[i].chunk == k)
+            return true;
+    return false;
+}
+
+static int level_prefetcher(void* data)
+{
+    TRACE_THREAD("level");
+    SDL_LockMutex(level_lock);
+    while(level_quit == false)
+    {
+        int want = -1;
+        int slot = 0;
+        int old,k,i;
+        Uint64 start,took;
+        
+        // The first chunk from the camera on that no slot has
+        for(k=level_current;k<level_current+LEVELSLOTS && k<level_chunks;k++)
+        {
+            if(level_held(k) == false)
+            {
+                want = k;
+                break;
+            }
+        }
+        if(want < 0)
+        {
+            SDL_CondWait(level_wake, level_lock);
+            continue;
+        }
+        
+        // Any slot with a chunk outside that window will do
+        for(i=0;i<LEVELSLOTS;i++)
+        {
+            if(level_slots[i].chunk < level_current || level_slots[i].chunk >= level_current+LEVELSLOTS)
+            {
+                slot = i;
+                break;
+            }
+        }
+        old = level_slots[slot].chunk;
+        level_slots[slot].chunk = want;
+        level_slots[slot].ready = false;
+        SDL_UnlockMutex(level_lock);
+        
+        // The slot is ours until it is marked ready
+        TRACE_BEGIN("level_decode");
+        start = pacer_now();
+        if(old >= 0)
+            level_advise(old, MADV_DONTNEED);
+        level_decode(want, level_slots[slot].scenery);
+        took = pacer_now() - start;
+        TRACE_END("level_decode");
+        
+        SDL_LockMutex(level_lock);
+        level_slots[slot].ready = true;
+        level_st.decoded++;
+        level_st.decode_total += took;
+        if(took > level_st.decode_max)
+            level_st.decode_max = took;
+    }
+    SDL_UnlockMutex(level_lock);
+    
+    return 0;
+}
+#endif
+
+//------------------------------
+// Playing
+//------------------------------
+bool level_open(const char* file) // After the video mode is set
+{
+#ifndef _WIN32
+    struct stat st;
+    char tileset[53];
+    SDL_PixelFormat* f = screen->format;
+    int fd,i;
+    
+    fd = open(file, O_RDONLY);
+    if(fd < 0 || fstat(fd, &st) != 0 || st.st_size < LEVELCHUNKSIZE)
+    {
+        fprintf(stderr, "Unable to open level %s\n", file);
+        if(fd >= 0)
+            close(fd);
+        return false;
+    }
+    
+    level_size = st.st_size;
+    level_map = mmap(NULL, level_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(level_map == MAP_FAILED)
+    {
+        level_map = NULL;
+        fprintf(stderr, "Unable to map level %s\n", file);
+        return false;
+    }
+    
+    level_chunks = level_u32(level_map + 12);
+    level_speed = level_u32(level_map + 16);
+    if(memcmp(level_map, "ESPLEVEL", 8) != 0 || level_u32(level_map + 8) != LEVELVERSION
+       || level_speed < 1 || level_speed > LEVELCHUNKHEIGHT
+       || level_chunks < 1 || (size_t)level_chunks >= level_size/LEVELCHUNKSIZE)
+    {
+        fprintf(stderr, "%s is not a version %d level\n", file, LEVELVERSION);
+        level_close();
+        return false;
+    }
+    
+    memcpy(tileset, level_map + 20, 52);
+    tileset[52] = '\0';
+    level_tileset = image_load(tileset, true);
+    if(level_tileset == NULL)
+    {
+        fprintf(stderr, "Unable to load the level's tiles from %s\n", tileset);
+        level_close();
+        return false;
+    }
+    
+    // Same format as the screen, so that compose can copy them
+    for(i=0;i<LEVELSLOTS;i++)
+    {
+        SDL_Surface* s = SDL_CreateRGBSurface(SDL_SWSURFACE, SCREEN_WIDTH, LEVELCHUNKHEIGHT, 32,
+                                              f->Rmask, f->Gmask, f->Bmask, 0);
+        if(s == NULL)
+        {
+            level_close();
+            return false;
+        }
+        SDL_SetColorKey(s, SDL_SRCCOLORKEY, SDL_MapRGB(s->format, 0xFF, 0, 0xFF));
+        level_slots[i].scenery = s;
+        level_slots[i].chunk = -1;
+        level_slots[i].ready = false;
+    }
+    
+    // The start is drawn before anything else happens
+    for(i=0;i<2 && i<level_chunks;i++)
+    {
+        level_decode(i, level_slots[i].scenery);
+        level_slots[i].chunk = i;
+        level_slots[i].ready = true;
+    }
+    
+    memset(&level_st, 0, sizeof(level_st));
+    level_current = 0;
+    level_quit = false;
+    level_lock = SDL_CreateMutex();
+    level_wake = SDL_CreateCond();
+    level_thread = SDL_CreateThread(level_prefetcher, NULL);
+    if(level_thread == NULL)
+    {
+        fprintf(stderr, "Unable to start the level thread\n");
+        level_close();
+        return false;
+    }
+    
+    return true;
+#else
+    fprintf(stderr, "Levels are not supported on this platform\n");
+    return false;
+#endif
+}
+
+bool level_active()
+{
+    return level_map != NULL ? true : false;
+}
+
+static void level_follow(int k) // Tell the prefetcher where the camera is
+{
+    if(k == level_current)
+        return;
+    SDL_LockMutex(level_lock);
+    level_current = k;
+    SDL_CondSignal(level_wake);
+    SDL_UnlockMutex(level_lock);
+}
+
+bool level_update(int tick) // Places what scrolled into view this tick, false once the level is over
+{
+    int camera,top,prevtop,k,i,e;
+    
+    if(level_map == NULL)
+        return false;
+    camera = tick * level_speed;
+    if(camera >= level_chunks*LEVELCHUNKHEIGHT)
+        return false;
+    level_follow(camera / LEVELCHUNKHEIGHT);
+    
+    // Everything between the top of the screen last tick and now
+    top = camera + SCREEN_HEIGHT;
+    prevtop = tick > 0 ? top - level_speed : -1;
+    for(k=(prevtop+1)/LEVELCHUNKHEIGHT;k<=top/LEVELCHUNKHEIGHT && k<level_chunks;k++)
+    {
+        int base = k*LEVELCHUNKHEIGHT;
+        int placements,events;
+        const Uint8* c = level_chunk(k, &placements, &events);
+        const Uint8* p;
+        
+        if(c == NULL)
+            continue;
+        
+        p = c + LEVEL_LISTS + 4;
+        for(i=0;i<placements;i++,p+=LEVEL_PLACEMENTSIZE)
+        {
+            int at = base + level_u16(p);
+            int type = level_u16(p+4);
+            
+            if(at <= prevtop || at > top || type >= enemy_scriptcount || type >= MAXENEMYTYPES)
+                continue;
+            // Coming in from the top, like the waves
+            e = game_enemyplace(type, (Sint16)level_u16(p+2), 0);
+            if(e >= 0)
+                obj_enemy[e].dim.y = top - at - obj_enemy[e].dim.h;
+            else if(events_live() == true)
+                level_st.dropped++;
+        }
+        for(i=0;i<events;i++,p+=LEVEL_EVENTSIZE)
+        {
+            int at = base + level_u16(p);
+            char text[LEVEL_TEXTSIZE+1];
+            
+            if(at <= prevtop || at > top || level_u16(p+2) != LEVELEVENT_TEXT)
+                continue;
+            memcpy(text, p+4, LEVEL_TEXTSIZE);
+            text[LEVEL_TEXTSIZE] = '\0';
+            game_setstatustext(text, 120);
+        }
+    }
+    
+    return true;
+}
+
+void level_draw(int tick)
+{
+    int camera = tick * level_speed;
+    int k,i;
+    
+    if(level_map == NULL || camera >= level_chunks*LEVELCHUNKHEIGHT)
+        return;
+    
+    for(k=camera/LEVELCHUNKHEIGHT;k<=(camera+SCREEN_HEIGHT-1)/LEVELCHUNKHEIGHT && k<level_chunks;k++)
+    {
+        SDL_Surface* s = NULL;
+        
+        SDL_LockMutex(level_lock);
+        for(i=0;i<LEVELSLOTS;i++)
+            if(level_slots[i].chunk == k && level_slots[i].ready == true)
+                s = level_slots[i].scenery;
+        SDL_UnlockMutex(level_lock);
+        
+        if(s == NULL)
+        {
+            TRACE_INSTANT("level late");
+            level_st.late++;
+            continue;
+        }
+        compose_add(s, NULL, 0, SCREEN_HEIGHT + camera - (k+1)*LEVELCHUNKHEIGHT, 255);
+    }
+}
+
+void level_close()
+{
+#ifndef _WIN32
+    int i;
+    
+    if(level_thread != NULL)
+    {
+        SDL_LockMutex(level_lock);
+        level_quit = true;
+        SDL_CondSignal(level_wake);
+        SDL_UnlockMutex(level_lock);
+        SDL_WaitThread(level_thread, NULL);
+    }
+    level_thread = NULL;
+    if(level_wake != NULL)
+        SDL_DestroyCond(level_wake);
+    if(level_lock != NULL)
+        SDL_DestroyMutex(level_lock);
+    level_wake = NULL;
+    level_lock = NULL;
+    
+    for(i=0;i<LEVELSLOTS;i++)
+    {
+        if(level_slots[i].scenery != NULL)
+            SDL_FreeSurface(level_slots[i].scenery);
+        level_slots[i].scenery = NULL;
+    }
+    image_free(level_tileset);
+    level_tileset = NULL;
+    
+    if(level_map != NULL)
+        munmap((void*)level_map, level_size);
+    level_map = NULL;
+#endif
+}
+
+//------------------------------
+// Statistics
+//------------------------------
+void level_getstats(level_stats* s)
+{
+    if(level_lock != NULL)
+        SDL_LockMutex(level_lock);
+    *s = level_st;
+    if(level_lock != NULL)
+        SDL_UnlockMutex(level_lock);
+}
+
+void level_report(FILE* f)
+{
+    level_stats s;
+    
+    level_getstats(&s);
+    if(s.decoded == 0)
+        return;
+    
+    fprintf(f,
+    "Level: %llu chunks prefetched, decode avg/max: %.3f/%.3f ms\n"
+    "Frames drawn without scenery: %llu, enemies dropped: %llu\n",
+    (unsigned long long)s.decoded, s.decode_total/(double)s.decoded/1000000.0, s.decode_max/1000000.0,
+    (unsigned long long)s.late, (unsigned long long)s.dropped);
+}
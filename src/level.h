@@ -0,0 +1,58 @@
+//------------------------------
+// Streamed levels
+//------------------------------
+// A level is a long stage that scrolls by at a fixed speed, with scenery
+// and enemy placements along the way, in place of the endless waves. Once
+// the end of the level has scrolled past, the waves take over.
+//
+// The file is memory-mapped and split into LEVELCHUNKSIZE chunks, each
+// covering LEVELCHUNKHEIGHT pixels of scrolling. The logic reads the
+// placements straight from the mapping, so where the game is depends on
+// nothing but the tick. A prefetch thread pages in the chunks ahead of the
+// camera, draws their scenery into one of LEVELSLOTS preallocated surfaces
+// and hands the pages of the passed ones back, so memory use does not
+// depend on the level's length. A chunk whose scenery is not ready when it
+// comes into view is drawn without it rather than waited for.
+//
+// All values are little-endian. The first chunk is the header:
+//   char magic[8]      "ESPLEVEL"
+//   Uint32 version     LEVELVERSION
+//   Uint32 chunks      Chunks after the header
+//   Uint32 speed       Pixels scrolled per tick, 1 to LEVELCHUNKHEIGHT
+//   char tileset[52]   Image of LEVELTILE square tiles, magenta is clear
+// Each chunk after it:
+//   Uint8 tiles[LEVELROWS][LEVELCOLS]  Bottom row first, 0 for no tile,
+//                                      otherwise 1 + the tile's index
+//   Uint16 placements, events          How many of each follow
+//   placements * {Uint16 at; Sint16 x; Uint16 type; Uint16 unused;}
+//   events * {Uint16 at; Uint16 type; char text[28];}
+// where at is the distance into the chunk, in pixels, at which an enemy of
+// that type enters at the top of the screen, or the event happens. Both
+// lists are sorted by at. espada-levelgen writes levels in this format
+// from a text description (see src/levelgen.c).
+
+#define LEVELVERSION 1
+#define LEVELCHUNKSIZE 4096
+#define LEVELCHUNKHEIGHT 512
+#define LEVELTILE 32
+#define LEVELCOLS (SCREEN_WIDTH/LEVELTILE)
+#define LEVELROWS (LEVELCHUNKHEIGHT/LEVELTILE)
+#define LEVELSLOTS 4  // Chunks of scenery drawn ahead
+
+#define LEVELEVENT_TEXT 0  // Show text in the status line
+
+typedef struct level_stats{
+    Uint64 decoded;
+    Uint64 late;         // Chunks that came into view without their scenery
+    Uint64 dropped;      // Placements with no free enemy to use
+    Uint64 decode_total; // Nanoseconds
+    Uint64 decode_max;
+}level_stats;
+
+bool level_open(const char* file);
+bool level_active();
+bool level_update(int tick);
+void level_draw(int tick);
+void level_close();
+void level_getstats(level_stats* s);
+void level_report(FILE* f);
@@ -0,0 +1,286 @@
+/*
+    Espada - A retro 2D space shooter
+    Copyright (C) 2011  Justin Jacobs
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//------------------------------
+// Level check
+//------------------------------
+// espada-levelcheck scrolls through a level headless, one tick at a time
+// until it is over, and fails if:
+//
+// - A placement does not spawn exactly once, on the first tick its
+//   distance is at or below the top of the screen, and that far above it.
+//   The placements are read from the file here, not through src/level.c.
+// - The prefetch thread has not decoded each chunk of the window ahead of
+//   the camera exactly once within a second of the camera reaching it, or
+//   a chunk in view is drawn without its scenery.
+//
+// Enemies are taken away after every tick so that none are dropped for
+// want of a free one.
+
+#include "SDL/SDL.h"
+#include "SDL/SDL_ttf.h"
+#include "SDL/SDL_mixer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "clips.h"
+#include "compose.h"
+#include "events.h"
+#include "level.h"
+
+#define LEVELCHECK_WAIT 1000  // Milliseconds the prefetcher gets per chunk
+#define LEVELCHECK_LISTS (LEVELROWS*LEVELCOLS)
+
+typedef struct levelcheck_placement{
+    int at;     // From the start of the level
+    int x;
+    int type;
+    int tick;   // It should spawn on, -1 for never
+    int spawns;
+}levelcheck_placement;
+
+static levelcheck_placement* levelcheck_placements = NULL;
+static int levelcheck_count = 0;
+static int levelcheck_chunks = 0;
+static int levelcheck_speed = 1;
+static int levelcheck_boundaries = 0;  // Ticks that placed from two chunks
+
+//------------------------------
+// Reading
+//------------------------------
+static int levelcheck_u16(const Uint8* p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static int levelcheck_u32(const Uint8* p)
+{
+    return levelcheck_u16(p) | (levelcheck_u16(p+2) << 16);
+}
+
+static int levelcheck_tick(int at) // First tick the top of the screen reaches at
+{
+    int tick = 0;
+    
+    if(at > SCREEN_HEIGHT)
+        tick = (at - SCREEN_HEIGHT + levelcheck_speed-1) / levelcheck_speed;
+    return tick*levelcheck_speed < levelcheck_chunks*LEVELCHUNKHEIGHT ? tick : -1;
+}
+
+static bool levelcheck_load(const char* file)
+{
+    Uint8 chunk[LEVELCHUNKSIZE];
+    FILE* f = fopen(file, "rb");
+    int k,i;
+    
+    if(f == NULL || fread(chunk, 1, LEVELCHUNKSIZE, f) != LEVELCHUNKSIZE)
+    {
+        fprintf(stderr, "Unable to read level %s\n", file);
+        if(f != NULL)
+            fclose(f);
+        return false;
+    }
+    levelcheck_chunks = levelcheck_u32(chunk+12);
+    levelcheck_speed = levelcheck_u32(chunk+16);
+    if(levelcheck_speed < 1 || levelcheck_chunks < 1)
+    {
+        fprintf(stderr, "%s is not a level\n", file);
+        fclose(f);
+        return false;
+    }
+    
+    for(k=0;k<levelcheck_chunks && fread(chunk, 1, LEVELCHUNKSIZE, f) == LEVELCHUNKSIZE;k++)
+    {
+        int placements = levelcheck_u16(chunk+LEVELCHECK_LISTS);
+        const Uint8* p = chunk + LEVELCHECK_LISTS + 4;
+        levelcheck_placement* more;
+        
+        if(LEVELCHECK_LISTS + 4 + placements*8 > LEVELCHUNKSIZE)
+            break;
+        if(placements == 0)
+            continue;
+        more = realloc(levelcheck_placements, (levelcheck_count+placements)*sizeof(levelcheck_placement));
+        if(more == NULL)
+            break;
+        levelcheck_placements = more;
+        for(i=0;i<placements;i++,p+=8)
+        {
+            levelcheck_placement* pl = &levelcheck_placements[levelcheck_count++];
+            
+            pl->at = k*LEVELCHUNKHEIGHT + levelcheck_u16(p);
+            pl->x = (Sint16)levelcheck_u16(p+2);
+            pl->type = levelcheck_u16(p+4);
+            pl->tick = pl->type < enemy_scriptcount ? levelcheck_tick(pl->at) : -1;
+            pl->spawns = 0;
+        }
+    }
+    fclose(f);
+    if(k < levelcheck_chunks)
+    {
+        fprintf(stderr, "Unable to read chunk %d of %s\n", k, file);
+        return false;
+    }
+    
+    printf("%s: %d chunks, speed %d, %d placements\n", file, levelcheck_chunks, levelcheck_speed, levelcheck_count);
+    return true;
+}
+
+//------------------------------
+// Checking
+//------------------------------
+static bool levelcheck_spawned(int tick) // Match this tick's enemies to the placements
+{
+    int top = tick*levelcheck_speed + SCREEN_HEIGHT;
+    int chunk = -1;
+    bool across = false;
+    bool ok = true;
+    int i,j;
+    
+    for(i=0;i<MAXENEMIES;i++)
+    {
+        enemy* e = &obj_enemy[i];
+        int at = top - e->dim.y - e->dim.h;
+        levelcheck_placement* pl = NULL;
+        
+        if(e->alive == false)
+            continue;
+        for(j=0;j<levelcheck_count && pl == NULL;j++)
+            if(levelcheck_placements[j].at == at && levelcheck_placements[j].x == e->dim.x && levelcheck_placements[j].type == e->type)
+                pl = &levelcheck_placements[j];
+        
+        if(pl == NULL)
+        {
+            printf("FAIL tick %d: enemy of type %d at x %d, %d pixels in, is not a placement\n", tick, e->type, e->dim.x, at);
+            ok = false;
+            continue;
+        }
+        pl->spawns++;
+        if(pl->spawns > 1)
+        {
+            printf("FAIL tick %d: placement %d pixels in at x %d spawned again\n", tick, pl->at, pl->x);
+            ok = false;
+        }
+        else if(pl->tick != tick)
+        {
+            printf("FAIL tick %d: placement %d pixels in at x %d spawned, expected on tick %d\n", tick, pl->at, pl->x, pl->tick);
+            ok = false;
+        }
+        
+        if(chunk >= 0 && chunk != at/LEVELCHUNKHEIGHT)
+            across = true;
+        chunk = at/LEVELCHUNKHEIGHT;
+        
+        e->alive = false;
+    }
+    game_enemytotal = 0;
+    if(across == true)
+        levelcheck_boundaries++;
+    
+    return ok;
+}
+
+static bool levelcheck_prefetched(int tick) // Wait for the window ahead of the camera
+{
+    int k = tick*levelcheck_speed / LEVELCHUNKHEIGHT;
+    int want = (k+LEVELSLOTS < levelcheck_chunks ? k+LEVELSLOTS : levelcheck_chunks);
+    int waited = 0;
+    level_stats s;
+    
+    // The first two are decoded when the level opens, every other one once
+    want -= levelcheck_chunks < 2 ? levelcheck_chunks : 2;
+    level_getstats(&s);
+    while((int)s.decoded < want && waited < LEVELCHECK_WAIT)
+    {
+        SDL_Delay(1);
+        waited++;
+        level_getstats(&s);
+    }
+    if((int)s.decoded != want)
+    {
+        printf("FAIL tick %d: %d chunks prefetched with the camera in chunk %d, expected %d\n", tick, (int)s.decoded, k, want);
+        return false;
+    }
+    
+    compose_begin(screen);
+    level_draw(tick);
+    compose_end();
+    level_getstats(&s);
+    if(s.late > 0)
+    {
+        printf("FAIL tick %d: chunk drawn without its scenery\n", tick);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    bool ok = true;
+    int tick,i;
+    
+    if(argc != 2)
+    {
+        printf("Usage: espada-levelcheck LEVEL\n");
+        return 2;
+    }
+    
+    // The level loads its tiles in the screen's format
+    setenv("SDL_VIDEODRIVER","dummy",0);
+    if(SDL_Init(SDL_INIT_VIDEO) == -1 ||
+       (screen = SDL_SetVideoMode(SCREEN_WIDTH,SCREEN_HEIGHT,SCREEN_BPP,SDL_SWSURFACE)) == NULL)
+    {
+        fprintf(stderr, "Unable to set the video mode: %s\n", SDL_GetError());
+        return 2;
+    }
+    sound_enabled = false;
+    events_mute(true);
+    set_clips();
+    if(game_loadscripts() == false || levelcheck_load(argv[1]) == false || level_open(argv[1]) == false)
+        return 2;
+    
+    for(tick=0;level_update(tick) == true;tick++)
+    {
+        if(levelcheck_spawned(tick) == false || levelcheck_prefetched(tick) == false)
+        {
+            ok = false;
+            break;
+        }
+    }
+    
+    for(i=0;i<levelcheck_count && ok == true;i++)
+    {
+        levelcheck_placement* pl = &levelcheck_placements[i];
+        
+        if(pl->tick >= 0 && pl->spawns == 0)
+        {
+            printf("FAIL placement %d pixels in at x %d never spawned, expected on tick %d\n", pl->at, pl->x, pl->tick);
+            ok = false;
+        }
+    }
+    
+    if(ok == true)
+        printf("ok   %d ticks, %d placements, %d ticks across a chunk boundary\n", tick, levelcheck_count, levelcheck_boundaries);
+    level_report(stdout);
+    level_close();
+    free(levelcheck_placements);
+    SDL_Quit();
+    return ok == true ? 0 : 1;
+}
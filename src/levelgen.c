@@ -0,0 +1,302 @@
+/*
+    Espada - A retro 2D space shooter
+    Copyright (C) 2011  Justin Jacobs
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//------------------------------
+// Level generator
+//------------------------------
+// espada-levelgen turns a text description of a level into the file that
+// --level plays (see src/level.h). One statement per line, # starts a
+// comment, and distances are in pixels from the start of the level:
+//
+//   speed N                  Pixels scrolled per tick
+//   tileset FILE             Image of the tiles
+//   length N                 At least N pixels long, in whole chunks
+//   enemy AT X TYPE          An enemy of TYPE enters at X
+//   text AT MESSAGE...       MESSAGE, up to 28 characters, shows in the
+//                            status line
+//   row ROW TILE...          Tiles of row ROW, counted in tiles from the
+//                            bottom of the level, left to right; a tile
+//                            is its index in the tileset or . for none
+//
+// The level is as long as the length or the last thing in it, whichever
+// is further. Placements and events may come in any order.
+
+#include "SDL/SDL.h"
+#include "SDL/SDL_ttf.h"
+#include "SDL/SDL_mixer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "level.h"
+
+#define LEVELGEN_MAXITEMS 4096
+#define LEVELGEN_MAXCHUNKS 1024
+#define LEVELGEN_LISTS (LEVELROWS*LEVELCOLS)
+
+typedef struct levelgen_item{
+    int at;
+    int x;      // Enemies only
+    int type;
+    char text[28];
+    bool event;
+}levelgen_item;
+
+static levelgen_item levelgen_items[LEVELGEN_MAXITEMS];
+static int levelgen_count = 0;
+static Uint8 levelgen_tiles[LEVELGEN_MAXCHUNKS][LEVELROWS][LEVELCOLS];
+static int levelgen_speed = 1;
+static int levelgen_length = 0;
+static char levelgen_tileset[52];
+
+//------------------------------
+// Reading
+//------------------------------
+static bool levelgen_add(const char* file, int n, int at, int x, int type, const char* text)
+{
+    levelgen_item* it;
+    
+    if(levelgen_count == LEVELGEN_MAXITEMS || at < 0 || at >= LEVELGEN_MAXCHUNKS*LEVELCHUNKHEIGHT)
+    {
+        fprintf(stderr, "%s:%d: at most %d placements and events, within %d pixels\n", file, n, LEVELGEN_MAXITEMS, LEVELGEN_MAXCHUNKS*LEVELCHUNKHEIGHT);
+        return false;
+    }
+    it = &levelgen_items[levelgen_count++];
+    it->at = at;
+    it->x = x;
+    it->type = type;
+    it->event = text != NULL ? true : false;
+    memset(it->text, 0, sizeof(it->text));
+    if(text != NULL)
+        strncpy(it->text, text, sizeof(it->text));
+    if(at+1 > levelgen_length)
+        levelgen_length = at+1;
+    return true;
+}
+
+static bool levelgen_row(const char* file, int n, char* args)
+{
+    char* tok = strtok(args, " \t");
+    int row,col;
+    
+    row = tok != NULL ? atoi(tok) : -1;
+    if(row < 0 || row >= LEVELGEN_MAXCHUNKS*LEVELROWS)
+    {
+        fprintf(stderr, "%s:%d: row out of range\n", file, n);
+        return false;
+    }
+    for(col=0;(tok = strtok(NULL, " \t")) != NULL;col++)
+    {
+        int t = tok[0] == '.' ? -1 : atoi(tok);
+        
+        if(col == LEVELCOLS || t > 254)
+        {
+            fprintf(stderr, "%s:%d: at most %d tiles of index 0 to 254 per row\n", file, n, LEVELCOLS);
+            return false;
+        }
+        levelgen_tiles[row/LEVELROWS][row%LEVELROWS][col] = t+1;
+    }
+    if((row+1)*LEVELTILE > levelgen_length)
+        levelgen_length = (row+1)*LEVELTILE;
+    return true;
+}
+
+static bool levelgen_read(const char* file)
+{
+    char line[256];
+    char word[16];
+    int n = 0;
+    int at,x,type,used,used2;
+    FILE* f = fopen(file, "r");
+    
+    if(f == NULL)
+    {
+        fprintf(stderr, "Unable to open %s\n", file);
+        return false;
+    }
+    
+    while(fgets(line, sizeof(line), f) != NULL)
+    {
+        char* end = strpbrk(line, "#\r\n");
+        bool ok = true;
+        
+        n++;
+        if(end != NULL)
+            *end = '\0';
+        if(sscanf(line, "%15s%n", word, &used) != 1)
+            continue;
+        
+        if(strcmp(word, "speed") == 0)
+            ok = sscanf(line+used, "%d", &levelgen_speed) == 1 && levelgen_speed >= 1 && levelgen_speed <= LEVELCHUNKHEIGHT;
+        else if(strcmp(word, "length") == 0)
+        {
+            ok = sscanf(line+used, "%d", &at) == 1 && at >= 0;
+            if(ok == true && at > levelgen_length)
+                levelgen_length = at;
+        }
+        else if(strcmp(word, "tileset") == 0)
+            ok = sscanf(line+used, "%51s", levelgen_tileset) == 1;
+        else if(strcmp(word, "enemy") == 0)
+            ok = sscanf(line+used, "%d %d %d", &at, &x, &type) == 3 && levelgen_add(file, n, at, x, type, NULL);
+        else if(strcmp(word, "text") == 0)
+            ok = sscanf(line+used, "%d %n", &at, &used2) == 1 && strlen(line+used+used2) <= 28
+                 && levelgen_add(file, n, at, 0, LEVELEVENT_TEXT, line+used+used2);
+        else if(strcmp(word, "row") == 0)
+            ok = levelgen_row(file, n, line+used);
+        else
+            ok = false;
+        
+        if(ok == false)
+        {
+            fprintf(stderr, "%s:%d: bad \"%s\" statement\n", file, n, word);
+            fclose(f);
+            return false;
+        }
+    }
+    
+    fclose(f);
+    if(levelgen_tileset[0] == '\0')
+    {
+        fprintf(stderr, "%s: no tileset\n", file);
+        return false;
+    }
+    return true;
+}
+
+//------------------------------
+// Writing
+//------------------------------
+static void levelgen_u16(Uint8* p, int v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+}
+
+static void levelgen_u32(Uint8* p, Uint32 v)
+{
+    levelgen_u16(p, v & 0xFFFF);
+    levelgen_u16(p+2, v >> 16);
+}
+
+static int levelgen_compare(const void* a, const void* b) // By distance, stable for equal ones
+{
+    const levelgen_item* x = a;
+    const levelgen_item* y = b;
+    
+    if(x->at != y->at)
+        return x->at - y->at;
+    return x < y ? -1 : 1;
+}
+
+static bool levelgen_write(const char* file)
+{
+    static Uint8 chunk[LEVELCHUNKSIZE];
+    int chunks = (levelgen_length + LEVELCHUNKHEIGHT-1) / LEVELCHUNKHEIGHT;
+    int first = 0;
+    int k,i;
+    FILE* f;
+    
+    if(chunks < 1)
+        chunks = 1;
+    qsort(levelgen_items, levelgen_count, sizeof(levelgen_item), levelgen_compare);
+    
+    f = fopen(file, "wb");
+    if(f == NULL)
+    {
+        fprintf(stderr, "Unable to open %s for writing\n", file);
+        return false;
+    }
+    
+    memset(chunk, 0, sizeof(chunk));
+    memcpy(chunk, "ESPLEVEL", 8);
+    levelgen_u32(chunk+8, LEVELVERSION);
+    levelgen_u32(chunk+12, chunks);
+    levelgen_u32(chunk+16, levelgen_speed);
+    memcpy(chunk+20, levelgen_tileset, sizeof(levelgen_tileset));
+    fwrite(chunk, 1, LEVELCHUNKSIZE, f);
+    
+    for(k=0;k<chunks;k++)
+    {
+        int last,placements = 0,events = 0;
+        Uint8* p;
+        
+        memset(chunk, 0, sizeof(chunk));
+        memcpy(chunk, levelgen_tiles[k], LEVELGEN_LISTS);
+        for(last=first;last<levelgen_count && levelgen_items[last].at < (k+1)*LEVELCHUNKHEIGHT;last++)
+        {
+            if(levelgen_items[last].event == true)
+                events++;
+            else
+                placements++;
+        }
+        if(LEVELGEN_LISTS + 4 + placements*8 + events*32 > LEVELCHUNKSIZE)
+        {
+            fprintf(stderr, "Chunk %d: too many placements and events to fit\n", k);
+            fclose(f);
+            return false;
+        }
+        levelgen_u16(chunk+LEVELGEN_LISTS, placements);
+        levelgen_u16(chunk+LEVELGEN_LISTS+2, events);
+        
+        // The placements, then the events, each sorted by distance
+        p = chunk + LEVELGEN_LISTS + 4;
+        for(i=first;i<last;i++)
+        {
+            if(levelgen_items[i].event == true)
+                continue;
+            levelgen_u16(p, levelgen_items[i].at - k*LEVELCHUNKHEIGHT);
+            levelgen_u16(p+2, levelgen_items[i].x);
+            levelgen_u16(p+4, levelgen_items[i].type);
+            p += 8;
+        }
+        for(i=first;i<last;i++)
+        {
+            if(levelgen_items[i].event == false)
+                continue;
+            levelgen_u16(p, levelgen_items[i].at - k*LEVELCHUNKHEIGHT);
+            levelgen_u16(p+2, levelgen_items[i].type);
+            memcpy(p+4, levelgen_items[i].text, sizeof(levelgen_items[i].text));
+            p += 32;
+        }
+        first = last;
+        fwrite(chunk, 1, LEVELCHUNKSIZE, f);
+    }
+    
+    if(fclose(f) != 0)
+    {
+        fprintf(stderr, "Unable to write %s\n", file);
+        return false;
+    }
+    printf("Wrote %s, %d chunks\n", file, chunks);
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc != 3)
+    {
+        printf("Usage: espada-levelgen DESCRIPTION LEVEL\n");
+        return 2;
+    }
+    
+    if(levelgen_read(argv[1]) == false || levelgen_write(argv[2]) == false)
+        return 1;
+    return 0;
+}
@@ -25,19 +25,245 @@
 
 #include <stdlib.h>
 #include <time.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
 #include "main.h"
 #include "clips.h"
+#include "pacer.h"
+#include "net.h"
+#include "capture.h"
+#include "ui.h"
+#include "pool.h"
+#include "compose.h"
+#include "scale.h"
+#include "trace.h"
+#include "background.h"
+#include "events.h"
+#include "soak.h"
+#include "vm.h"
+#include "path.h"
+#include "anim.h"
+#include "stats.h"
+#include "replay.h"
+#include "mixer.h"
+#include "level.h"
+
+//------------------------------
+// Timers
+//------------------------------
+int enemyTimer;
+int enemyspawnTimer = 180;
+int statustextTimer;
+
+//------------------------------
+// Image surfaces
+//------------------------------
+SDL_Surface* screen = NULL;
+SDL_Surface* display = NULL;
+
+int background_y[MAXLAYERS];
+
+SDL_Surface* title_graphic = NULL;
+SDL_Surface* menu_cursor = NULL;
+
+SDL_Surface* sprite_player = NULL;
+SDL_Surface* sprite_health_full = NULL;
+SDL_Surface* sprite_health_empty = NULL;
+SDL_Surface* sprite_laser = NULL;
+SDL_Surface* sprite_laser_enemy = NULL;
+SDL_Surface* sprite_enemy = NULL;
+SDL_Surface* sprite_enemy2 = NULL;
+SDL_Surface* sprite_explosion = NULL;
+
+//------------------------------
+// Collision masks
+//------------------------------
+mask mask_player[2];
+mask mask_enemy[2];
+mask mask_enemy2[2];
+mask mask_laser;
+mask mask_laser_enemy;
+
+//------------------------------
+// Text surfaces
+//------------------------------
+TTF_Font *font = NULL;
+SDL_Color textColor = { 255, 255, 255 };
+SDL_Surface* text_glyphs = NULL;
+int text_glyphx[TEXTGLYPHS+1];
+
+//------------------------------
+// Sounds
+//------------------------------
+Mix_Music* music = NULL;
+Mix_Chunk* snd_player_fire = NULL;
+Mix_Chunk* snd_enemy_fire = NULL;
+Mix_Chunk* snd_explosion = NULL;
+
+bool sound_enabled = true;
+int sound_fadetime = 500;
+int sound_volfx;
+int sound_volmus;
+int sound_volmus_paused;
+
+//------------------------------
+// System variables
+//------------------------------
+bool quit = false;
+char* sys_configpath;
+Uint32 sys_randstate = 1;
+bool sys_vsync = false;
+bool sys_mixer = false;
+int sys_timescale = 1;
+int sys_timescales[] = {1,2,5,10,25,50,100};
+int sys_netport = 0;
+char sys_nethost[256] = "";
+int sys_netdelay = 0;
+int sys_netloss = 0;
+char sys_capturefile[256] = "";
+char sys_tracefile[256] = "";
+char sys_metricsfile[108] = "";
+char sys_replayfile[256] = "";
+char sys_levelfile[256] = "";
+bool sys_autoplay = false;
+double sys_soakhours = 0;
+int sys_idlefps = 10;
+int sys_maxframeskip = 4;
+int sys_scale = 1;
+int sys_scalefilter = SCALE_NEAREST;
+int sys_threads = 0;
+bool sys_redraw = false;
+int sys_idleticks = 0;
+SDL_TimerID sys_idletimerid = NULL;
+
+//------------------------------
+// Menus
+//------------------------------
+ui_item menu_mainitems[] = {
+    {UI_ACTION,"Start",MENU_START},
+    {UI_SUBMENU,"Options",MENU_OPTIONS},
+    {UI_ACTION,"Quit",MENU_QUIT}
+};
+ui_item menu_optionsitems[] = {
+    {UI_VALUE,"SFX: ",0,&sound_volfx,0,12,sound_volumeschanged},
+    {UI_VALUE,"Music: ",0,&sound_volmus,0,12,sound_volumeschanged},
+    {UI_SUBMENU,"Back",MENU_MAIN}
+};
+ui_menu menus[] = {
+    {menu_mainitems,sizeof(menu_mainitems)/sizeof(ui_item)},
+    {menu_optionsitems,sizeof(menu_optionsitems)/sizeof(ui_item)}
+};
+
+//------------------------------
+// Background layers
+//------------------------------
+// Back to front. Layers after the first are see-through on magenta.
+background_layer background_layers[] = {
+    {"res/background.png",640,10}
+};
+int background_layercount = sizeof(background_layers)/sizeof(background_layer);
+
+//------------------------------
+// Enemy behaviors
+//------------------------------
+// One script per enemy type, in the language described in vm.h
+const char* enemy_scripts[] = {
+    // Drift down, zig-zagging across legs of random length
+    "        rand r1 0 1\n"
+    "        jz r1 left\n"
+    "right:  rand r0 10 320\n"
+    "        move 2 1\n"
+    "        wait r0\n"
+    "left:   rand r0 10 320\n"
+    "        move -2 1\n"
+    "        wait r0\n"
+    "        jmp right\n",
+    
+    // Fly the loop, so a wave of them flies it in formation
+    "        path 0 2 0\n"
+};
+int enemy_scriptcount = sizeof(enemy_scripts)/sizeof(char*);
+int enemy_entry[MAXENEMYTYPES];
+
+// The flight paths for the path instruction, see path.h
+const path_def enemy_paths[] = {
+    // Swing out to the right and loop back, then dive off the bottom
+    {10,{{0,0},{0,120},{60,260},{160,300},{220,220},{160,140},{60,180},{40,300},{60,440},{80,720}}}
+};
+int enemy_pathcount = sizeof(enemy_paths)/sizeof(path_def);
+
+//------------------------------
+// Gameplay states
+//------------------------------
+SDL_Event event;
+
+bool gamestate_init = true;
+bool gamestate_title = true;
+bool gamestate_over = true;
+bool gamestate_pause = false;
+
+bool action_moveleft = false;
+bool action_moveright = false;
+bool action_moveup = false;
+bool action_movedown = false;
+bool action_fire = false;
+
+//------------------------------
+// Gameplay variables
+//------------------------------
+int game_players = 1;
+int game_tick = 0; // Logic ticks this game, for the animations
+int game_input[MAXPLAYERS];
+
+int game_enemytotal;
+int game_enemyspawnlimit;
+int game_enemywaves;
+
+char game_statustext[100];
+int game_statustexttimeout;
+
+//------------------------------
+// Game objects
+//------------------------------
+player obj_player[MAXPLAYERS];
+enemy obj_enemy[MAXENEMIES];
+explosion obj_explosion[MAXEXPLOSIONS];
 
 //------------------------------
 // System functions
 //------------------------------
+void sys_seed(Uint32 seed)
+{
+    if(seed == 0)
+        seed = 0x9E3779B9;
+    sys_randstate = seed;
+}
+
 int sys_rand(int low, int high) // Generate a random number in a specific range
 {
-    int r = rand() % (high - low + 1) + low;
+    // xorshift32, so a game can be replayed from its seed
+    sys_randstate ^= sys_randstate << 13;
+    sys_randstate ^= sys_randstate >> 17;
+    sys_randstate ^= sys_randstate << 5;
+    
+    int r = sys_randstate % (high - low + 1) + low;
     return r;
 }
 
+Uint32 sys_hash(Uint32 h, int v) // FNV-1a, one int at a time
+{
+    int i;
+    
+    for(i=0;i<4;i++)
+    {
+        h ^= (v >> (i*8)) & 0xFF;
+        h *= 16777619;
+    }
+    return h;
+}
+
 bool sys_collide( SDL_Rect A, SDL_Rect B ) // Thanks to lazyfoo.net
 {    
     //If any of the sides from A are outside of B
@@ -57,26 +283,92 @@ bool sys_collide( SDL_Rect A, SDL_Rect B ) // Thanks to lazyfoo.net
     return true;
 }
 
-bool sys_init()
+bool sys_collidemask( SDL_Rect A, const mask* a, SDL_Rect B, const mask* b )
 {
-    if(SDL_Init(SDL_INIT_EVERYTHING) == -1) { return false; }
+    int y,top,bottom,dx;
+    Uint64 ra,rb;
     
-    screen = SDL_SetVideoMode(SCREEN_WIDTH,SCREEN_HEIGHT,SCREEN_BPP,SDL_SWSURFACE);
-    if(screen == NULL) { return false; }
+    if(sys_collide(A,B) == false)
+        return false;
     
-    if( TTF_Init() == -1 ) { return false; }
+    // Sprites that were never loaded only have their rectangles
+    if(a->w == 0 || b->w == 0)
+        return true;
     
-    if( Mix_OpenAudio( 22050, MIX_DEFAULT_FORMAT, 2, 4096 ) == -1 ) { return false; }
+    // Line B's rows up with A's columns and test the overlapping rows a word at a time
+    dx = B.x - A.x;
+    if(dx >= 64 || dx <= -64)
+        return false;
     
-    SDL_WM_SetCaption("Espada",NULL);
+    top = A.y > B.y ? A.y : B.y;
+    bottom = A.y+a->h < B.y+b->h ? A.y+a->h : B.y+b->h;
+    
+    for(y=top;y<bottom;y++)
+    {
+        ra = a->rows[y-A.y];
+        rb = b->rows[y-B.y];
+        if(dx >= 0)
+            rb <<= dx;
+        else
+            rb >>= -dx;
+        if((ra & rb) != 0)
+            return true;
+    }
     
+    return false;
+}
+
+bool sys_init()
+{
     static char configpath_buffer[4096];
+    int threads;
     if (getenv("XDG_CONFIG_HOME") != NULL)
         snprintf(configpath_buffer, sizeof(configpath_buffer), "%s/espada.ini", getenv("XDG_CONFIG_HOME"));
     else
         snprintf(configpath_buffer, sizeof(configpath_buffer), "%s/.config/espada.ini", getenv("HOME"));
     sys_configpath = configpath_buffer;
     
+    // The config is needed before the video mode is set
+    sys_configload();
+    
+    if(SDL_Init(SDL_INIT_EVERYTHING) == -1) { return false; }
+    
+    if(sys_vsync == true)
+        display = SDL_SetVideoMode(SCREEN_WIDTH*sys_scale,SCREEN_HEIGHT*sys_scale,SCREEN_BPP,SDL_HWSURFACE|SDL_DOUBLEBUF);
+    else
+        display = SDL_SetVideoMode(SCREEN_WIDTH*sys_scale,SCREEN_HEIGHT*sys_scale,SCREEN_BPP,SDL_SWSURFACE);
+    if(display == NULL) { return false; }
+    
+    // When scaled, the game still draws at 640x480 and sys_present() scales it to the window
+    screen = display;
+    if(sys_scale > 1 && display->format->BitsPerPixel == 32)
+    {
+        screen = SDL_CreateRGBSurface(SDL_SWSURFACE,SCREEN_WIDTH,SCREEN_HEIGHT,32,
+                                      display->format->Rmask,display->format->Gmask,display->format->Bmask,0);
+        if(screen == NULL) { return false; }
+        if(scale_init(sys_scale,sys_scalefilter) == false) { return false; }
+    }
+    
+    // Compositing and scaling share the worker threads, threads=0 means one per core
+    threads = sys_threads;
+    if(threads <= 0)
+    {
+#ifndef _WIN32
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+#else
+        threads = 2;
+#endif
+    }
+    pool_init(threads);
+    
+    if( TTF_Init() == -1 ) { return false; }
+    
+    if( Mix_OpenAudio( 22050, MIX_DEFAULT_FORMAT, 2, 4096 ) == -1 ) { return false; }
+    if(sys_mixer == true && mixer_open() == false)
+        sys_mixer = false;
+    
+    SDL_WM_SetCaption("Espada",NULL);
+    
     return true;
 }
 
@@ -91,6 +383,13 @@ void sys_configcreate()
         "[config]\n"
         "sound=6;\n"
         "music=8;\n"
+        "vsync=0;\n"
+        "idlefps=10;\n"
+        "maxframeskip=4;\n"
+        "scale=1;\n"
+        "scalefilter=0;\n"
+        "threads=0;\n"
+        "mixer=0;\n"
         "\n");
         fclose(f);
     }
@@ -107,7 +406,15 @@ void sys_configupdate()
         "[config]\n"
         "sound=%d;\n"
         "music=%d;\n"
-        "\n",sound_volfx,sound_volmus);
+        "vsync=%d;\n"
+        "idlefps=%d;\n"
+        "maxframeskip=%d;\n"
+        "scale=%d;\n"
+        "scalefilter=%d;\n"
+        "threads=%d;\n"
+        "mixer=%d;\n"
+        "\n",sound_volfx,sound_volmus,sys_vsync,sys_idlefps,sys_maxframeskip,
+        sys_scale,sys_scalefilter,sys_threads,sys_mixer);
         fclose(f);
     }
 }
@@ -125,6 +432,23 @@ void sys_configload()
     else
     {
         sound_setvolumes(iniparser_getint(f,"config:sound",-1),iniparser_getint(f,"config:music",-1));
+        sys_vsync = iniparser_getint(f,"config:vsync",0);
+        sys_idlefps = iniparser_getint(f,"config:idlefps",10);
+        if(sys_idlefps > FPS)
+            sys_idlefps = FPS;
+        sys_maxframeskip = iniparser_getint(f,"config:maxframeskip",4);
+        sys_scale = iniparser_getint(f,"config:scale",1);
+        if(sys_scale < 1)
+            sys_scale = 1;
+        if(sys_scale > MAXSCALE)
+            sys_scale = MAXSCALE;
+        sys_scalefilter = iniparser_getint(f,"config:scalefilter",SCALE_NEAREST);
+        if(sys_scalefilter < SCALE_NEAREST)
+            sys_scalefilter = SCALE_NEAREST;
+        if(sys_scalefilter > SCALE_SCALE2X)
+            sys_scalefilter = SCALE_SCALE2X;
+        sys_threads = iniparser_getint(f,"config:threads",0);
+        sys_mixer = iniparser_getint(f,"config:mixer",0);
     }
 }
 
@@ -133,10 +457,10 @@ bool sys_loadfiles()
     //Font
     font = TTF_OpenFont( "res/LCD_Solid.ttf", 20 );
     if( font == NULL ) { return false; }
+    if(text_init() == false) { return false; }
     
     //Textures
-    background = image_load("res/background.png",false);
-    if(background == NULL) { return false; }
+    if(background_load(background_layers,background_layercount) == false) { return false; }
     
     title_graphic = image_load("res/title.png",true);
     if(title_graphic == NULL) { return false; }
@@ -144,7 +468,7 @@ bool sys_loadfiles()
     menu_cursor = image_load("res/menu_cursor.png",true);
     if(menu_cursor == NULL) { return false; }
     
-    sprite_player = image_load("res/player_ship.png",true);
+    sprite_player = image_loadmasked("res/player_ship.png",clipPlayerNorm,2,mask_player);
     if(sprite_player == NULL) { return false; }
     
     sprite_health_full = image_load("res/health_full.png",true);
@@ -153,32 +477,47 @@ bool sys_loadfiles()
     sprite_health_empty = image_load("res/health_empty.png",true);
     if(sprite_health_empty == NULL) { return false; }
     
-    sprite_laser = image_load("res/laser.png",true);
+    sprite_laser = image_loadmasked("res/laser.png",NULL,1,&mask_laser);
     if(sprite_laser == NULL) { return false; }
     
-    sprite_laser_enemy = image_load("res/laser_enemy.png",true);
+    sprite_laser_enemy = image_loadmasked("res/laser_enemy.png",NULL,1,&mask_laser_enemy);
     if(sprite_laser_enemy == NULL) { return false; }
     
-    sprite_enemy = image_load("res/enemy_ship.png",true);
+    sprite_enemy = image_loadmasked("res/enemy_ship.png",clipEnemyType1,2,mask_enemy);
     if(sprite_enemy == NULL) { return false; }
     
-    sprite_enemy2 = image_load("res/enemy_ship2.png",true);
+    sprite_enemy2 = image_loadmasked("res/enemy_ship2.png",clipEnemyType2,2,mask_enemy2);
     if(sprite_enemy2 == NULL) { return false; }
     
     sprite_explosion = image_load("res/explosion.png",true);
     if(sprite_explosion == NULL) { return false; }
     
-    //Sound
+    return true;
+}
+
+bool game_loadmasks() // The collision masks of sys_loadfiles(), built without a video mode
+{
+    if(image_loadmask("res/player_ship.png",clipPlayerNorm,2,mask_player) == false) { return false; }
+    if(image_loadmask("res/laser.png",NULL,1,&mask_laser) == false) { return false; }
+    if(image_loadmask("res/laser_enemy.png",NULL,1,&mask_laser_enemy) == false) { return false; }
+    if(image_loadmask("res/enemy_ship.png",clipEnemyType1,2,mask_enemy) == false) { return false; }
+    if(image_loadmask("res/enemy_ship2.png",clipEnemyType2,2,mask_enemy2) == false) { return false; }
+    
+    return true;
+}
+
+bool sys_loadsounds()
+{
     music = Mix_LoadMUS("res/music1.ogg");
     if(music == NULL) { return false; }
     
-    snd_player_fire = Mix_LoadWAV("res/player_fire.wav");
+    snd_player_fire = sound_load("res/player_fire.wav");
     if(snd_player_fire == NULL) { return false; }
     
-    snd_enemy_fire = Mix_LoadWAV("res/enemy_fire.wav");
+    snd_enemy_fire = sound_load("res/enemy_fire.wav");
     if(snd_enemy_fire == NULL) { return false; }
     
-    snd_explosion = Mix_LoadWAV("res/explosion.wav");
+    snd_explosion = sound_load("res/explosion.wav");
     if(snd_explosion == NULL) { return false; }
     
     return true;
@@ -186,34 +525,60 @@ bool sys_loadfiles()
 
 void sys_cleanup()
 {
-    SDL_FreeSurface(background);
-    SDL_FreeSurface(title_graphic);
-    SDL_FreeSurface(menu_cursor);
-    SDL_FreeSurface(sprite_player);
-    SDL_FreeSurface(sprite_health_full);
-    SDL_FreeSurface(sprite_health_empty);
-    SDL_FreeSurface(sprite_laser);
-    SDL_FreeSurface(sprite_laser_enemy);
-    SDL_FreeSurface(sprite_enemy);
-    SDL_FreeSurface(sprite_enemy2);
-    SDL_FreeSurface(sprite_explosion);
-    
+    level_close();
+    background_cleanup();
+    image_free(title_graphic);
+    image_free(menu_cursor);
+    image_free(sprite_player);
+    image_free(sprite_health_full);
+    image_free(sprite_health_empty);
+    image_free(sprite_laser);
+    image_free(sprite_laser_enemy);
+    image_free(sprite_enemy);
+    image_free(sprite_enemy2);
+    image_free(sprite_explosion);
+    image_free(text_glyphs);
+    
+    // The mixer plays straight out of the chunks
+    mixer_close();
     Mix_FreeMusic(music);
-    Mix_FreeChunk(snd_player_fire);
-    Mix_FreeChunk(snd_enemy_fire);
-    Mix_FreeChunk(snd_explosion);
+    sound_free(snd_player_fire);
+    sound_free(snd_enemy_fire);
+    sound_free(snd_explosion);
     
+    ui_cleanup();
     TTF_CloseFont(font);
     
+    if(screen != display)
+    {
+        scale_cleanup();
+        SDL_FreeSurface(screen);
+    }
+    pool_cleanup();
+    
     SDL_Quit();
 }
 
 void sys_input()
 {
+    int i;
+    int timescales = sizeof(sys_timescales)/sizeof(int);
+    
     while(SDL_PollEvent(&event))
     {
         if( event.type == SDL_KEYDOWN )
         {
+            sys_redraw = true;
+            
+            // Turbo mode
+            if(event.key.keysym.sym == 't' && net_active() == false)
+            {
+                for(i=0;i<timescales;i++)
+                    if(sys_timescales[i] > sys_timescale)
+                        break;
+                game_settimescale(i < timescales ? sys_timescales[i] : sys_timescales[0]);
+            }
+            
             // Gameplay
             if(gamestate_over == false && gamestate_title == false)
             {
@@ -228,8 +593,8 @@ void sys_input()
                 if(event.key.keysym.sym == 'z')
                     action_fire = true;
                 
-                // Pause screen
-                if(event.key.keysym.sym == 'p' || event.key.keysym.sym == SDLK_ESCAPE)
+                // Pause screen, the other player can't be paused
+                if((event.key.keysym.sym == 'p' || event.key.keysym.sym == SDLK_ESCAPE) && net_active() == false)
                     game_pause();
                 if(gamestate_pause == true)
                     if(event.key.keysym.sym == 'q')
@@ -239,61 +604,23 @@ void sys_input()
             // Title screen menu
             if(gamestate_over == true && gamestate_title == true)
             {
-                if(event.key.keysym.sym == SDLK_DOWN && menu_selection+1 < 3)
-                    menu_selection += 1;
-                if(event.key.keysym.sym == SDLK_UP && menu_selection > 0)
-                    menu_selection -= 1;
-
-                if(menu_level == 0) // main menu
-                {
-                    if(event.key.keysym.sym == 'z')
-                    {
-                        if(menu_selection == 0)
-                            game_newgame();
-                        if(menu_selection == 1)
-                        {
-                            menu_level = 1;
-                            menu_selection = 0;
-                        }
-                        if(menu_selection == 2)
-                            quit = true;
-                    }
-                }
-                else if (menu_level == 1) // options menu
+                switch(ui_input(event.key.keysym.sym))
                 {
-                    if(event.key.keysym.sym == SDLK_LEFT)
-                    {
-                        if(menu_selection == 0)
-                            if(sound_volfx-1 >= 0)
-                                sound_setvolumes(sound_volfx-1,sound_volmus);
-                        if(menu_selection == 1)
-                            if(sound_volmus-1 >= 0)
-                                sound_setvolumes(sound_volfx,sound_volmus-1);
-                    }
-                    if(event.key.keysym.sym == SDLK_RIGHT)
-                    {
-                        if(menu_selection == 0)
-                            if(sound_volfx+1 <= 12)
-                                sound_setvolumes(sound_volfx+1,sound_volmus);
-                        if(menu_selection == 1)
-                            if(sound_volmus+1 <= 12)
-                                sound_setvolumes(sound_volfx,sound_volmus+1);
-                    }
-                    if(event.key.keysym.sym == 'z')
-                    {
-                        if(menu_selection == 2)
-                        {
-                            menu_level = 0;
-                            menu_selection = 0;
-                        }
-                    }
+                    case MENU_START:
+                        game_newgame();
+                        break;
+                    case MENU_QUIT:
+                        quit = true;
+                        break;
                 }
             }
             
             // Game over
             if(gamestate_over == true && gamestate_title == false)
             {
-                if(event.key.keysym.sym == 'q')
+                if(event.key.keysym.sym == 'q' && net_active() == true)
+                    quit = true;
+                else if(event.key.keysym.sym == 'q')
                     game_titlescreen();
             }
         }
@@ -315,6 +642,11 @@ void sys_input()
             }
         }
         
+        else if(event.type == SDL_USEREVENT && event.user.code == EVENT_IDLETICK)
+            sys_idleticks++;
+        else if(event.type == SDL_VIDEOEXPOSE)
+            sys_redraw = true;
+        
         if(event.type == SDL_QUIT)
         {
             quit = true;
@@ -322,6 +654,157 @@ void sys_input()
     }
 }
 
+int sys_present() // Scale the frame to the window if needed and show it
+{
+    if(screen != display)
+        scale_blit(screen, display);
+    return SDL_Flip(display);
+}
+
+void sys_gameevents() // Drain the game events into their consumers
+{
+    game_event e;
+    
+    while(events_pop(&e) == true)
+        sound_handleevent(e.type, e.a);
+}
+
+bool sys_idle() // Only the title screen background moves, and nobody needs every frame
+{
+    if(sys_idlefps <= 0 || net_active() == true || sys_capturefile[0] != '\0' || sys_autoplay == true)
+        return false;
+    if(gamestate_title == true || gamestate_pause == true)
+        return true;
+    return false;
+}
+
+Uint32 sys_idletick(Uint32 interval, void* param) // Runs on SDL's timer thread
+{
+    SDL_Event e;
+    
+    e.type = SDL_USEREVENT;
+    e.user.code = EVENT_IDLETICK;
+    e.user.data1 = NULL;
+    e.user.data2 = NULL;
+    SDL_PushEvent(&e);
+    
+    return interval;
+}
+
+void sys_idletimer(bool on)
+{
+    if(on == true && sys_idletimerid == NULL)
+        sys_idletimerid = SDL_AddTimer(1000/sys_idlefps, sys_idletick, NULL);
+    else if(on == false && sys_idletimerid != NULL)
+    {
+        SDL_RemoveTimer(sys_idletimerid);
+        sys_idletimerid = NULL;
+    }
+}
+
+void sys_idlewait() // One pass of the main loop in idle mode
+{
+    // The paused screen is still, so only the title screen needs waking up
+    sys_idletimer(gamestate_title);
+    
+    SDL_WaitEvent(NULL);
+    sys_input();
+    
+    // Each timer tick is one step of the background at the reduced rate
+    if(sys_idleticks > 0 && gamestate_title == true)
+    {
+        game_logic();
+        sys_redraw = true;
+    }
+    sys_idleticks = 0;
+    
+    if(sys_redraw == true)
+    {
+        draw_everything();
+        sys_present();
+        sys_redraw = false;
+    }
+    
+    // Back to full speed without counting the idle time as a missed frame
+    if(sys_idle() == false)
+    {
+        sys_idletimer(false);
+        pacer_resync();
+    }
+}
+
+int sys_actionbits() // Current keyboard state as player input bits
+{
+    int bits = 0;
+    
+    if(action_moveleft == true)
+        bits |= ACTION_LEFT;
+    if(action_moveright == true)
+        bits |= ACTION_RIGHT;
+    if(action_moveup == true)
+        bits |= ACTION_UP;
+    if(action_movedown == true)
+        bits |= ACTION_DOWN;
+    if(action_fire == true)
+        bits |= ACTION_FIRE;
+    
+    return bits;
+}
+
+void sys_parseargs(int argc, char* argv[])
+{
+    int i;
+    
+    for(i=1;i<argc;i++)
+    {
+        if((strcmp(argv[i],"--turbo") == 0 || strcmp(argv[i],"-t") == 0) && i+1 < argc)
+        {
+            sys_timescale = atoi(argv[++i]);
+            if(sys_timescale < 1)
+                sys_timescale = 1;
+            if(sys_timescale > MAXTIMESCALE)
+                sys_timescale = MAXTIMESCALE;
+        }
+        else if(strcmp(argv[i],"--host") == 0 && i+1 < argc)
+        {
+            sys_netport = atoi(argv[++i]);
+            sys_nethost[0] = '\0';
+        }
+        else if(strcmp(argv[i],"--join") == 0 && i+1 < argc)
+        {
+            char* port;
+            strncpy(sys_nethost,argv[++i],sizeof(sys_nethost)-1);
+            port = strrchr(sys_nethost,':');
+            if(port != NULL)
+            {
+                *port = '\0';
+                sys_netport = atoi(port+1);
+            }
+        }
+        else if(strcmp(argv[i],"--netdelay") == 0 && i+1 < argc)
+            sys_netdelay = atoi(argv[++i]);
+        else if(strcmp(argv[i],"--netloss") == 0 && i+1 < argc)
+            sys_netloss = atoi(argv[++i]);
+        else if(strcmp(argv[i],"--capture") == 0 && i+1 < argc)
+            strncpy(sys_capturefile,argv[++i],sizeof(sys_capturefile)-1);
+        else if(strcmp(argv[i],"--trace") == 0 && i+1 < argc)
+            strncpy(sys_tracefile,argv[++i],sizeof(sys_tracefile)-1);
+        else if(strcmp(argv[i],"--metrics") == 0 && i+1 < argc)
+            strncpy(sys_metricsfile,argv[++i],sizeof(sys_metricsfile)-1);
+        else if(strcmp(argv[i],"--level") == 0 && i+1 < argc)
+            strncpy(sys_levelfile,argv[++i],sizeof(sys_levelfile)-1);
+        else if(strcmp(argv[i],"--record") == 0 && i+1 < argc)
+            strncpy(sys_replayfile,argv[++i],sizeof(sys_replayfile)-1);
+        else if(strcmp(argv[i],"--autoplay") == 0)
+            sys_autoplay = true;
+        else if(strcmp(argv[i],"--soak") == 0 && i+1 < argc)
+        {
+            sys_soakhours = atof(argv[++i]);
+            sys_autoplay = true;
+        }
+    }
+}
+
 //------------------------------
 // Image functions
 //------------------------------
@@ -336,6 +819,8 @@ SDL_Surface *image_load(char * filename, bool withalpha)
     if(loadedImage != NULL)
     {
         optimizedImage = SDL_DisplayFormat(loadedImage);
+        if(optimizedImage != NULL)
+            soak_surfaces++;
         if(optimizedImage != NULL && withalpha == true)
         {
             Uint32 colorkey = SDL_MapRGB( optimizedImage->format, 0xFF, 0, 0xFF );
@@ -347,11 +832,124 @@ SDL_Surface *image_load(char * filename, bool withalpha)
     return optimizedImage;
 }
 
+SDL_Surface* image_text(const char* text) // Rendered with the game font, free with image_free()
+{
+    SDL_Surface* s = TTF_RenderText_Solid( font, text, textColor );
+    
+    if(s != NULL)
+        soak_surfaces++;
+    return s;
+}
+
+void image_free(SDL_Surface* s)
+{
+    if(s == NULL)
+        return;
+    soak_surfaces--;
+    SDL_FreeSurface(s);
+}
+
+void image_buildmask(SDL_Surface* s, SDL_Rect* clip, mask* m)
+{
+    SDL_Rect r;
+    int x,y;
+    int bpp = s->format->BytesPerPixel;
+    Uint32 key = s->format->colorkey;
+    
+    if(clip != NULL)
+        r = *clip;
+    else
+    {
+        r.x = 0;
+        r.y = 0;
+        r.w = s->w;
+        r.h = s->h;
+    }
+    
+    memset(m, 0, sizeof(mask));
+    if(r.w > 64 || r.h > 64 || r.x + r.w > s->w || r.y + r.h > s->h)
+        return;
+    m->w = r.w;
+    m->h = r.h;
+    
+    if(SDL_MUSTLOCK(s))
+        SDL_LockSurface(s);
+    for(y=0;y<r.h;y++)
+    {
+        Uint8* row = (Uint8*)s->pixels + (r.y+y)*s->pitch + r.x*bpp;
+        for(x=0;x<r.w;x++)
+        {
+            Uint32 p = 0;
+            memcpy(&p, row + x*bpp, bpp);
+            if((s->flags & SDL_SRCCOLORKEY) == 0 || p != key)
+                m->rows[y] |= (Uint64)1 << x;
+        }
+    }
+    if(SDL_MUSTLOCK(s))
+        SDL_UnlockSurface(s);
+}
+
+SDL_Surface* image_loadmasked(char* filename, SDL_Rect* clips, int count, mask* masks) // Load a colorkeyed sheet and its collision masks
+{
+    SDL_Surface* s = image_load(filename,true);
+    int i;
+    
+    if(s == NULL)
+        return NULL;
+    
+    if(clips == NULL)
+        image_buildmask(s, NULL, masks);
+    else
+        for(i=0;i<count;i++)
+            image_buildmask(s, &clips[i], &masks[i]);
+    
+    return s;
+}
+
+bool image_loadmask(char* filename, SDL_Rect* clips, int count, mask* masks) // The masks alone, without a video mode
+{
+    SDL_Surface* loaded = IMG_Load(filename);
+    SDL_Surface* format = SDL_CreateRGBSurface(SDL_SWSURFACE,1,1,32,0x00FF0000,0x0000FF00,0x000000FF,0);
+    SDL_Surface* s = NULL;
+    int i;
+    
+    // A 32bpp layout like the screen's, keyed the way image_load() keys it,
+    // so that the masks come out the same as the game's
+    if(loaded != NULL && format != NULL)
+        s = SDL_ConvertSurface(loaded,format->format,SDL_SWSURFACE);
+    if(loaded != NULL)
+        SDL_FreeSurface(loaded);
+    if(format != NULL)
+        SDL_FreeSurface(format);
+    if(s == NULL)
+    {
+        fprintf(stderr, "Unable to load %s\n", filename);
+        return false;
+    }
+    SDL_SetColorKey(s, SDL_SRCCOLORKEY, SDL_MapRGB(s->format, 0xFF, 0, 0xFF));
+    
+    if(clips == NULL)
+        image_buildmask(s, NULL, masks);
+    else
+        for(i=0;i<count;i++)
+            image_buildmask(s, &clips[i], &masks[i]);
+    
+    SDL_FreeSurface(s);
+    return true;
+}
+
 void image_apply( int x, int y, int alpha, SDL_Surface* source, SDL_Surface* destination, SDL_Rect* clip )
 {
     //Make a temporary rectangle to hold the offsets
     SDL_Rect offset;
-
+    
+    //Frames being composited are drawn later, in bands
+    if(destination == compose_target())
+    {
+        compose_add(source, clip, x, y, alpha);
+        return;
+    }
+    
     //Give the offsets to the rectangle
     offset.x = x;
     offset.y = y;
@@ -361,13 +959,92 @@ void image_apply( int x, int y, int alpha, SDL_Surface* source, SDL_Surface* des
     SDL_BlitSurface( source, clip, destination, &offset );
 }
 
+//------------------------------
+// Text functions
+//------------------------------
+bool text_init() // Render every printable character once, side by side
+{
+    char glyphs[TEXTGLYPHS+1];
+    SDL_Surface* strip;
+    SDL_Color key;
+    int i,w;
+    
+    for(i=0;i<TEXTGLYPHS;i++)
+        glyphs[i] = TEXTFIRST+i;
+    glyphs[TEXTGLYPHS] = '\0';
+    
+    strip = TTF_RenderText_Solid( font, glyphs, textColor );
+    if(strip == NULL) { return false; }
+    key = strip->format->palette->colors[0];
+    text_glyphs = SDL_DisplayFormat(strip);
+    SDL_FreeSurface(strip);
+    if(text_glyphs == NULL) { return false; }
+    soak_surfaces++;
+    SDL_SetColorKey(text_glyphs, SDL_SRCCOLORKEY, SDL_MapRGB(text_glyphs->format, key.r, key.g, key.b));
+    
+    // Each glyph starts where the text before it ends
+    text_glyphx[0] = 0;
+    for(i=1;i<=TEXTGLYPHS;i++)
+    {
+        char c = glyphs[i];
+        glyphs[i] = '\0';
+        TTF_SizeText(font, glyphs, &w, NULL);
+        glyphs[i] = c;
+        text_glyphx[i] = w;
+    }
+    
+    return true;
+}
+
+void text_draw(int x, int y, const char* text, SDL_Surface* dest) // Like a TTF_RenderText_Solid() blit, without the new surface
+{
+    SDL_Rect clip;
+    
+    clip.y = 0;
+    clip.h = text_glyphs->h;
+    for(;*text != '\0';text++)
+    {
+        int g = (unsigned char)*text - TEXTFIRST;
+        if(g < 0 || g >= TEXTGLYPHS)
+            continue;
+        clip.x = text_glyphx[g];
+        clip.w = text_glyphx[g+1] - text_glyphx[g];
+        if(*text != ' ')
+            image_apply(x, y, 255, text_glyphs, dest, &clip);
+        x += clip.w;
+    }
+}
+
 //------------------------------
 // Sound functions
 //------------------------------
+Mix_Chunk* sound_load(char* filename)
+{
+    Mix_Chunk* c = Mix_LoadWAV(filename);
+    
+    if(c != NULL)
+        soak_chunks++;
+    return c;
+}
+
+void sound_free(Mix_Chunk* c)
+{
+    if(c == NULL)
+        return;
+    soak_chunks--;
+    Mix_FreeChunk(c);
+}
+
 void sound_playfx(Mix_Chunk* snd)
 {
     if(sound_enabled == true)
     {
+        TRACE_INSTANT("sound");
+        if(sys_mixer == true)
+        {
+            mixer_play(snd, sound_volfx*10);
+            return;
+        }
         Mix_VolumeChunk(snd, sound_volfx*10);
         Mix_PlayChannel( -1, snd, 0 );
     }
@@ -384,6 +1061,42 @@ void sound_playmus()
     }
 }
 
+void sound_handleevent(int type, int a) // Audio for what the game logic reported
+{
+    if(sound_enabled == false)
+        return;
+    
+    switch(type)
+    {
+        case GAMEEVENT_FIRE:
+            sound_playfx(a >= 0 ? snd_player_fire : snd_enemy_fire);
+            break;
+        case GAMEEVENT_EXPLOSION:
+        case GAMEEVENT_DAMAGE:
+            sound_playfx(snd_explosion);
+            break;
+        case GAMEEVENT_STATE:
+            if(a == GAMESTATE_NEWGAME)
+                sound_playmus();
+            else if(a == GAMESTATE_TITLE)
+            {
+                Mix_FadeOutMusic(sound_fadetime);
+                Mix_HaltChannel(-1);
+                mixer_stopall();
+            }
+            else if(a == GAMESTATE_PAUSE)
+                Mix_VolumeMusic(sound_volmus_paused*10);
+            else if(a == GAMESTATE_RESUME)
+                Mix_VolumeMusic(sound_volmus*10);
+            break;
+    }
+}
+
+void sound_volumeschanged() // The options menu has changed sound_volfx or sound_volmus
+{
+    sound_setvolumes(sound_volfx,sound_volmus);
+}
+
 void sound_setvolumes(int snd, int mus)
 {
     sound_volfx = snd;
@@ -399,87 +1112,41 @@ void sound_setvolumes(int snd, int mus)
 //------------------------------
 void draw_everything()
 {
-    // Fill the screen with black
-    SDL_FillRect(screen,NULL, 0x000000);
+    compose_begin(screen);
     
-    // Draw background
-    draw_background();
+    // Draw background, which covers the whole screen
+    TRACE_SPAN(draw_background());
     
     // Draw the title screen
     if(gamestate_title == true)
-        draw_titlescreen();
+        TRACE_SPAN(draw_titlescreen());
     else
     {
-        // Draw the game objects
+        // Draw the game objects over the level's scenery
+        TRACE_SPAN(level_draw(game_tick));
         if(gamestate_over == false)
-            draw_player();
-        draw_enemies();
-        draw_explosions();
-        draw_lasers();
-        draw_info();
-        draw_statustext();
-    }
-}
-void draw_frameadvance(int* frame,int totalframes)
-{
-    if(animationTimer == 0)
-    {
-        *frame += 1;
-        if(*frame > totalframes-1)
-            *frame = 0;
+            TRACE_SPAN(draw_player());
+        TRACE_SPAN(draw_enemies());
+        TRACE_SPAN(draw_explosions());
+        TRACE_SPAN(draw_lasers());
+        TRACE_SPAN(draw_info());
+        TRACE_SPAN(draw_statustext());
     }
+    
+    TRACE_SPAN(compose_end());
 }
 
 void draw_background()
 {
-    int scrollspeed = 10;
-    
-    if(gamestate_pause == false)
-    {
-        if(background_y < 640)
-        {
-            background_y += scrollspeed;
-        }
-        else
-            background_y = 0;
-    }
-        
-    image_apply(0,background_y,255,background,screen,NULL);
-    image_apply(0,background_y-640,255,background,screen,NULL);
-
+    background_draw(background_y);
 }
 
 void draw_titlescreen()
 {
-    char tempstr[16];
-    
     image_apply((SCREEN_WIDTH-486)/2,50,255,title_graphic,screen,NULL);
     
-    int i;
-    for(i=0;i<3;i++)
-    {
-        if(menu_level == 1)
-        {
-            if(i == 0)
-                sprintf(tempstr,"%s%d",menu_main[menu_level][i],sound_volfx);
-            else if(i == 1)
-                sprintf(tempstr,"%s%d",menu_main[menu_level][i],sound_volmus);
-            else
-                sprintf(tempstr,"%s",menu_main[menu_level][i]);
-        }
-        else
-        {
-            sprintf(tempstr,"%s",menu_main[menu_level][i]);
-        }
-        
-        text_titlescreen = TTF_RenderText_Solid( font, tempstr, textColor );
-        if(text_titlescreen == NULL){ return; }
-        
-        image_apply(280, 300+(i*20), 255, text_titlescreen, screen, NULL);
-        SDL_FreeSurface(text_titlescreen);
-    }
-    
-    image_apply(260, 300+(menu_selection*20), 255, menu_cursor, screen, NULL);
+    // Menu text is only rendered again when it changes
+    ui_draw(280, 300, menu_cursor, screen);
 }
 
 void draw_info()
@@ -488,27 +1155,26 @@ void draw_info()
     
     char score[64];
     
-    sprintf(score,"Score: %d",obj_player.score);
-    text_score = TTF_RenderText_Solid( font, score, textColor );
-    
-    if(text_score == NULL){ return; }
-    image_apply(5, 5+SCREEN_BOTTOM, 255, text_score, screen, NULL);
-    SDL_FreeSurface(text_score);
-    
-    char health[64];
+    sprintf(score,"Score: %d",obj_player[0].score);
+    text_draw(5, 5+SCREEN_BOTTOM, score, screen);
     
-    sprintf(health,"Health:");
-    text_health = TTF_RenderText_Solid( font, health, textColor );
+    text_draw(SCREEN_WIDTH-200, 5+SCREEN_BOTTOM, "Health:", screen);
     
-    if(text_health == NULL){ return; }
-    image_apply(SCREEN_WIDTH-200, 5+SCREEN_BOTTOM, 255, text_health, screen, NULL);
-    SDL_FreeSurface(text_health);
-    
-    for(i=1;i<=obj_player.health;i++)
+    for(i=1;i<=obj_player[0].health;i++)
         image_apply((SCREEN_WIDTH-120)+(i*18), 3+SCREEN_BOTTOM, 255, sprite_health_full, screen, NULL);
     
-    for(i=obj_player.health+1;i<=5;i++)
+    for(i=obj_player[0].health+1;i<=5;i++)
         image_apply((SCREEN_WIDTH-120)+(i*18), 3+SCREEN_BOTTOM, 255, sprite_health_empty, screen, NULL);
+    
+    // Second player's health in co-op
+    if(game_players > 1)
+    {
+        for(i=1;i<=obj_player[1].health;i++)
+            image_apply((SCREEN_WIDTH/2-54)+(i*18), 3+SCREEN_BOTTOM, 255, sprite_health_full, screen, NULL);
+        
+        for(i=obj_player[1].health+1;i<=5;i++)
+            image_apply((SCREEN_WIDTH/2-54)+(i*18), 3+SCREEN_BOTTOM, 255, sprite_health_empty, screen, NULL);
+    }
 }
 
 void draw_statustext()
@@ -517,75 +1183,63 @@ void draw_statustext()
     {
         int len = strlen(game_statustext);
         int xpos = (SCREEN_WIDTH-(len*12))/2;
-        text_status = TTF_RenderText_Solid( font, game_statustext, textColor );
-        
-        if(text_status == NULL){ return; }
-        image_apply(xpos, 200, 255, text_status, screen, NULL);
-        SDL_FreeSurface(text_status);
+        text_draw(xpos, 200, game_statustext, screen);
     }
-    
-    if(game_statustexttimeout > 0)
-        game_statustexttimeout -= 1;
 }
 
 void draw_player()
 {
     int alpha;
-        
-    if(obj_player.alive == true)
+    int p;
+    
+    for(p=0;p<game_players;p++)
     {
-        if(obj_player.invuln == false)
-        {
-            alpha = 255;
-            image_apply(obj_player.dim.x,obj_player.dim.y,alpha,sprite_player,screen,&clipPlayerNorm[obj_player.frame]);
-        }
-        else
+        if(obj_player[p].alive == true)
         {
-            alpha = 127;
-            image_apply(obj_player.dim.x,obj_player.dim.y,alpha,sprite_player,screen,&clipPlayerInvuln[obj_player.frame]);
+            if(obj_player[p].invuln == false)
+            {
+                alpha = 255;
+                image_apply(obj_player[p].dim.x,obj_player[p].dim.y,alpha,sprite_player,screen,anim_clip(obj_player[p].anim,obj_player[p].animstart));
+            }
+            else
+            {
+                alpha = 127;
+                image_apply(obj_player[p].dim.x,obj_player[p].dim.y,alpha,sprite_player,screen,&clipPlayerInvuln[anim_frame(obj_player[p].anim,obj_player[p].animstart)]);
+            }
         }
-        
-        
-        int totalframes = sizeof(clipPlayerNorm)/sizeof(SDL_Rect);
-        draw_frameadvance(&obj_player.frame,totalframes);
     }
 }
 
 void draw_enemies()
 {
     int i;
-    int totalframes = 0;
     
     for(i=0;i<MAXENEMIES;i++)
     {
         if(obj_enemy[i].alive == true)
         {
+            SDL_Rect* clip = anim_clip(obj_enemy[i].anim,obj_enemy[i].animstart);
             if(obj_enemy[i].type == 0)
-            {
-                image_apply(obj_enemy[i].dim.x,obj_enemy[i].dim.y,255,sprite_enemy,screen,&clipEnemyType1[obj_enemy[i].frame]);
-                totalframes = sizeof(clipEnemyType1)/sizeof(SDL_Rect);
-            }
+                image_apply(obj_enemy[i].dim.x,obj_enemy[i].dim.y,255,sprite_enemy,screen,clip);
             else if (obj_enemy[i].type == 1)
-            {
-                image_apply(obj_enemy[i].dim.x,obj_enemy[i].dim.y,255,sprite_enemy2,screen,&clipEnemyType2[obj_enemy[i].frame]);
-                totalframes = sizeof(clipEnemyType2)/sizeof(SDL_Rect);
-            }
-            
-            draw_frameadvance(&obj_enemy[i].frame,totalframes);
+                image_apply(obj_enemy[i].dim.x,obj_enemy[i].dim.y,255,sprite_enemy2,screen,clip);
         }
     }
 }
 
 void draw_lasers()
 {
-    int i,j;
+    int i,j,p;
     
     //player lasers
-    for(i=0;i<MAXLASERS;i++)
+    for(p=0;p<game_players;p++)
     {
-        if(obj_player.laz[i].alive == true)
+        for(i=0;i<MAXLASERS;i++)
         {
-            image_apply(obj_player.laz[i].dim.x,obj_player.laz[i].dim.y,255,sprite_laser,screen,NULL);
+            if(obj_player[p].laz[i].alive == true)
+            {
+                image_apply(obj_player[p].laz[i].dim.x,obj_player[p].laz[i].dim.y,255,sprite_laser,screen,NULL);
+            }
         }
     }
     
@@ -610,15 +1264,7 @@ void draw_explosions()
     {
         if(obj_explosion[i].alive == true)
         {
-            image_apply(obj_explosion[i].dim.x,obj_explosion[i].dim.y,255,sprite_explosion,screen,&clipExplosion[obj_explosion[i].frame]);
-            
-            int totalframes = sizeof(clipExplosion)/sizeof(SDL_Rect);
-            draw_frameadvance(&obj_explosion[i].frame,totalframes);
-            
-            if(obj_explosion[i].frame == totalframes-1)
-            {
-                obj_explosion[i].alive = false;
-            }
+            image_apply(obj_explosion[i].dim.x,obj_explosion[i].dim.y,255,sprite_explosion,screen,anim_clip(obj_explosion[i].anim,obj_explosion[i].animstart));
         }
     }
 }
@@ -628,42 +1274,225 @@ void draw_explosions()
 //------------------------------
 void game_logic()
 {
+    // Scroll the background
+    if(gamestate_pause == false)
+        TRACE_SPAN(game_backgroundscroll());
+    
     if(gamestate_pause == false && gamestate_title == false)
     {
         if(gamestate_over == false)
         {
-            // Player movement
-            game_playerinvulntick();
-            game_playermove();
-            
-            // Fire player lasers
-            game_playerfire();
+            int p;
+            for(p=0;p<game_players;p++)
+            {
+                if(obj_player[p].alive == false)
+                    continue;
+                
+                // Player movement
+                TRACE_SPAN(game_playerinvulntick(p));
+                TRACE_SPAN(game_playermove(p));
+                
+                // Fire player lasers
+                TRACE_SPAN(game_playerfire(p));
+            }
             
             // Collision Detection
-            game_testcollisions();
+            TRACE_SPAN(game_testcollisions());
         }
         
-        // Spawn and draw enemies
-        game_enemyspawn();
-        game_enemymove();
-        game_enemyfire();
+        // Spawn and draw enemies, from the level until it runs out
+        if(level_update(game_tick) == false)
+            TRACE_SPAN(game_enemyspawn());
+        TRACE_SPAN(game_enemymove());
+        TRACE_SPAN(game_enemyfire());
         
-        game_lasersmove();
+        TRACE_SPAN(game_lasersmove());
         
         // Draw the gameover text when the game is over
         if(gamestate_over == true)
             game_setstatustext("Game Over | Press 'q' to continue",-1);
         
+        if(game_statustexttimeout > 0)
+            game_statustexttimeout -= 1;
+        
         //Update animations
-        if(animationTimer > 0)
-            animationTimer--;
-        else
-            animationTimer = 2;
+        TRACE_SPAN(game_animate());
+        game_tick++;
+    }
+}
+
+void game_animate() // Frames come from the tick, only finished one-shots need retiring
+{
+    int i;
+    
+    for(i=0;i<MAXEXPLOSIONS;i++)
+        if(obj_explosion[i].alive == true && anim_done(obj_explosion[i].anim,obj_explosion[i].animstart) == true)
+            obj_explosion[i].alive = false;
+}
+
+void game_backgroundscroll()
+{
+    int i;
+    
+    // Each layer wraps around on its own
+    for(i=0;i<background_layercount && i<MAXLAYERS;i++)
+    {
+        background_y[i] += background_layers[i].speed;
+        if(background_y[i] >= background_layers[i].height)
+            background_y[i] -= background_layers[i].height;
+    }
+}
+
+void game_settimescale(int scale)
+{
+    char speedmsg[64];
+    
+    if(scale < 1)
+        scale = 1;
+    if(scale > MAXTIMESCALE)
+        scale = MAXTIMESCALE;
+    sys_timescale = scale;
+    
+    // Keep the message on screen for about two seconds at any speed
+    sprintf(speedmsg,"Speed: %dx",sys_timescale);
+    game_setstatustext(speedmsg,120*sys_timescale);
+}
+
+void game_savestate(game_state* s)
+{
+    memcpy(s->players,obj_player,sizeof(obj_player));
+    memcpy(s->enemies,obj_enemy,sizeof(obj_enemy));
+    memcpy(s->explosions,obj_explosion,sizeof(obj_explosion));
+    s->enemyTimer = enemyTimer;
+    s->enemyspawnTimer = enemyspawnTimer;
+    s->tick = game_tick;
+    memcpy(s->background_y, background_y, sizeof(background_y));
+    s->enemytotal = game_enemytotal;
+    s->enemywaves = game_enemywaves;
+    memcpy(s->statustext,game_statustext,sizeof(game_statustext));
+    s->statustexttimeout = game_statustexttimeout;
+    s->over = gamestate_over;
+    s->init = gamestate_init;
+    s->randstate = sys_randstate;
+}
+
+void game_loadstate(const game_state* s)
+{
+    memcpy(obj_player,s->players,sizeof(obj_player));
+    memcpy(obj_enemy,s->enemies,sizeof(obj_enemy));
+    memcpy(obj_explosion,s->explosions,sizeof(obj_explosion));
+    enemyTimer = s->enemyTimer;
+    enemyspawnTimer = s->enemyspawnTimer;
+    game_tick = s->tick;
+    memcpy(background_y, s->background_y, sizeof(background_y));
+    game_enemytotal = s->enemytotal;
+    game_enemywaves = s->enemywaves;
+    memcpy(game_statustext,s->statustext,sizeof(game_statustext));
+    game_statustexttimeout = s->statustexttimeout;
+    gamestate_over = s->over;
+    gamestate_init = s->init;
+    sys_randstate = s->randstate;
+}
+
+void game_statehashes(const game_state* s, Uint32* h) // Checksums of the parts that affect play, see STATE_*
+{
+    // Dead enemies and lasers keep whatever they last had, which depends on
+    // earlier games and makes no difference to this one, so only the live
+    // ones count
+    int i,j;
+    
+    for(i=0;i<STATEPARTS;i++)
+        h[i] = 2166136261u;
+    
+    for(i=0;i<MAXPLAYERS;i++)
+    {
+        const player* p = &s->players[i];
+        h[STATE_PLAYERS] = sys_hash(h[STATE_PLAYERS],p->alive);
+        h[STATE_PLAYERS] = sys_hash(h[STATE_PLAYERS],p->dim.x);
+        h[STATE_PLAYERS] = sys_hash(h[STATE_PLAYERS],p->dim.y);
+        h[STATE_PLAYERS] = sys_hash(h[STATE_PLAYERS],p->score);
+        h[STATE_PLAYERS] = sys_hash(h[STATE_PLAYERS],p->health);
+        h[STATE_PLAYERS] = sys_hash(h[STATE_PLAYERS],p->laserTimer);
+        h[STATE_PLAYERS] = sys_hash(h[STATE_PLAYERS],p->invuln);
+        h[STATE_PLAYERS] = sys_hash(h[STATE_PLAYERS],p->invulnTimer);
+        h[STATE_PLAYERS] = sys_hash(h[STATE_PLAYERS],p->netspeedhorz);
+        h[STATE_PLAYERS] = sys_hash(h[STATE_PLAYERS],p->netspeedvert);
+        for(j=0;j<MAXLASERS;j++)
+        {
+            h[STATE_LASERS] = sys_hash(h[STATE_LASERS],p->laz[j].alive);
+            if(p->laz[j].alive == false)
+                continue;
+            h[STATE_LASERS] = sys_hash(h[STATE_LASERS],p->laz[j].dim.x);
+            h[STATE_LASERS] = sys_hash(h[STATE_LASERS],p->laz[j].dim.y);
+        }
+    }
+    
+    for(i=0;i<MAXENEMIES;i++)
+    {
+        const enemy* e = &s->enemies[i];
+        h[STATE_ENEMIES] = sys_hash(h[STATE_ENEMIES],e->alive);
+        if(e->alive == true)
+        {
+            h[STATE_ENEMIES] = sys_hash(h[STATE_ENEMIES],e->type);
+            h[STATE_ENEMIES] = sys_hash(h[STATE_ENEMIES],e->dim.x);
+            h[STATE_ENEMIES] = sys_hash(h[STATE_ENEMIES],e->dim.y);
+            h[STATE_ENEMIES] = sys_hash(h[STATE_ENEMIES],e->vm.pc);
+            h[STATE_ENEMIES] = sys_hash(h[STATE_ENEMIES],e->vm.wait);
+            h[STATE_ENEMIES] = sys_hash(h[STATE_ENEMIES],e->vm.turn);
+            h[STATE_ENEMIES] = sys_hash(h[STATE_ENEMIES],e->vm.vx);
+            h[STATE_ENEMIES] = sys_hash(h[STATE_ENEMIES],e->vm.vy);
+            h[STATE_ENEMIES] = sys_hash(h[STATE_ENEMIES],e->vm.fx);
+            h[STATE_ENEMIES] = sys_hash(h[STATE_ENEMIES],e->vm.fy);
+            for(j=0;j<VMREGS;j++)
+                h[STATE_ENEMIES] = sys_hash(h[STATE_ENEMIES],e->vm.r[j]);
+            if(e->vm.path != 0)
+            {
+                h[STATE_ENEMIES] = sys_hash(h[STATE_ENEMIES],e->vm.path);
+                h[STATE_ENEMIES] = sys_hash(h[STATE_ENEMIES],e->vm.speed);
+                h[STATE_ENEMIES] = sys_hash(h[STATE_ENEMIES],e->vm.ox);
+                h[STATE_ENEMIES] = sys_hash(h[STATE_ENEMIES],e->vm.oy);
+                h[STATE_ENEMIES] = sys_hash(h[STATE_ENEMIES],e->vm.along);
+            }
+            h[STATE_ENEMIES] = sys_hash(h[STATE_ENEMIES],e->laserTimer);
+        }
+        
+        // An enemy's lasers fly on after it dies
+        for(j=0;j<MAXLASERS;j++)
+        {
+            h[STATE_LASERS] = sys_hash(h[STATE_LASERS],e->laz[j].alive);
+            if(e->laz[j].alive == false)
+                continue;
+            h[STATE_LASERS] = sys_hash(h[STATE_LASERS],e->laz[j].dim.x);
+            h[STATE_LASERS] = sys_hash(h[STATE_LASERS],e->laz[j].dim.y);
+        }
     }
+    
+    h[STATE_WORLD] = sys_hash(h[STATE_WORLD],s->enemyspawnTimer);
+    h[STATE_WORLD] = sys_hash(h[STATE_WORLD],s->enemytotal);
+    h[STATE_WORLD] = sys_hash(h[STATE_WORLD],s->enemywaves);
+    h[STATE_WORLD] = sys_hash(h[STATE_WORLD],s->over);
+    h[STATE_WORLD] = sys_hash(h[STATE_WORLD],s->tick);
+    h[STATE_WORLD] = sys_hash(h[STATE_WORLD],(int)s->randstate);
+}
+
+Uint32 game_statehash(const game_state* s) // Checksum of everything that affects play
+{
+    Uint32 parts[STATEPARTS];
+    Uint32 h = 2166136261u;
+    int i;
+    
+    game_statehashes(s, parts);
+    for(i=0;i<STATEPARTS;i++)
+        h = sys_hash(h,(int)parts[i]);
+    
+    return h;
 }
 
 void game_newgame()
 {
+    int i;
+    
+    replay_newgame();
     gamestate_init = true;
     gamestate_title = false;
     gamestate_over = false;
@@ -673,14 +1502,21 @@ void game_newgame()
     action_moveright = false;
     action_moveup = false;
     action_movedown = false;
+    enemyTimer = 0;
+    enemyspawnTimer = 180;
+    game_tick = 0;
+    game_setstatustext("",0);
     game_lasersdestroy();
-    game_playerspawn();
+    for(i=0;i<MAXPLAYERS;i++)
+    {
+        game_input[i] = 0;
+        game_playerspawn(i);
+    }
     game_enemyspawn();
     gamestate_init = false;
     
-    sound_playmus();
+    events_push(GAMEEVENT_STATE,GAMESTATE_NEWGAME,0);
     
-    int i;
     for(i=0;i<MAXEXPLOSIONS;i++)
     {
         obj_explosion[i].alive = false;
@@ -693,8 +1529,7 @@ void game_titlescreen()
     gamestate_pause = false;
     gamestate_title = true;
     game_setstatustext("",0);
-    Mix_FadeOutMusic(sound_fadetime);
-    Mix_HaltChannel(-1);
+    events_push(GAMEEVENT_STATE,GAMESTATE_TITLE,0);
 }
 
 void game_pause()
@@ -702,13 +1537,13 @@ void game_pause()
     if(gamestate_pause == false)
     {
         game_setstatustext("Game Paused | Press 'q' to quit",-1);
-        Mix_VolumeMusic(sound_volmus_paused*10);
+        events_push(GAMEEVENT_STATE,GAMESTATE_PAUSE,0);
         gamestate_pause = true;
     }
     else
     {
         game_setstatustext("",0);
-        Mix_VolumeMusic(sound_volmus*10);
+        events_push(GAMEEVENT_STATE,GAMESTATE_RESUME,0);
         gamestate_pause = false;
     }
 }
@@ -719,202 +1554,326 @@ void game_setstatustext(char* text, int timeout)
     game_statustexttimeout = timeout;
 }
 
+const mask* game_enemymask(int j)
+{
+    if(obj_enemy[j].type == 0)
+        return &mask_enemy[anim_frame(obj_enemy[j].anim,obj_enemy[j].animstart)];
+    return &mask_enemy2[anim_frame(obj_enemy[j].anim,obj_enemy[j].animstart)];
+}
+
 void game_testcollisions()
 {
-    int i,j;
+    contact contacts[MAXCONTACTS];
     
-    // Check if player lasers hit enemies
-    for(i=0;i<MAXLASERS;i++)
+    game_resolvecontacts(contacts, game_findcontacts(contacts));
+}
+
+int game_findcontacts(contact* c) // Everything touching, without changing the state
+{
+    int n = 0;
+    int i,j,p;
+    
+    for(p=0;p<game_players;p++)
     {
+        const mask* pm = &mask_player[anim_frame(obj_player[p].anim,obj_player[p].animstart)];
+        
+        if(obj_player[p].alive == false)
+            continue;
+        
         for(j=0;j<MAXENEMIES;j++)
         {
-            if(obj_player.alive && obj_player.laz[i].alive == true && obj_enemy[j].alive == true && (obj_enemy[j].dim.y + obj_enemy[j].dim.h) >= 0)
+            // Player lasers against enemies that have come on screen
+            if(obj_enemy[j].alive == true && (obj_enemy[j].dim.y + obj_enemy[j].dim.h) >= 0)
+            {
+                for(i=0;i<MAXLASERS;i++)
+                {
+                    if(obj_player[p].laz[i].alive == true &&
+                       sys_collidemask(obj_player[p].laz[i].dim,&mask_laser,obj_enemy[j].dim,game_enemymask(j)) == true)
+                    {
+                        c[n].kind = CONTACT_LASER;
+                        c[n].a = p*MAXLASERS + i;
+                        c[n++].b = j;
+                    }
+                }
+            }
+            
+            // Enemy lasers against the player
+            for(i=0;i<MAXLASERS;i++)
             {
-                if(sys_collide(obj_player.laz[i].dim,obj_enemy[j].dim) == true)
+                if(obj_enemy[j].laz[i].alive == true &&
+                   sys_collidemask(obj_player[p].dim,pm,obj_enemy[j].laz[i].dim,&mask_laser_enemy) == true)
                 {
-                    obj_enemy[j].alive = false;
-                    game_enemytotal -= 1;
-                    obj_player.laz[i].alive = false;
-                    enemyTimer = 30;
-                    if(obj_enemy[j].type == 0)
-                        obj_player.score += 50;
-                    else if(obj_enemy[j].type == 1)
-                        obj_player.score += 100;
-                    game_explosionspawn(obj_enemy[j].dim.x,obj_enemy[j].dim.y);
-                    sound_playfx(snd_explosion);
-                    break;
+                    c[n].kind = CONTACT_SHOT;
+                    c[n].a = j*MAXLASERS + i;
+                    c[n++].b = p;
                 }
             }
+            
+            // Enemies flying into the player
+            if(obj_enemy[j].alive == true &&
+               sys_collidemask(obj_enemy[j].dim,game_enemymask(j),obj_player[p].dim,pm) == true)
+            {
+                c[n].kind = CONTACT_RAM;
+                c[n].a = j;
+                c[n++].b = p;
+            }
         }
     }
     
-    // Check if enemy lasers hit player
+    return n;
+}
+
+void game_resolvecontacts(const contact* c, int count)
+{
+    bool touch[MAXPLAYERS*MAXLASERS][MAXENEMIES];
+    bool shot[MAXENEMIES];
+    int first[MAXPLAYERS][MAXENEMIES]; // Lowest laser of each enemy on each player
+    int damage[MAXPLAYERS];
+    int i,j,p;
+    
+    for(i=0;i<MAXPLAYERS*MAXLASERS;i++)
+        for(j=0;j<MAXENEMIES;j++)
+            touch[i][j] = false;
+    for(p=0;p<MAXPLAYERS;p++)
+        for(j=0;j<MAXENEMIES;j++)
+            first[p][j] = MAXLASERS;
+    for(i=0;i<count;i++)
+    {
+        if(c[i].kind == CONTACT_LASER)
+            touch[c[i].a][c[i].b] = true;
+        else if(c[i].kind == CONTACT_SHOT && c[i].a % MAXLASERS < first[c[i].b][c[i].a / MAXLASERS])
+            first[c[i].b][c[i].a / MAXLASERS] = c[i].a % MAXLASERS;
+    }
+    
+    // Each laser, lowest first, shoots down the lowest enemy it touches
+    // that no laser before it did, and is spent; the rest fly on
     for(j=0;j<MAXENEMIES;j++)
+        shot[j] = false;
+    for(i=0;i<MAXPLAYERS*MAXLASERS;i++)
     {
-        for(i=0;i<MAXLASERS;i++)
+        for(j=0;j<MAXENEMIES;j++)
         {
-            if(obj_player.alive == true && obj_enemy[j].laz[i].alive == true)
+            if(touch[i][j] == true && shot[j] == false)
             {
-                if(sys_collide(obj_player.dim,obj_enemy[j].laz[i].dim) == true)
-                {
-                    if(obj_player.invuln == false)
-                    {
-                        obj_enemy[j].laz[i].alive = false;
-                        game_playerdamage(1);
-                    }
-                    break;
-                }
+                obj_player[i / MAXLASERS].laz[i % MAXLASERS].alive = false;
+                shot[j] = true;
+                break;
             }
         }
     }
-    
-    //Check if enemies hit the player
     for(j=0;j<MAXENEMIES;j++)
     {
-        if(obj_enemy[j].alive == true && obj_player.alive == true)
+        if(shot[j] == false)
+            continue;
+        EVENTS_INSTANT("enemy death");
+        obj_enemy[j].alive = false;
+        game_enemytotal -= 1;
+        enemyTimer = 30;
+        // The score is shared in co-op
+        if(obj_enemy[j].type == 0)
+            obj_player[0].score += 50;
+        else if(obj_enemy[j].type == 1)
+            obj_player[0].score += 100;
+        game_explosionspawn(obj_enemy[j].dim.x,obj_enemy[j].dim.y);
+        events_push(GAMEEVENT_EXPLOSION,obj_enemy[j].dim.x,obj_enemy[j].dim.y);
+    }
+    
+    // The hits on a player that was not invulnerable add up: 1 for each
+    // enemy whose lasers touched it, spending the lowest one, and 2 for each
+    // enemy that flew into it and was not shot down above
+    for(p=0;p<MAXPLAYERS;p++)
+    {
+        damage[p] = 0;
+        if(obj_player[p].invuln == true)
+            continue;
+        for(j=0;j<MAXENEMIES;j++)
         {
-            if(sys_collide(obj_enemy[j].dim,obj_player.dim) == true)
+            if(first[p][j] < MAXLASERS)
             {
-                if(obj_player.invuln == false)
-                {
-                    obj_enemy[j].alive = false;
-                    game_enemytotal -= 1;
-                    game_playerdamage(2);
-                }
-                break;
+                obj_enemy[j].laz[first[p][j]].alive = false;
+                damage[p] += 1;
             }
         }
     }
+    for(i=0;i<count;i++)
+    {
+        p = c[i].b;
+        if(c[i].kind != CONTACT_RAM || obj_player[p].invuln == true || shot[c[i].a] == true)
+            continue;
+        if(obj_enemy[c[i].a].alive == true)
+        {
+            EVENTS_INSTANT("enemy death");
+            obj_enemy[c[i].a].alive = false;
+            game_enemytotal -= 1;
+            damage[p] += 2;
+        }
+    }
+    for(p=0;p<MAXPLAYERS;p++)
+        if(damage[p] > 0)
+            game_playerdamage(p,damage[p]);
 }
 
-void game_playerspawn()
+void game_playerspawn(int p)
 {
-    obj_player.alive = true;
-    obj_player.invuln = false;
-    obj_player.invulnTimer = 0;
-    obj_player.score = 0;
-    obj_player.health = 5;
-    
-    obj_player.dim.w = 64;
-    obj_player.dim.h = 64;
-    obj_player.dim.x = 295;
-    obj_player.dim.y = SCREEN_BOTTOM - obj_player.dim.h;
+    obj_player[p].alive = p < game_players;
+    obj_player[p].invuln = false;
+    obj_player[p].invulnTimer = 0;
+    obj_player[p].score = 0;
+    obj_player[p].health = p < game_players ? 5 : 0;
+    obj_player[p].laserTimer = 0;
+    
+    obj_player[p].dim.w = 64;
+    obj_player[p].dim.h = 64;
+    if(game_players == 1)
+        obj_player[p].dim.x = 295;
+    else
+        obj_player[p].dim.x = 199 + p*192;
+    obj_player[p].dim.y = SCREEN_BOTTOM - obj_player[p].dim.h;
     
-    obj_player.frame = 0;
+    obj_player[p].anim = ANIM_PLAYER;
+    obj_player[p].animstart = game_tick;
     
-    obj_player.netspeedhorz = 0;
-    obj_player.netspeedvert = 0;
+    obj_player[p].netspeedhorz = 0;
+    obj_player[p].netspeedvert = 0;
 }
 
-void game_playermove()
+void game_playermove(int p)
 {
     int maxspeed = 8;
-
-    if(action_moveleft == true)
+    int input = game_input[p];
+    
+    if(input & ACTION_LEFT)
     {
-        if(obj_player.netspeedhorz > -maxspeed)
-            obj_player.netspeedhorz -= 1;
+        if(obj_player[p].netspeedhorz > -maxspeed)
+            obj_player[p].netspeedhorz -= 1;
     }
-    else if(action_moveright == true)
+    else if(input & ACTION_RIGHT)
     {
-        if(obj_player.netspeedhorz < maxspeed)
-            obj_player.netspeedhorz += 1;
+        if(obj_player[p].netspeedhorz < maxspeed)
+            obj_player[p].netspeedhorz += 1;
     }
-    if(action_moveup == true)
+    if(input & ACTION_UP)
     {
-        if(obj_player.netspeedvert > -maxspeed/2)
-            obj_player.netspeedvert -= 1;
+        if(obj_player[p].netspeedvert > -maxspeed/2)
+            obj_player[p].netspeedvert -= 1;
     }
-    else if(action_movedown == true)
+    else if(input & ACTION_DOWN)
     {
-        if(obj_player.netspeedvert < maxspeed/2)
-            obj_player.netspeedvert += 1;
+        if(obj_player[p].netspeedvert < maxspeed/2)
+            obj_player[p].netspeedvert += 1;
     }
     
-    if(action_moveleft == false)
+    if(!(input & ACTION_LEFT))
     {
-        if(obj_player.netspeedhorz < 0)
-            obj_player.netspeedhorz += 1;
+        if(obj_player[p].netspeedhorz < 0)
+            obj_player[p].netspeedhorz += 1;
     }
-    if(action_moveright == false)
+    if(!(input & ACTION_RIGHT))
     {
-        if(obj_player.netspeedhorz > 0)
-            obj_player.netspeedhorz -= 1;
+        if(obj_player[p].netspeedhorz > 0)
+            obj_player[p].netspeedhorz -= 1;
     }
-    if(action_moveup == false)
+    if(!(input & ACTION_UP))
     {
-        if(obj_player.netspeedvert < 0)
-            obj_player.netspeedvert += 1;
+        if(obj_player[p].netspeedvert < 0)
+            obj_player[p].netspeedvert += 1;
     }
-    if(action_movedown == false)
+    if(!(input & ACTION_DOWN))
     {
-        if(obj_player.netspeedvert > 0)
-            obj_player.netspeedvert -= 1;
+        if(obj_player[p].netspeedvert > 0)
+            obj_player[p].netspeedvert -= 1;
     }
-        
-    obj_player.dim.x += obj_player.netspeedhorz;
-    obj_player.dim.y += obj_player.netspeedvert;
     
-    if(obj_player.dim.x < 0)
-        obj_player.dim.x = 0;
-    if(obj_player.dim.y < 0)
-        obj_player.dim.y = 0;
-    if((obj_player.dim.x + obj_player.dim.w) > SCREEN_WIDTH)
-        obj_player.dim.x = SCREEN_WIDTH - obj_player.dim.w;
-    if((obj_player.dim.y + obj_player.dim.h) > SCREEN_BOTTOM)
-        obj_player.dim.y = SCREEN_BOTTOM - obj_player.dim.h;
+    obj_player[p].dim.x += obj_player[p].netspeedhorz;
+    obj_player[p].dim.y += obj_player[p].netspeedvert;
+    
+    if(obj_player[p].dim.x < 0)
+        obj_player[p].dim.x = 0;
+    if(obj_player[p].dim.y < 0)
+        obj_player[p].dim.y = 0;
+    if((obj_player[p].dim.x + obj_player[p].dim.w) > SCREEN_WIDTH)
+        obj_player[p].dim.x = SCREEN_WIDTH - obj_player[p].dim.w;
+    if((obj_player[p].dim.y + obj_player[p].dim.h) > SCREEN_BOTTOM)
+        obj_player[p].dim.y = SCREEN_BOTTOM - obj_player[p].dim.h;
 }
 
-void game_playerfire()
+void game_playerfire(int p)
 {
     int i;
     
-    if(action_fire == true && obj_player.laserTimer == 0)
+    if((game_input[p] & ACTION_FIRE) && obj_player[p].laserTimer == 0)
     {
         for(i=0;i<MAXLASERS;i++)
         {
-            obj_player.laz[i].dim.w = 8;
-            obj_player.laz[i].dim.h = 16;
+            obj_player[p].laz[i].dim.w = 8;
+            obj_player[p].laz[i].dim.h = 16;
             
-            if(obj_player.laz[i].alive != true)
+            if(obj_player[p].laz[i].alive != true)
             {
-                obj_player.laz[i].alive = true;
-                obj_player.laz[i].dim.x = obj_player.dim.x + (obj_player.dim.w/2);
-                obj_player.laz[i].dim.y = obj_player.dim.y - obj_player.laz[i].dim.h;
-                obj_player.laserTimer = 15;
-                sound_playfx(snd_player_fire);
+                obj_player[p].laz[i].alive = true;
+                obj_player[p].laz[i].dim.x = obj_player[p].dim.x + (obj_player[p].dim.w/2);
+                obj_player[p].laz[i].dim.y = obj_player[p].dim.y - obj_player[p].laz[i].dim.h;
+                obj_player[p].laserTimer = 15;
+                events_push(GAMEEVENT_FIRE,p,0);
                 break;
             }
         }
     }
     
-    if(obj_player.laserTimer > 0)
-        obj_player.laserTimer--;
+    if(obj_player[p].laserTimer > 0)
+        obj_player[p].laserTimer--;
 }
 
-void game_playerdamage(int d)
+void game_playerdamage(int p, int d)
 {
-    obj_player.invuln = true;
-    obj_player.invulnTimer = 100;
-    obj_player.health -= d;
-    sound_playfx(snd_explosion);
+    int i;
+    
+    obj_player[p].invuln = true;
+    obj_player[p].invulnTimer = 100;
+    obj_player[p].health -= d;
+    EVENTS_INSTANT("player damage");
+    events_push(GAMEEVENT_DAMAGE,p,d);
     
     // Check if player is dead
-    if(obj_player.health <= 0)
+    if(obj_player[p].health <= 0)
     {
-        obj_player.health = 0;
-        obj_player.alive = false;
-        game_explosionspawn(obj_player.dim.x,obj_player.dim.y);
+        obj_player[p].health = 0;
+        obj_player[p].alive = false;
+        game_explosionspawn(obj_player[p].dim.x,obj_player[p].dim.y);
+        
+        // The game is over once every player is dead
         gamestate_over = true;
+        for(i=0;i<game_players;i++)
+            if(obj_player[i].alive == true)
+                gamestate_over = false;
+        if(gamestate_over == true)
+            events_push(GAMEEVENT_STATE,GAMESTATE_OVER,0);
     }
 }
 
-void game_playerinvulntick()
+void game_playerinvulntick(int p)
 {
-    if(obj_player.invulnTimer != 0)
-        obj_player.invulnTimer--;
+    if(obj_player[p].invulnTimer != 0)
+        obj_player[p].invulnTimer--;
     else
-        obj_player.invuln = false;
+        obj_player[p].invuln = false;
+}
+
+bool game_loadscripts() // Compile the enemy behaviors
+{
+    char name[32];
+    int i;
+    
+    vm_reset();
+    if(path_bake(enemy_paths, enemy_pathcount) == false) { return false; }
+    for(i=0;i<enemy_scriptcount && i<MAXENEMYTYPES;i++)
+    {
+        sprintf(name,"enemy script %d",i);
+        enemy_entry[i] = vm_compile(enemy_scripts[i],name);
+        if(enemy_entry[i] == 0) { return false; }
+    }
+    
+    return true;
 }
 
 void game_enemyspawn()
@@ -939,24 +1898,7 @@ void game_enemyspawn()
             {                
                 if(obj_enemy[i].alive != true)
                 {
-                    if(game_enemywaves < 5)
-                    {
-                        obj_enemy[i].dim.w = 64;
-                        obj_enemy[i].dim.h = 32;
-                        obj_enemy[i].type = 0;
-                    }
-                    else
-                    {
-                        obj_enemy[i].dim.w = 64;
-                        obj_enemy[i].dim.h = 64;
-                        obj_enemy[i].type = 1;
-                    }
-                    obj_enemy[i].alive = true;
-                    game_enemytotal += 1;
-                    obj_enemy[i].frame = 0;
-                    obj_enemy[i].pathlength = 0;
-                    obj_enemy[i].laserTimer = 0;
-                    obj_enemy[i].dir = sys_rand(0,1);
+                    game_enemyinit(i, game_enemywaves < 5 ? 0 : 1);
                     obj_enemy[i].dim.x = sys_rand(0,SCREEN_WIDTH - obj_enemy[i].dim.w);
                     obj_enemy[i].dim.y = sys_rand(-192,-64);
                 }
@@ -973,63 +1915,61 @@ void game_enemyspawn()
     if(enemyspawnTimer == 179 && game_enemytotal == 0)
     {
         game_enemywaves += 1;
+        EVENTS_INSTANT("wave start");
+        events_push(GAMEEVENT_WAVE,game_enemywaves,0);
         sprintf(wavemsg,"Wave: %d",game_enemywaves);
         game_setstatustext(wavemsg,120);
     }
 }
 
-void game_enemymove()
+void game_enemyinit(int i, int type) // Bring enemy i to life, the caller places it
+{
+    obj_enemy[i].type = type;
+    obj_enemy[i].dim.w = 64;
+    obj_enemy[i].dim.h = type == 0 ? 32 : 64;
+    obj_enemy[i].alive = true;
+    game_enemytotal += 1;
+    obj_enemy[i].anim = type == 0 ? ANIM_ENEMY1 : ANIM_ENEMY2;
+    obj_enemy[i].animstart = game_tick;
+    obj_enemy[i].laserTimer = 0;
+    vm_start(&obj_enemy[i].vm, enemy_entry[type]);
+}
+
+int game_enemyplace(int type, int x, int y) // Index of the new enemy, -1 if all are in use
 {
-    int movespeed;
-    
     int i;
+    
+    for(i=0;i<MAXENEMIES;i++)
+    {
+        if(obj_enemy[i].alive == false)
+        {
+            game_enemyinit(i, type);
+            obj_enemy[i].dim.x = x;
+            obj_enemy[i].dim.y = y;
+            return i;
+        }
+    }
+    return -1;
+}
 
+void game_enemymove()
+{
+    int i;
+    
+    // Every live enemy's script in one pass
+    vm_run(obj_enemy, MAXENEMIES);
+    
     for(i=0;i<MAXENEMIES;i++)
     {
-        if(obj_enemy[i].alive == true)
+        while(obj_enemy[i].vm.fire > 0)
         {
-            if(obj_enemy[i].type == 0)
-                movespeed = 2;
-            else if(obj_enemy[i].type == 1)
-                movespeed = 3;
-            
-            if(obj_enemy[i].pathlength == 0)
-            {
-                obj_enemy[i].pathlength = sys_rand(10,SCREEN_WIDTH/2);
-            }
-            if(obj_enemy[i].pathlength != 0)
-            {
-                if(obj_enemy[i].dir == 0)
-                {
-                    if(obj_enemy[i].dim.x + obj_enemy[i].dim.w < SCREEN_WIDTH)
-                    {
-                        obj_enemy[i].dim.x += movespeed;
-                        obj_enemy[i].pathlength--;
-                    }
-                    if(obj_enemy[i].dim.x + obj_enemy[i].dim.w >= SCREEN_WIDTH || obj_enemy[i].pathlength == 0)
-                    {
-                        obj_enemy[i].dir = 1;
-                        obj_enemy[i].pathlength = 0;
-                    }
-                }
-                else if(obj_enemy[i].dir == 1)
-                {
-                    if(obj_enemy[i].dim.x > 0)
-                    {
-                        obj_enemy[i].dim.x -= movespeed;
-                        obj_enemy[i].pathlength--;
-                    }
-                    if(obj_enemy[i].dim.x <= 0 || obj_enemy[i].pathlength == 0)
-                    {
-                        obj_enemy[i].dir = 0;
-                        obj_enemy[i].pathlength = 0;
-                    }
-                }
-            }
-            
-            obj_enemy[i].dim.y += 1;
+            obj_enemy[i].vm.fire--;
+            game_enemyshoot(i);
         }
-        
+    }
+    
+    for(i=0;i<MAXENEMIES;i++)
+    {
         if(obj_enemy[i].dim.y > SCREEN_BOTTOM+obj_enemy[i].dim.h)
         {
             obj_enemy[i].alive = false;
@@ -1039,12 +1979,12 @@ void game_enemymove()
             if(gamestate_over == false)
             {
                 if(obj_enemy[i].type == 0)
-                    obj_player.score -= 100;
+                    obj_player[0].score -= 100;
                 else if(obj_enemy[i].type == 1)
-                    obj_player.score -= 200;
+                    obj_player[0].score -= 200;
             }
-            if(obj_player.score < 0)
-                obj_player.score = 0;
+            if(obj_player[0].score < 0)
+                obj_player[0].score = 0;
             break;
         }
     }
@@ -1052,31 +1992,42 @@ void game_enemymove()
         enemyTimer--;
 }
 
+bool game_enemyshoot(int j) // False if all of its lasers are already out
+{
+    int i;
+    
+    for(i=0;i<MAXLASERS;i++)
+    {
+        obj_enemy[j].laz[i].dim.w = 8;
+        obj_enemy[j].laz[i].dim.h = 16;
+        
+        if(obj_enemy[j].laz[i].alive != true)
+        {
+            obj_enemy[j].laz[i].alive = true;
+            obj_enemy[j].laz[i].dim.x = obj_enemy[j].dim.x + (obj_enemy[j].dim.w/2);
+            obj_enemy[j].laz[i].dim.y = obj_enemy[j].dim.y + obj_enemy[j].laz[i].dim.h;
+            events_push(GAMEEVENT_FIRE,-1,j);
+            return true;
+        }
+    }
+    
+    return false;
+}
+
 void game_enemyfire()
 {
-    int i,j;
+    int j;
     
     for(j=0;j<MAXENEMIES;j++)
     {
         if(obj_enemy[j].laserTimer == 0 && obj_enemy[j].alive && (obj_enemy[j].dim.y + obj_enemy[j].dim.h) >= 0)
         {
-            for(i=0;i<MAXLASERS;i++)
+            if(game_enemyshoot(j) == true)
             {
-                obj_enemy[j].laz[i].dim.w = 8;
-                obj_enemy[j].laz[i].dim.h = 16;
-                
-                if(obj_enemy[j].laz[i].alive != true)
-                {
-                    obj_enemy[j].laz[i].alive = true;
-                    obj_enemy[j].laz[i].dim.x = obj_enemy[j].dim.x + (obj_enemy[j].dim.w/2);
-                    obj_enemy[j].laz[i].dim.y = obj_enemy[j].dim.y + obj_enemy[j].laz[i].dim.h;
-                    if(obj_enemy[j].type == 0)
-                        obj_enemy[j].laserTimer = sys_rand(100,250);
-                    else if (obj_enemy[j].type == 1)
-                        obj_enemy[j].laserTimer = sys_rand(50,100);
-                    sound_playfx(snd_enemy_fire);
-                    break;
-                }
+                if(obj_enemy[j].type == 0)
+                    obj_enemy[j].laserTimer = sys_rand(100,250);
+                else if (obj_enemy[j].type == 1)
+                    obj_enemy[j].laserTimer = sys_rand(50,100);
             }
         }
         
@@ -1088,16 +2039,19 @@ void game_enemyfire()
 void game_lasersmove()
 {
     int movespeed = 10;
-    int i,j;
+    int i,j,p;
     
-    for(i=0;i<MAXLASERS;i++)
+    for(p=0;p<game_players;p++)
     {
-        if(obj_player.laz[i].alive == true)
+        for(i=0;i<MAXLASERS;i++)
         {
-            obj_player.laz[i].dim.y -= movespeed;
+            if(obj_player[p].laz[i].alive == true)
+            {
+                obj_player[p].laz[i].dim.y -= movespeed;
+            }
+            if(obj_player[p].laz[i].dim.y < 0)
+                obj_player[p].laz[i].alive = false;
         }
-        if(obj_player.laz[i].dim.y < 0)
-            obj_player.laz[i].alive = false;
     }
     
     for(j=0;j<MAXENEMIES;j++)
@@ -1116,10 +2070,11 @@ void game_lasersmove()
 
 void game_lasersdestroy()
 {
-    int i,j;
+    int i,j,p;
     
-    for(i=0;i<MAXLASERS;i++)
-        obj_player.laz[i].alive = false;
+    for(p=0;p<MAXPLAYERS;p++)
+        for(i=0;i<MAXLASERS;i++)
+            obj_player[p].laz[i].alive = false;
     
     for(j=0;j<MAXENEMIES;j++)
         for(i=0;i<MAXLASERS;i++)
@@ -1139,46 +2094,154 @@ void game_explosionspawn(int x, int y)
             obj_explosion[i].dim.y = y;
             obj_explosion[i].dim.w = 64;
             obj_explosion[i].dim.h = 64;
-            obj_explosion[i].frame = 0;
-            break;
+            obj_explosion[i].anim = ANIM_EXPLOSION;
+            obj_explosion[i].animstart = game_tick;
+            return;
         }
     }
+    
+    if(events_live() == true)
+        stats_count(STATS_EXPLOSIONSDROPPED);
 }
 
 //------------------------------
 // Main game loop
 //------------------------------
+#ifndef ESPADA_LIB
 int main(int argc, char* argv[])
 {
-    srand(time(0));
-        
+    sys_seed(time(0));
+    
+    sys_parseargs(argc, argv);
+    
+    // Before sys_init() so that the worker threads get their names
+    if(sys_tracefile[0] != '\0')
+        if(trace_start(sys_tracefile) == false) { return 1; }
+    
     if(sys_init() == false) { return 1; }
-    if(sys_loadfiles() == false) { return 1; }
     
+    // The clips are needed to build the collision masks
     set_clips();
-    sys_configload();
+    if(game_loadscripts() == false) { return 1; }
+    if(sys_loadfiles() == false) { return 1; }
+    if(sys_loadsounds() == false) { return 1; }
+    if(sys_levelfile[0] != '\0')
+        if(level_open(sys_levelfile) == false) { return 1; }
+    ui_setmenus(menus, sizeof(menus)/sizeof(ui_menu));
+    
+    pacer_init(FPS, sys_vsync, sys_maxframeskip);
+    
+    if(sys_netport > 0)
+    {
+        net_setsim(sys_netdelay, sys_netloss);
+        if(sys_nethost[0] == '\0' && net_host(sys_netport) == false) { return 1; }
+        if(sys_nethost[0] != '\0' && net_join(sys_nethost, sys_netport) == false) { return 1; }
+        sys_timescale = 1;
+        gamestate_title = false;
+    }
+    
+    if(sys_capturefile[0] != '\0')
+        if(capture_start(sys_capturefile, SCREEN_WIDTH, SCREEN_HEIGHT, FPS) == false) { return 1; }
+    
+    if(sys_metricsfile[0] != '\0')
+        if(stats_serve(sys_metricsfile) == false) { return 1; }
+    
+    if(sys_replayfile[0] != '\0')
+    {
+        if(sys_netport > 0)
+            fprintf(stderr, "Recording replays is not supported in netplay\n");
+        else if(level_active() == true)
+            fprintf(stderr, "Recording replays is not supported with --level, replays do not store the level\n");
+        else if(replay_record(sys_replayfile) == false) { return 1; }
+    }
+    
+    if(sys_soakhours > 0)
+        soak_start(sys_soakhours);
     
     while(quit == false)
     {
-        startTimer = SDL_GetTicks();
+        if(sys_idle() == true)
+        {
+            TRACE_SPAN(sys_idlewait());
+            sys_gameevents();
+            continue;
+        }
         
-        sys_input();
-        game_logic();
-        draw_everything();
+        TRACE_SPAN(sys_input());
+        if(sys_autoplay == true)
+            soak_autoplay();
         
-        //Update the screen
-        if(SDL_Flip(screen) == -1) { return 1; }
-            
-        endTimer = SDL_GetTicks();
-        deltaTimer = endTimer - startTimer;
-        if ( deltaTimer < ( 1000 / FPS ))
+        TRACE_BEGIN("logic");
+        pacer_beginlogic();
+        if(sys_netport > 0)
+        {
+            // Netplay runs (and re-runs) its own ticks
+            if(net_active() == false)
+                quit = true;
+            TRACE_SPAN(net_update(sys_actionbits()));
+        }
+        else
+        {
+            // Only the last of the logic ticks gets drawn in turbo mode
+            int tick;
+            game_input[0] = sys_actionbits();
+            for(tick=0;tick<sys_timescale;tick++)
+            {
+                TRACE_SPAN(game_logic());
+                replay_tick();
+            }
+        }
+        pacer_endlogic();
+        TRACE_END("logic");
+        
+        // Sounds for this frame's ticks, outside of the logic
+        TRACE_SPAN(sys_gameevents());
+        
+        // Under load, frames go undrawn so that the logic keeps its rate
+        if(pacer_shoulddraw() == true || sys_soakhours > 0)
         {
-            SDL_Delay( ( 1000 / FPS ) - deltaTimer );
+            TRACE_BEGIN("draw");
+            pacer_begindraw();
+            TRACE_SPAN(draw_everything());
+            TRACE_SPAN(capture_frame(screen));
+            pacer_enddraw();
+            TRACE_END("draw");
+            
+            //Update the screen
+            TRACE_BEGIN("present");
+            pacer_beginflip();
+            if(sys_present() == -1) { return 1; }
+            pacer_endflip();
+            TRACE_END("present");
         }
+        else
+            TRACE_INSTANT("frame skipped");
+        
+        stats_frame();
+        if(soak_frame() == false)
+            quit = true;
+        
+        //Wait for the next frame, unless soaking as fast as possible
+        if(sys_soakhours <= 0)
+            TRACE_SPAN(pacer_wait());
     }
     
+    pacer_report(stdout);
+    net_report(stdout);
+    events_report(stdout);
+    mixer_report(stdout);
+    level_report(stdout);
+    net_close();
+    capture_stop();
+    capture_report(stdout);
+    trace_stop();
+    stats_stop();
+    replay_stop();
+    bool soaked = soak_report(stdout);
+    
     sys_configupdate();
     sys_cleanup();
     
-    return 0;
+    return soaked == true ? 0 : 1;
 }
+#endif
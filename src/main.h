@@ -3,25 +3,45 @@ typedef enum { false = 0, true = 1 } bool;
 //------------------------------
 // Funtion declarations
 //------------------------------
+void sys_seed(Uint32 seed);
 int sys_rand(int low, int high);
+Uint32 sys_hash(Uint32 h, int v);
+int sys_actionbits();
 bool sys_collide();
 bool sys_init();
 void sys_configcreate();
 void sys_configupdate();
 void sys_configload();
 bool sys_loadfiles();
+bool sys_loadsounds();
 void sys_cleanup();
 void sys_input();
+void sys_parseargs(int argc, char* argv[]);
+int sys_present();
+void sys_gameevents();
+bool sys_idle();
+Uint32 sys_idletick(Uint32 interval, void* param);
+void sys_idletimer(bool on);
+void sys_idlewait();
 
 SDL_Surface *image_load(char * filename, bool withalpha);
+SDL_Surface* image_text(const char* text);
+void image_free(SDL_Surface* s);
 void image_apply( int x, int y, int alpha, SDL_Surface* source, SDL_Surface* destination, SDL_Rect* clip );
 
+bool text_init();
+void text_draw(int x, int y, const char* text, SDL_Surface* dest);
+
+Mix_Chunk* sound_load(char* filename);
+void sound_free(Mix_Chunk* c);
+
 void sound_playfx(Mix_Chunk* snd);
 void sound_playmus();
 void sound_setvolumes(int snd, int mus);
+void sound_volumeschanged();
+void sound_handleevent(int type, int a);
 
 void draw_everything();
-void draw_frameadvance(int* frame,int totalframes);
 void draw_background();
 void draw_titlescreen();
 void draw_info();
@@ -32,18 +52,25 @@ void draw_lasers();
 void draw_explosions();
 
 void game_logic();
+void game_animate();
+void game_backgroundscroll();
+void game_settimescale(int scale);
 void game_newgame();
 void game_titlescreen();
 void game_pause();
 void game_setstatustext(char* text, int timeout);
 void game_testcollisions();
-void game_playerspawn();
-void game_playermove();
-void game_playerfire();
-void game_playerdamage(int d);
-void game_playerinvulntick();
+void game_playerspawn(int p);
+void game_playermove(int p);
+void game_playerfire(int p);
+void game_playerdamage(int p, int d);
+void game_playerinvulntick(int p);
 void game_enemyspawn();
+void game_enemyinit(int i, int type);
+int game_enemyplace(int type, int x, int y);
+bool game_loadscripts();
 void game_enemymove();
+bool game_enemyshoot(int j);
 void game_enemyfire();
 void game_lasersmove();
 void game_lasersdestroy();
@@ -55,6 +82,20 @@ void game_explosionspawn(int x, int y);
 #define MAXLASERS 5
 #define MAXENEMIES 4
 #define MAXEXPLOSIONS 16
+#define MAXTIMESCALE 100
+#define MAXPLAYERS 2
+#define MAXLAYERS 4
+#define MAXENEMYTYPES 8
+#define EVENT_IDLETICK 1
+
+//------------------------------
+// Player input bits
+//------------------------------
+#define ACTION_LEFT 1
+#define ACTION_RIGHT 2
+#define ACTION_UP 4
+#define ACTION_DOWN 8
+#define ACTION_FIRE 16
 
 //------------------------------
 // Screen dimensions
@@ -64,100 +105,185 @@ void game_explosionspawn(int x, int y);
 #define SCREEN_BPP 32
 #define SCREEN_BOTTOM SCREEN_HEIGHT-32
 #define FPS 60
+#define TEXTFIRST 32   // Printable ASCII, ' ' to '~'
+#define TEXTGLYPHS 95
 
 //------------------------------
 // Timers
 //------------------------------
-int startTimer;
-int endTimer;
-int deltaTimer;
-int enemyTimer;
-int enemyspawnTimer = 180;
-int animationTimer;
-int statustextTimer;
+extern int enemyTimer;
+extern int enemyspawnTimer;
+extern int statustextTimer;
 
 //------------------------------
 // Image surfaces
 //------------------------------
-SDL_Surface* screen = NULL;
+extern SDL_Surface* screen;
+extern SDL_Surface* display;
+
+typedef struct background_layer{
+    char* file;
+    int height; // Scroll period, the height of the image
+    int speed;  // Pixels per tick
+}background_layer;
 
-SDL_Surface* background = NULL;
-int background_y = 0;
+extern background_layer background_layers[];
+extern int background_layercount;
+extern int background_y[MAXLAYERS];
 
-SDL_Surface* title_graphic = NULL;
-SDL_Surface* menu_cursor = NULL;
+extern SDL_Surface* title_graphic;
+extern SDL_Surface* menu_cursor;
 
-SDL_Surface* sprite_player = NULL;
-SDL_Surface* sprite_health_full = NULL;
-SDL_Surface* sprite_health_empty = NULL;
-SDL_Surface* sprite_laser = NULL;
-SDL_Surface* sprite_laser_enemy = NULL;
-SDL_Surface* sprite_enemy = NULL;
-SDL_Surface* sprite_enemy2 = NULL;
-SDL_Surface* sprite_explosion = NULL;
+extern SDL_Surface* sprite_player;
+extern SDL_Surface* sprite_health_full;
+extern SDL_Surface* sprite_health_empty;
+extern SDL_Surface* sprite_laser;
+extern SDL_Surface* sprite_laser_enemy;
+extern SDL_Surface* sprite_enemy;
+extern SDL_Surface* sprite_enemy2;
+extern SDL_Surface* sprite_explosion;
 
 //------------------------------
 // Text surfaces
 //------------------------------
-TTF_Font *font = NULL;
-SDL_Color textColor = { 255, 255, 255 };
-SDL_Surface* text_score = NULL;
-SDL_Surface* text_health = NULL;
-SDL_Surface* text_status = NULL;
-SDL_Surface* text_titlescreen = NULL;
+extern TTF_Font *font;
+extern SDL_Color textColor;
+extern SDL_Surface* text_glyphs;
+extern int text_glyphx[TEXTGLYPHS+1];
 
 //------------------------------
 // Sounds
 //------------------------------
-Mix_Music* music = NULL;
-Mix_Chunk* snd_player_fire = NULL;
-Mix_Chunk* snd_enemy_fire = NULL;
-Mix_Chunk* snd_explosion = NULL;
+extern Mix_Music* music;
+extern Mix_Chunk* snd_player_fire;
+extern Mix_Chunk* snd_enemy_fire;
+extern Mix_Chunk* snd_explosion;
 
-bool sound_enabled = true;
-int sound_fadetime = 500;
-int sound_volfx;
-int sound_volmus;
-int sound_volmus_paused;
+extern bool sound_enabled;
+extern int sound_fadetime;
+extern int sound_volfx;
+extern int sound_volmus;
+extern int sound_volmus_paused;
 
 //------------------------------
 // System variables
 //------------------------------
-bool quit = false;
-char* sys_configpath;
+extern bool quit;
+extern char* sys_configpath;
+extern Uint32 sys_randstate;
+extern bool sys_vsync;
+extern bool sys_mixer;
+extern int sys_timescale;
+extern int sys_timescales[];
+extern int sys_idlefps;
+extern int sys_maxframeskip;
+extern int sys_scale;
+extern int sys_scalefilter;
+extern int sys_threads;
+extern bool sys_redraw;
+extern int sys_idleticks;
 
 //------------------------------
 // Menus
 //------------------------------
-int menu_selection = 0;
-int menu_level = 0;
-char* menu_main[2][3] = {{"Start","Options","Quit"},{"SFX: ","Music: ","Back"}};
+#define MENU_MAIN 0
+#define MENU_OPTIONS 1
+
+#define MENU_START 0
+#define MENU_QUIT 1
 
 //------------------------------
 // Gameplay states
 //------------------------------
-SDL_Event event;
+extern SDL_Event event;
 
-bool gamestate_init = true;
-bool gamestate_title = true;
-bool gamestate_over = true;
-bool gamestate_pause = false;
+extern bool gamestate_init;
+extern bool gamestate_title;
+extern bool gamestate_over;
+extern bool gamestate_pause;
 
-bool action_moveleft = false;
-bool action_moveright = false;
-bool action_moveup = false;
-bool action_movedown = false;
-bool action_fire = false;
+extern bool action_moveleft;
+extern bool action_moveright;
+extern bool action_moveup;
+extern bool action_movedown;
+extern bool action_fire;
 
 //------------------------------
 // Gameplay variables
 //------------------------------
-int game_enemytotal;
-int game_enemyspawnlimit;
-int game_enemywaves;
+extern int game_players;
+extern int game_tick;
+extern int game_input[MAXPLAYERS];
+
+extern int game_enemytotal;
+extern int game_enemyspawnlimit;
+extern int game_enemywaves;
+
+extern char game_statustext[100];
+extern int game_statustexttimeout;
+
+//------------------------------
+// Collision masks
+//------------------------------
+// One bit per opaque pixel, bit x of a row is column x. Sprites up to
+// 64x64 fit; an empty mask (w == 0) collides like its rectangle.
+typedef struct mask{
+    int w;
+    int h;
+    Uint64 rows[64];
+}mask;
+
+void image_buildmask(SDL_Surface* s, SDL_Rect* clip, mask* m);
+SDL_Surface* image_loadmasked(char* filename, SDL_Rect* clips, int count, mask* masks);
+bool image_loadmask(char* filename, SDL_Rect* clips, int count, mask* masks);
+bool game_loadmasks();
+bool sys_collidemask(SDL_Rect A, const mask* a, SDL_Rect B, const mask* b);
+const mask* game_enemymask(int j);
+
+extern mask mask_player[2];
+extern mask mask_enemy[2];
+extern mask mask_enemy2[2];
+extern mask mask_laser;
+extern mask mask_laser_enemy;
+
+//------------------------------
+// Behavior scripts
+//------------------------------
+#define VMREGS 4
+
+// Where an enemy is in its script, see vm.h
+typedef struct vm_context{
+    Uint16 pc;       // 0 once the script has ended
+    Sint16 wait;     // Ticks until the script runs again
+    Sint16 turn;     // Added to the heading every tick
+    Sint16 vx;       // Pixels per tick, 8.8 fixed point
+    Sint16 vy;
+    Uint8 fx;        // Sub-pixel position
+    Uint8 fy;
+    Uint8 fire;      // Shots asked for this tick
+    Uint8 path;      // 1 + the path being flown, 0 for none
+    Sint16 speed;    // Along the path, 8.8 fixed point
+    Sint16 ox;       // Where the enemy started the path
+    Sint16 oy;
+    Sint32 along;    // Distance flown, 24.8 fixed point, below 0 while held back
+    Sint32 length;   // Of the path, the same
+    Sint16 r[VMREGS];
+}vm_context;
+
+// A flight path, see path.h
+#define MAXPATHS 16
+#define PATHCONTROLS 12
 
-char game_statustext[100];
-char game_statustexttimeout;
+typedef struct path_def{
+    int count;
+    Sint16 points[PATHCONTROLS][2]; // Pixels from the start, so the first is 0,0
+}path_def;
+
+extern const char* enemy_scripts[];
+extern int enemy_scriptcount;
+extern int enemy_entry[MAXENEMYTYPES];
+extern const path_def enemy_paths[];
+extern int enemy_pathcount;
 
 //------------------------------
 // Game object structures
@@ -176,7 +302,8 @@ typedef struct player{
     laser laz[MAXLASERS];
     bool invuln;
     int invulnTimer;
-    int frame;
+    int anim;       // Animation and the tick it started on, see anim.h
+    int animstart;
     int netspeedhorz;
     int netspeedvert;
 }player;
@@ -185,19 +312,72 @@ typedef struct enemy{
     bool alive;
     int type;
     SDL_Rect dim;
-    int pathlength;
-    int dir;
+    vm_context vm;
     int laserTimer;
     laser laz[MAXLASERS];
-    int frame;
+    int anim;
+    int animstart;
 }enemy;
 
 typedef struct explosion{
     bool alive;
     SDL_Rect dim;
-    int frame;
+    int anim;
+    int animstart;
 }explosion;
 
-player obj_player;
-enemy obj_enemy[MAXENEMIES];
-explosion obj_explosion[MAXEXPLOSIONS];
+//------------------------------
+// Collisions
+//------------------------------
+// game_testcollisions() first finds everything that touches, without
+// changing anything, then applies the hits all together, so the outcome
+// does not depend on the order the objects were checked in.
+#define CONTACT_LASER 0  // Laser a (player*MAXLASERS + slot) hit enemy b
+#define CONTACT_SHOT 1   // Laser a (enemy*MAXLASERS + slot) hit player b
+#define CONTACT_RAM 2    // Enemy a flew into player b
+#define MAXCONTACTS (2*MAXPLAYERS*MAXENEMIES*MAXLASERS + MAXPLAYERS*MAXENEMIES)
+
+typedef struct contact{
+    Uint8 kind;
+    Uint8 a;
+    Uint8 b;
+}contact;
+
+int game_findcontacts(contact* c);
+void game_resolvecontacts(const contact* c, int count);
+
+//------------------------------
+// Saved game state
+//------------------------------
+typedef struct game_state{
+    player players[MAXPLAYERS];
+    enemy enemies[MAXENEMIES];
+    explosion explosions[MAXEXPLOSIONS];
+    int enemyTimer;
+    int enemyspawnTimer;
+    int tick;
+    int background_y[MAXLAYERS];
+    int enemytotal;
+    int enemywaves;
+    char statustext[100];
+    int statustexttimeout;
+    bool over;
+    bool init;
+    Uint32 randstate;
+}game_state;
+
+// Parts of the state that game_statehashes() checks separately
+#define STATE_PLAYERS 0
+#define STATE_ENEMIES 1
+#define STATE_LASERS 2
+#define STATE_WORLD 3   // Waves, timers, the tick and the random state
+#define STATEPARTS 4
+
+void game_savestate(game_state* s);
+void game_loadstate(const game_state* s);
+void game_statehashes(const game_state* s, Uint32* h);
+Uint32 game_statehash(const game_state* s);
+
+extern player obj_player[MAXPLAYERS];
+extern enemy obj_enemy[MAXENEMIES];
+extern explosion obj_explosion[MAXEXPLOSIONS];
@@ -0,0 +1,215 @@
+/*
+    Espada - A retro 2D space shooter
+    Copyright (C) 2011  Justin Jacobs
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SDL/SDL.h"
+#include "SDL/SDL_ttf.h"
+#include "SDL/SDL_mixer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "main.h"
+#include "pacer.h"
+#include "mixer.h"
+#include "trace.h"
+
+// The voices, one array per field. Only the audio callback and callers
+// holding SDL_LockAudio() touch them.
+static const Sint16* mixer_samples[MAXVOICES];
+static int mixer_left[MAXVOICES];   // Samples still to play
+static Sint16 mixer_gain[MAXVOICES]; // 1.15 fixed point
+static int mixer_voices = 0;
+
+static bool mixer_on = false;
+static mixer_stats mixer_totals;
+
+//------------------------------
+// Mixing
+//------------------------------
+static void mixer_add(Sint16* out, const Sint16* in, int n, Sint16 gain) // out += in*gain, saturated
+{
+    int i = 0;
+
+#ifdef __SSE2__
+    __m128i g = _mm_set1_epi16(gain);
+    
+    for(;i+8<=n;i+=8)
+    {
+        __m128i s = _mm_loadu_si128((const __m128i*)(in+i));
+        __m128i d = _mm_loadu_si128((const __m128i*)(out+i));
+        __m128i lo = _mm_mullo_epi16(s, g);
+        __m128i hi = _mm_mulhi_epi16(s, g);
+        
+        // Full 32-bit products, back down to 16 bits with saturation
+        __m128i a = _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), 15);
+        __m128i b = _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), 15);
+        d = _mm_adds_epi16(d, _mm_packs_epi32(a, b));
+        _mm_storeu_si128((__m128i*)(out+i), d);
+    }
+#endif
+    
+    for(;i<n;i++)
+    {
+        int v = out[i] + ((in[i] * gain) >> 15);
+        out[i] = v > 32767 ? 32767 : v < -32768 ? -32768 : v;
+    }
+}
+
+static void mixer_callback(void* data, Uint8* stream, int len) // On SDL's audio thread, after the music
+{
+    Sint16* out = (Sint16*)stream;
+    int samples = len / (int)sizeof(Sint16);
+    Uint64 start = pacer_now();
+    Uint64 took;
+    int i = 0;
+    
+    TRACE_BEGIN("mixer");
+    while(i < mixer_voices)
+    {
+        int n = mixer_left[i] < samples ? mixer_left[i] : samples;
+        
+        mixer_add(out, mixer_samples[i], n, mixer_gain[i]);
+        mixer_samples[i] += n;
+        mixer_left[i] -= n;
+        mixer_totals.voicesamples += n;
+        
+        // A finished voice is replaced by the last one, which is mixed next
+        if(mixer_left[i] == 0)
+        {
+            mixer_voices--;
+            mixer_samples[i] = mixer_samples[mixer_voices];
+            mixer_left[i] = mixer_left[mixer_voices];
+            mixer_gain[i] = mixer_gain[mixer_voices];
+        }
+        else
+            i++;
+    }
+    TRACE_END("mixer");
+    
+    took = pacer_now() - start;
+    mixer_totals.callbacks++;
+    mixer_totals.time_total += took;
+    if(took > mixer_totals.time_max)
+        mixer_totals.time_max = took;
+}
+
+//------------------------------
+// Control
+//------------------------------
+bool mixer_open()
+{
+    int rate,channels;
+    Uint16 format;
+    
+    if(Mix_QuerySpec(&rate, &format, &channels) == 0)
+        return false;
+    if(format != AUDIO_S16SYS)
+    {
+        fprintf(stderr, "The software mixer needs 16-bit audio, using SDL_mixer's channels\n");
+        return false;
+    }
+    
+    memset(&mixer_totals, 0, sizeof(mixer_totals));
+    mixer_voices = 0;
+    Mix_SetPostMix(mixer_callback, NULL);
+    mixer_on = true;
+    return true;
+}
+
+void mixer_play(Mix_Chunk* c, int volume) // volume from 0 to MIX_MAX_VOLUME
+{
+    int v;
+    
+    if(mixer_on == false || c == NULL || volume <= 0)
+        return;
+    
+    SDL_LockAudio();
+    v = mixer_voices;
+    if(v == MAXVOICES)
+    {
+        // Cut short whichever voice is nearest its end
+        int i;
+        for(v=0,i=1;i<MAXVOICES;i++)
+            if(mixer_left[i] < mixer_left[v])
+                v = i;
+        mixer_totals.stolen++;
+    }
+    else
+        mixer_voices++;
+    
+    mixer_samples[v] = (const Sint16*)c->abuf;
+    mixer_left[v] = c->alen / sizeof(Sint16);
+    mixer_gain[v] = volume >= MIX_MAX_VOLUME ? 32767 : volume * 32768 / MIX_MAX_VOLUME;
+    mixer_totals.played++;
+    if(mixer_voices > mixer_totals.voices_max)
+        mixer_totals.voices_max = mixer_voices;
+    SDL_UnlockAudio();
+}
+
+void mixer_stopall()
+{
+    if(mixer_on == false)
+        return;
+    SDL_LockAudio();
+    mixer_voices = 0;
+    SDL_UnlockAudio();
+}
+
+int mixer_playing() // Only a gauge, so no need to lock
+{
+    return __atomic_load_n(&mixer_voices, __ATOMIC_RELAXED);
+}
+
+void mixer_close() // Before the sounds are freed
+{
+    if(mixer_on == false)
+        return;
+    Mix_SetPostMix(NULL, NULL);
+    mixer_stopall();
+    mixer_on = false;
+}
+
+//------------------------------
+// Statistics
+//------------------------------
+void mixer_getstats(mixer_stats* s)
+{
+    SDL_LockAudio();
+    *s = mixer_totals;
+    SDL_UnlockAudio();
+}
+
+void mixer_report(FILE* f)
+{
+    mixer_stats s;
+    
+    mixer_getstats(&s);
+    if(s.callbacks == 0)
+        return;
+    
+    fprintf(f,
+    "Mixer: %llu sounds, %llu cut short, at most %d at once\n"
+    "Mixing avg/max: %.3f/%.3f ms per callback, %.2f ns per voice sample\n",
+    (unsigned long long)s.played, (unsigned long long)s.stolen, s.voices_max,
+    s.time_total/(double)s.callbacks/1000000.0, s.time_max/1000000.0,
+    s.voicesamples > 0 ? s.time_total/(double)s.voicesamples : 0.0);
+}
@@ -0,0 +1,33 @@
+//------------------------------
+// Software mixer
+//------------------------------
+// An optional replacement for SDL_mixer's channels for the sound effects
+// (mixer=1 in the config). SDL_mixer still opens the device and plays the
+// music; mixer_open() hooks its post-mix callback and adds the effect
+// voices on top. Mix_LoadWAV() has already converted the effects to the
+// device's format and rate, so a voice is just a pointer into the samples,
+// kept with the others in flat arrays. Each voice is scaled by its gain
+// and added in with saturation, eight samples at a time with SSE2.
+//
+// Only signed 16-bit output is supported; with anything else mixer_open()
+// fails and the channels are used as before.
+
+#define MAXVOICES 64
+
+typedef struct mixer_stats{
+    Uint64 callbacks;
+    Uint64 played;
+    Uint64 stolen;       // Voices cut short to make room for a new one
+    Uint64 time_total;   // Nanoseconds spent mixing voices
+    Uint64 time_max;
+    Uint64 voicesamples; // Samples mixed, over all voices
+    int voices_max;
+}mixer_stats;
+
+bool mixer_open();
+void mixer_play(Mix_Chunk* c, int volume);
+void mixer_stopall();
+int mixer_playing();
+void mixer_close();
+void mixer_getstats(mixer_stats* s);
+void mixer_report(FILE* f);
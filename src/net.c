@@ -0,0 +1,544 @@
+/*
+    Espada - A retro 2D space shooter
+    Copyright (C) 2011  Justin Jacobs
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SDL/SDL.h"
+#include "SDL/SDL_ttf.h"
+#include "SDL/SDL_mixer.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "main.h"
+#include "pacer.h"
+#include "net.h"
+#include "events.h"
+
+#define NET_RING 128
+#define NET_MAXROLLBACK 16
+#define NET_MAXINPUTS 40
+#define NET_QUEUE 256
+#define NET_TIMEOUT 5000000000ULL
+
+#define NET_HELLO 1
+#define NET_START 2
+#define NET_INPUT 3
+
+typedef struct net_packet{
+    Uint64 due;
+    int len;
+    Uint8 data[128];
+}net_packet;
+
+static int net_socket = -1;
+static struct sockaddr_in net_peer;
+static bool net_haspeer;
+static bool net_ishost;
+static bool net_started;
+static bool net_peerready;
+static int net_localplayer;
+static Uint32 net_seed;
+static int net_waitframes;
+static Uint64 net_lastheard;
+
+// Inputs and game states by tick, indexed modulo NET_RING
+static int net_tick;
+static game_state net_states[NET_RING];
+static Uint8 net_localinput[NET_RING];
+static Uint8 net_remoteinput[NET_RING];
+static Uint8 net_predicted[NET_RING];
+static Uint32 net_hash[NET_RING];
+static int net_hashtick[NET_RING];
+static int net_hashnext;
+
+static int net_remotenext;      // first tick we have no remote input for
+static int net_remoteack;       // first tick the peer has no input from us for
+static int net_remotetick;
+static int net_remoteadvantage;
+static int net_remotehashtick;
+static Uint32 net_remotehash;
+static int net_rollbackfrom;
+static int net_stallcooldown;
+
+// Simulated network conditions
+static int net_delay;
+static int net_loss;
+static Uint32 net_simrand = 2463534242u;
+static net_packet net_queue[NET_QUEUE];
+static int net_queuelen;
+
+static net_stats net_st;
+
+static void net_put32(Uint8* p, Uint32 v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+}
+
+static Uint32 net_get32(const Uint8* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((Uint32)p[3] << 24);
+}
+
+//------------------------------
+// Socket
+//------------------------------
+#ifndef _WIN32
+static bool net_open(int port)
+{
+    struct sockaddr_in addr;
+    
+    net_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if(net_socket < 0)
+    {
+        perror("socket");
+        return false;
+    }
+    
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if(bind(net_socket, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        perror("bind");
+        net_close();
+        return false;
+    }
+    
+    fcntl(net_socket, F_SETFL, fcntl(net_socket, F_GETFL, 0) | O_NONBLOCK);
+    return true;
+}
+
+static void net_sendnow(const Uint8* data, int len)
+{
+    sendto(net_socket, data, len, 0, (struct sockaddr*)&net_peer, sizeof(net_peer));
+}
+
+static void net_send(const Uint8* data, int len)
+{
+    net_st.sent++;
+    
+    if(net_loss > 0)
+    {
+        net_simrand ^= net_simrand << 13;
+        net_simrand ^= net_simrand >> 17;
+        net_simrand ^= net_simrand << 5;
+        if((int)(net_simrand % 100) < net_loss)
+        {
+            net_st.dropped++;
+            return;
+        }
+    }
+    
+    if(net_delay > 0 && net_queuelen < NET_QUEUE)
+    {
+        net_packet* p = &net_queue[net_queuelen++];
+        p->due = pacer_now() + (Uint64)net_delay * 1000000;
+        p->len = len;
+        memcpy(p->data, data, len);
+        return;
+    }
+    
+    net_sendnow(data, len);
+}
+
+static void net_flushqueue() // Send delayed packets whose time has come, in order
+{
+    Uint64 now = pacer_now();
+    int i;
+    int sent = 0;
+    
+    while(sent < net_queuelen && net_queue[sent].due <= now)
+    {
+        net_sendnow(net_queue[sent].data, net_queue[sent].len);
+        sent++;
+    }
+    
+    if(sent > 0)
+    {
+        for(i=sent;i<net_queuelen;i++)
+            net_queue[i-sent] = net_queue[i];
+        net_queuelen -= sent;
+    }
+}
+#endif
+
+//------------------------------
+// Session
+//------------------------------
+static void net_start(Uint32 seed)
+{
+    int i;
+    
+    net_seed = seed;
+    sys_seed(seed);
+    game_players = 2;
+    game_newgame();
+    
+    net_tick = 0;
+    net_remotenext = 0;
+    net_remoteack = 0;
+    net_remotetick = 0;
+    net_remoteadvantage = 0;
+    net_remotehashtick = -1;
+    net_rollbackfrom = 0;
+    net_hashnext = 0;
+    net_stallcooldown = 0;
+    for(i=0;i<NET_RING;i++)
+        net_hashtick[i] = -1;
+    
+    net_started = true;
+    net_lastheard = pacer_now();
+}
+
+static void net_simulate(int t) // Run tick t, saving the state it starts from
+{
+    int r = t % NET_RING;
+    int remote = 0;
+    
+    if(t < net_remotenext)
+        remote = net_remoteinput[r];
+    else if(net_remotenext > 0)
+        remote = net_remoteinput[(net_remotenext-1) % NET_RING];
+    
+    game_savestate(&net_states[r]);
+    net_predicted[r] = remote;
+    game_input[net_localplayer] = net_localinput[r];
+    game_input[1-net_localplayer] = remote;
+    game_logic();
+}
+
+static void net_rollback()
+{
+    Uint64 start = pacer_now();
+    Uint64 elapsed;
+    int depth = net_tick - net_rollbackfrom;
+    int t;
+    
+    game_loadstate(&net_states[net_rollbackfrom % NET_RING]);
+    events_mute(true);
+    for(t=net_rollbackfrom;t<net_tick;t++)
+        net_simulate(t);
+    events_mute(false);
+    elapsed = pacer_now() - start;
+    
+    net_st.rollbacks++;
+    net_st.rollback_ticks += depth;
+    if(depth > net_st.rollback_max)
+        net_st.rollback_max = depth;
+    if(elapsed > net_st.resim_max)
+        net_st.resim_max = elapsed;
+    
+    net_rollbackfrom = net_tick;
+}
+
+static void net_checkhash()
+{
+    int r = net_remotehashtick % NET_RING;
+    
+    if(net_remotehashtick < 0 || net_remotehashtick >= net_hashnext || net_hashtick[r] != net_remotehashtick)
+        return;
+    if(net_hash[r] != net_remotehash && net_st.desync_tick < 0)
+    {
+        net_st.desync_tick = net_remotehashtick;
+        fprintf(stderr, "Netplay desync at tick %d\n", net_remotehashtick);
+    }
+}
+
+static void net_readinput(const Uint8* buf, int len)
+{
+    int count = buf[1];
+    int first = (int)net_get32(buf+2);
+    int i;
+    
+    if(len < 26 + count)
+        return;
+    
+    net_remotetick = (int)net_get32(buf+6);
+    if((int)net_get32(buf+10) > net_remoteack)
+        net_remoteack = (int)net_get32(buf+10);
+    net_remoteadvantage = (int)net_get32(buf+14);
+    net_remotehashtick = (int)net_get32(buf+18);
+    net_remotehash = net_get32(buf+22);
+    
+    for(i=0;i<count;i++)
+    {
+        int t = first + i;
+        int r = t % NET_RING;
+        
+        // Take inputs in order only; anything past a gap will be sent again
+        if(t != net_remotenext || t >= net_tick + NET_RING/2)
+            continue;
+        
+        net_remoteinput[r] = buf[26+i];
+        net_remotenext++;
+        if(t < net_tick && net_remoteinput[r] != net_predicted[r] && t < net_rollbackfrom)
+            net_rollbackfrom = t;
+    }
+    
+    net_checkhash();
+}
+
+static void net_receive()
+{
+#ifndef _WIN32
+    Uint8 buf[256];
+    struct sockaddr_in from;
+    socklen_t fromlen;
+    int len;
+    
+    while(1)
+    {
+        fromlen = sizeof(from);
+        len = recvfrom(net_socket, buf, sizeof(buf), 0, (struct sockaddr*)&from, &fromlen);
+        if(len <= 0)
+            break;
+        
+        if(net_haspeer == true && (from.sin_addr.s_addr != net_peer.sin_addr.s_addr || from.sin_port != net_peer.sin_port))
+            continue;
+        
+        net_st.received++;
+        net_lastheard = pacer_now();
+        
+        if(buf[0] == NET_HELLO && net_ishost == true && net_haspeer == false)
+        {
+            net_peer = from;
+            net_haspeer = true;
+            net_start((Uint32)time(0) ^ (Uint32)pacer_now());
+        }
+        else if(buf[0] == NET_START && net_ishost == false && net_started == false && len >= 5)
+        {
+            net_start(net_get32(buf+1));
+        }
+        else if(buf[0] == NET_INPUT && net_started == true && len >= 26)
+        {
+            net_peerready = true;
+            net_readinput(buf, len);
+        }
+    }
+#endif
+}
+
+static void net_sendinput()
+{
+#ifndef _WIN32
+    Uint8 buf[26 + NET_MAXINPUTS];
+    int first = net_remoteack;
+    int count = net_tick - first;
+    int i;
+    
+    if(count > NET_MAXINPUTS)
+        count = NET_MAXINPUTS;
+    
+    buf[0] = NET_INPUT;
+    buf[1] = count;
+    net_put32(buf+2, first);
+    net_put32(buf+6, net_tick);
+    net_put32(buf+10, net_remotenext);
+    net_put32(buf+14, net_tick - net_remotetick);
+    net_put32(buf+18, net_hashnext-1);
+    net_put32(buf+22, net_hashnext > 0 ? net_hash[(net_hashnext-1) % NET_RING] : 0);
+    for(i=0;i<count;i++)
+        buf[26+i] = net_localinput[(first+i) % NET_RING];
+    
+    net_send(buf, 26 + count);
+#endif
+}
+
+static bool net_shouldstall()
+{
+    int ahead;
+    
+    // Too far past the last confirmed input to roll back
+    if(net_tick - net_remotenext >= NET_MAXROLLBACK)
+        return true;
+    
+    // Give up the odd frame while we run ahead of the peer so that
+    // both sides see about the same latency and roll back about as often
+    ahead = ((net_tick - net_remotetick) - net_remoteadvantage) / 2;
+    if(net_stallcooldown > 0)
+        net_stallcooldown--;
+    else if(ahead > 1)
+    {
+        net_stallcooldown = 10;
+        return true;
+    }
+    return false;
+}
+
+bool net_host(int port)
+{
+#ifndef _WIN32
+    net_ishost = true;
+    net_localplayer = 0;
+    net_st.desync_tick = -1;
+    return net_open(port);
+#else
+    fprintf(stderr, "Netplay is not supported on this platform\n");
+    return false;
+#endif
+}
+
+bool net_join(const char* host, int port)
+{
+#ifndef _WIN32
+    struct addrinfo hints;
+    struct addrinfo* res;
+    
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if(getaddrinfo(host, NULL, &hints, &res) != 0)
+    {
+        fprintf(stderr, "Could not resolve %s\n", host);
+        return false;
+    }
+    memcpy(&net_peer, res->ai_addr, sizeof(net_peer));
+    net_peer.sin_port = htons(port);
+    freeaddrinfo(res);
+    
+    net_ishost = false;
+    net_haspeer = true;
+    net_localplayer = 1;
+    net_st.desync_tick = -1;
+    return net_open(0);
+#else
+    fprintf(stderr, "Netplay is not supported on this platform\n");
+    return false;
+#endif
+}
+
+void net_setsim(int delayms, int losspct)
+{
+    net_delay = delayms;
+    net_loss = losspct;
+}
+
+bool net_active()
+{
+    return net_socket >= 0 ? true : false;
+}
+
+void net_update(int input)
+{
+#ifndef _WIN32
+    Uint8 buf[8];
+    
+    if(net_socket < 0)
+        return;
+    
+    net_flushqueue();
+    net_receive();
+    
+    if(net_started == false)
+    {
+        if(net_ishost == false && net_waitframes++ % 30 == 0)
+        {
+            buf[0] = NET_HELLO;
+            net_send(buf, 1);
+        }
+        game_setstatustext("Waiting for the other player", 2);
+        return;
+    }
+    
+    if(pacer_now() - net_lastheard > NET_TIMEOUT)
+    {
+        fprintf(stderr, "Netplay connection lost\n");
+        net_close();
+        return;
+    }
+    
+    // The host keeps announcing the game until the joiner is sending inputs
+    if(net_ishost == true && net_peerready == false)
+    {
+        buf[0] = NET_START;
+        net_put32(buf+1, net_seed);
+        net_send(buf, 5);
+    }
+    
+    if(net_rollbackfrom < net_tick)
+        net_rollback();
+    
+    // Hash every state whose inputs are all confirmed
+    while(net_hashnext < net_tick && net_hashnext <= net_remotenext)
+    {
+        int r = net_hashnext % NET_RING;
+        net_hash[r] = game_statehash(&net_states[r]);
+        net_hashtick[r] = net_hashnext;
+        net_hashnext++;
+    }
+    net_checkhash();
+    
+    if(net_shouldstall() == true)
+        net_st.stalls++;
+    else
+    {
+        net_localinput[net_tick % NET_RING] = input;
+        net_simulate(net_tick);
+        net_tick++;
+        net_rollbackfrom = net_tick;
+        net_st.ticks++;
+    }
+    
+    net_sendinput();
+#endif
+}
+
+void net_close()
+{
+#ifndef _WIN32
+    if(net_socket >= 0)
+        close(net_socket);
+#endif
+    net_socket = -1;
+    net_started = false;
+}
+
+void net_getstats(net_stats* s)
+{
+    *s = net_st;
+}
+
+void net_report(FILE* f)
+{
+    if(net_st.ticks == 0)
+        return;
+    
+    fprintf(f,
+    "Netplay ticks: %llu, stalls: %llu, packets sent/dropped/received: %llu/%llu/%llu\n"
+    "Rollbacks: %llu, avg/max depth: %.1f/%d ticks, max resimulation: %.3f ms\n",
+    (unsigned long long)net_st.ticks, (unsigned long long)net_st.stalls,
+    (unsigned long long)net_st.sent, (unsigned long long)net_st.dropped, (unsigned long long)net_st.received,
+    (unsigned long long)net_st.rollbacks,
+    net_st.rollbacks ? net_st.rollback_ticks/(double)net_st.rollbacks : 0.0, net_st.rollback_max,
+    net_st.resim_max/1000000.0);
+    if(net_st.desync_tick >= 0)
+        fprintf(f, "Desync first detected at tick %d\n", net_st.desync_tick);
+}
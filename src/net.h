@@ -0,0 +1,29 @@
+//------------------------------
+// Rollback netplay
+//------------------------------
+// Two-player co-op over UDP. Each side runs the game locally and sends its
+// inputs every frame; the other player's input is predicted until it
+// arrives, and a wrong guess rewinds to the saved state of that tick and
+// re-runs the ticks since. The host is player 1 and picks the seed.
+
+typedef struct net_stats{
+    Uint64 ticks;
+    Uint64 rollbacks;
+    Uint64 rollback_ticks;
+    int rollback_max;
+    Uint64 resim_max;
+    Uint64 stalls;
+    Uint64 sent;
+    Uint64 dropped;
+    Uint64 received;
+    int desync_tick;
+}net_stats;
+
+bool net_host(int port);
+bool net_join(const char* host, int port);
+void net_setsim(int delayms, int losspct);
+bool net_active();
+void net_update(int input);
+void net_close();
+void net_getstats(net_stats* s);
+void net_report(FILE* f);
@@ -0,0 +1,450 @@
+/*
+    Espada - A retro 2D space shooter
+    Copyright (C) 2011  Justin Jacobs
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SDL/SDL.h"
+#include "SDL/SDL_image.h"
+#include "SDL/SDL_ttf.h"
+#include "SDL/SDL_mixer.h"
+
+#include <stdlib.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "main.h"
+#include "clips.h"
+#include "anim.h"
+#include "obs.h"
+
+typedef struct obs_sprite{
+    int w;
+    int h;
+    Uint8* lum;
+    Uint8* cov;
+}obs_sprite;
+
+static obs_sprite obs_player[2];
+static obs_sprite obs_playerinvuln[2];
+static obs_sprite obs_enemy1[2];
+static obs_sprite obs_enemy2[2];
+static obs_sprite obs_explosion[8];
+static obs_sprite obs_laser;
+static obs_sprite obs_laserenemy;
+static obs_sprite obs_background;
+
+static int obs_w;
+static int obs_h;
+static int obs_stack;
+static int obs_count;
+static Uint8* obs_frames = NULL;
+
+//------------------------------
+// Kernels
+//------------------------------
+static void obs_accumulate(Uint32* acc, const Uint8* src, int n, int weight) // acc += src*weight, weight <= 256
+{
+    int x = 0;
+
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+    __m128i w = _mm_set1_epi16(weight);
+    
+    for(;x+16<=n;x+=16)
+    {
+        __m128i s = _mm_loadu_si128((const __m128i*)(src+x));
+        __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(s,zero),w);
+        __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(s,zero),w);
+        __m128i* a = (__m128i*)(acc+x);
+        
+        _mm_storeu_si128(a+0,_mm_add_epi32(_mm_loadu_si128(a+0),_mm_unpacklo_epi16(lo,zero)));
+        _mm_storeu_si128(a+1,_mm_add_epi32(_mm_loadu_si128(a+1),_mm_unpackhi_epi16(lo,zero)));
+        _mm_storeu_si128(a+2,_mm_add_epi32(_mm_loadu_si128(a+2),_mm_unpacklo_epi16(hi,zero)));
+        _mm_storeu_si128(a+3,_mm_add_epi32(_mm_loadu_si128(a+3),_mm_unpackhi_epi16(hi,zero)));
+    }
+#endif
+    
+    for(;x<n;x++)
+        acc[x] += src[x]*weight;
+}
+
+static void obs_boxfilter(const Uint8* src, int sw, int sh, Uint8* dst, int dw, int dh) // Area-weighted downscale
+{
+    int ox,oy,sx,sy;
+    Uint32* acc = malloc(sw*sizeof(Uint32));
+    
+    if(acc == NULL)
+        return;
+    
+    // Weights are in 1/256ths of a source pixel
+    for(oy=0;oy<dh;oy++)
+    {
+        int y0 = (int)((Sint64)oy*sh*256/dh);
+        int y1 = (int)((Sint64)(oy+1)*sh*256/dh);
+        
+        memset(acc,0,sw*sizeof(Uint32));
+        for(sy=y0>>8;sy*256<y1;sy++)
+        {
+            int top = sy*256 > y0 ? sy*256 : y0;
+            int bottom = (sy+1)*256 < y1 ? (sy+1)*256 : y1;
+            obs_accumulate(acc,src+sy*sw,sw,bottom-top);
+        }
+        
+        for(ox=0;ox<dw;ox++)
+        {
+            int x0 = (int)((Sint64)ox*sw*256/dw);
+            int x1 = (int)((Sint64)(ox+1)*sw*256/dw);
+            Uint64 sum = 0;
+            Uint64 area = (Uint64)(y1-y0)*(x1-x0);
+            
+            for(sx=x0>>8;sx*256<x1;sx++)
+            {
+                int left = sx*256 > x0 ? sx*256 : x0;
+                int right = (sx+1)*256 < x1 ? (sx+1)*256 : x1;
+                sum += (Uint64)acc[sx]*(right-left);
+            }
+            dst[oy*dw+ox] = (Uint8)((sum + area/2) / area);
+        }
+    }
+    
+    free(acc);
+}
+
+static void obs_blendrow(Uint8* dst, const Uint8* lum, const Uint8* cov, int n) // dst = lum + dst*(255-cov)/255
+{
+    int x = 0;
+
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+    __m128i c255 = _mm_set1_epi16(255);
+    __m128i c128 = _mm_set1_epi16(128);
+    
+    for(;x+16<=n;x+=16)
+    {
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst+x));
+        __m128i c = _mm_loadu_si128((const __m128i*)(cov+x));
+        __m128i l = _mm_loadu_si128((const __m128i*)(lum+x));
+        __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(d,zero),_mm_sub_epi16(c255,_mm_unpacklo_epi8(c,zero)));
+        __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(d,zero),_mm_sub_epi16(c255,_mm_unpackhi_epi8(c,zero)));
+        
+        lo = _mm_add_epi16(lo,c128);
+        hi = _mm_add_epi16(hi,c128);
+        lo = _mm_srli_epi16(_mm_add_epi16(lo,_mm_srli_epi16(lo,8)),8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi,_mm_srli_epi16(hi,8)),8);
+        _mm_storeu_si128((__m128i*)(dst+x),_mm_adds_epu8(_mm_packus_epi16(lo,hi),l));
+    }
+#endif
+    
+    for(;x<n;x++)
+    {
+        unsigned int t = dst[x]*(255-cov[x]) + 128;
+        t = ((t + (t >> 8)) >> 8) + lum[x];
+        dst[x] = t > 255 ? 255 : t;
+    }
+}
+
+//------------------------------
+// Loading
+//------------------------------
+static int obs_scale(int v, int num, int den) // Round v*num/den to the nearest integer
+{
+    int t = v*num*2 + den;
+    int q = t / (2*den);
+    
+    if(t < 0 && q*2*den != t)
+        q--;
+    return q;
+}
+
+static SDL_Surface* obs_loadimage(char* filename)
+{
+    SDL_Surface* loaded;
+    SDL_Surface* converted = NULL;
+    SDL_Surface* format;
+    
+    // Convert to a known 32bpp layout without needing a video mode
+    format = SDL_CreateRGBSurface(SDL_SWSURFACE,1,1,32,0x00FF0000,0x0000FF00,0x000000FF,0);
+    if(format == NULL)
+        return NULL;
+    
+    loaded = IMG_Load(filename);
+    if(loaded != NULL)
+    {
+        converted = SDL_ConvertSurface(loaded,format->format,SDL_SWSURFACE);
+        SDL_FreeSurface(loaded);
+    }
+    
+    SDL_FreeSurface(format);
+    return converted;
+}
+
+static int obs_makesprite(obs_sprite* spr, SDL_Surface* img, SDL_Rect* clip, bool withalpha, int alpha)
+{
+    int x,y,i;
+    int cw = clip != NULL ? clip->w : img->w;
+    int ch = clip != NULL ? clip->h : img->h;
+    int cx = clip != NULL ? clip->x : 0;
+    int cy = clip != NULL ? clip->y : 0;
+    Uint8* lum = malloc(cw*ch);
+    Uint8* cov = malloc(cw*ch);
+    
+    spr->w = obs_scale(cw,obs_w,SCREEN_WIDTH);
+    spr->h = obs_scale(ch,obs_h,SCREEN_HEIGHT);
+    if(spr->w < 1)
+        spr->w = 1;
+    if(spr->h < 1)
+        spr->h = 1;
+    spr->lum = malloc(spr->w*spr->h);
+    spr->cov = malloc(spr->w*spr->h);
+    
+    if(lum == NULL || cov == NULL || spr->lum == NULL || spr->cov == NULL)
+    {
+        free(lum);
+        free(cov);
+        return 0;
+    }
+    
+    // Transparent pixels count as black with no coverage, so that the
+    // filtered luminance comes out premultiplied
+    SDL_LockSurface(img);
+    for(y=0;y<ch;y++)
+    {
+        Uint32* row = (Uint32*)((Uint8*)img->pixels + (cy+y)*img->pitch) + cx;
+        for(x=0;x<cw;x++)
+        {
+            Uint32 p = row[x] & 0x00FFFFFF;
+            int r = (p >> 16) & 0xFF;
+            int g = (p >> 8) & 0xFF;
+            int b = p & 0xFF;
+            
+            if(withalpha == true && p == 0x00FF00FF)
+            {
+                lum[y*cw+x] = 0;
+                cov[y*cw+x] = 0;
+            }
+            else
+            {
+                lum[y*cw+x] = (77*r + 150*g + 29*b) >> 8;
+                cov[y*cw+x] = 255;
+            }
+        }
+    }
+    SDL_UnlockSurface(img);
+    
+    obs_boxfilter(lum,cw,ch,spr->lum,spr->w,spr->h);
+    obs_boxfilter(cov,cw,ch,spr->cov,spr->w,spr->h);
+    
+    if(alpha < 255)
+    {
+        for(i=0;i<spr->w*spr->h;i++)
+        {
+            spr->lum[i] = spr->lum[i]*alpha/255;
+            spr->cov[i] = spr->cov[i]*alpha/255;
+        }
+    }
+    
+    free(lum);
+    free(cov);
+    return 1;
+}
+
+static int obs_makeframes(obs_sprite* spr, char* filename, SDL_Rect* clips, int count, int alpha)
+{
+    int i;
+    int ok = 1;
+    SDL_Surface* img = obs_loadimage(filename);
+    
+    if(img == NULL)
+        return 0;
+    
+    for(i=0;i<count && ok;i++)
+        ok = obs_makesprite(&spr[i],img,clips != NULL ? &clips[i] : NULL,true,alpha);
+    
+    SDL_FreeSurface(img);
+    return ok;
+}
+
+int obs_init(int w, int h, int stack)
+{
+    SDL_Surface* img;
+    
+    obs_w = w;
+    obs_h = h;
+    obs_stack = stack < 1 ? 1 : stack;
+    obs_count = 0;
+    
+    set_clips();
+    
+    if(!obs_makeframes(obs_player,"res/player_ship.png",clipPlayerNorm,2,255) ||
+       !obs_makeframes(obs_playerinvuln,"res/player_ship.png",clipPlayerInvuln,2,127) ||
+       !obs_makeframes(obs_enemy1,"res/enemy_ship.png",clipEnemyType1,2,255) ||
+       !obs_makeframes(obs_enemy2,"res/enemy_ship2.png",clipEnemyType2,2,255) ||
+       !obs_makeframes(obs_explosion,"res/explosion.png",clipExplosion,8,255) ||
+       !obs_makeframes(&obs_laser,"res/laser.png",NULL,1,255) ||
+       !obs_makeframes(&obs_laserenemy,"res/laser_enemy.png",NULL,1,255))
+    {
+        obs_cleanup();
+        return 0;
+    }
+    
+    img = obs_loadimage(background_layers[0].file);
+    if(img == NULL || !obs_makesprite(&obs_background,img,NULL,false,255))
+    {
+        SDL_FreeSurface(img);
+        obs_cleanup();
+        return 0;
+    }
+    SDL_FreeSurface(img);
+    
+    // Every frame is stored twice, so the last obs_stack frames are always contiguous
+    obs_frames = calloc(2*obs_stack,w*h);
+    if(obs_frames == NULL)
+    {
+        obs_cleanup();
+        return 0;
+    }
+    
+    return 1;
+}
+
+static void obs_freesprites(obs_sprite* spr, int count)
+{
+    int i;
+    
+    for(i=0;i<count;i++)
+    {
+        free(spr[i].lum);
+        free(spr[i].cov);
+        spr[i].lum = NULL;
+        spr[i].cov = NULL;
+    }
+}
+
+void obs_cleanup()
+{
+    obs_freesprites(obs_player,2);
+    obs_freesprites(obs_playerinvuln,2);
+    obs_freesprites(obs_enemy1,2);
+    obs_freesprites(obs_enemy2,2);
+    obs_freesprites(obs_explosion,8);
+    obs_freesprites(&obs_laser,1);
+    obs_freesprites(&obs_laserenemy,1);
+    obs_freesprites(&obs_background,1);
+    
+    free(obs_frames);
+    obs_frames = NULL;
+}
+
+//------------------------------
+// Rendering
+//------------------------------
+static void obs_drawbackground(Uint8* frame)
+{
+    int y;
+    int offset = obs_scale(background_y[0],obs_h,SCREEN_HEIGHT) % obs_background.h;
+    
+    // The first background layer, one row at a time
+    for(y=0;y<obs_h;y++)
+    {
+        int row = (y - offset) % obs_background.h;
+        if(row < 0)
+            row += obs_background.h;
+        memcpy(frame+y*obs_w,obs_background.lum+row*obs_background.w,obs_w);
+    }
+}
+
+static void obs_drawsprite(Uint8* frame, obs_sprite* spr, int x, int y)
+{
+    int row;
+    int ox = obs_scale(x,obs_w,SCREEN_WIDTH);
+    int oy = obs_scale(y,obs_h,SCREEN_HEIGHT);
+    int left = ox < 0 ? -ox : 0;
+    int right = ox + spr->w > obs_w ? obs_w - ox : spr->w;
+    
+    if(left >= right)
+        return;
+    
+    for(row=0;row<spr->h;row++)
+    {
+        int dy = oy + row;
+        if(dy < 0 || dy >= obs_h)
+            continue;
+        obs_blendrow(frame + dy*obs_w + ox + left, spr->lum + row*spr->w + left, spr->cov + row*spr->w + left, right-left);
+    }
+}
+
+void obs_reset()
+{
+    obs_count = 0;
+}
+
+const Uint8* obs_render()
+{
+    int i,j;
+    int size = obs_w*obs_h;
+    int k = obs_count % obs_stack;
+    Uint8* frame = obs_frames + k*size;
+    
+    obs_drawbackground(frame);
+    
+    if(gamestate_title == false)
+    {
+        if(gamestate_over == false && obj_player[0].alive == true)
+        {
+            if(obj_player[0].invuln == false)
+                obs_drawsprite(frame,&obs_player[anim_frame(obj_player[0].anim,obj_player[0].animstart)],obj_player[0].dim.x,obj_player[0].dim.y);
+            else
+                obs_drawsprite(frame,&obs_playerinvuln[anim_frame(obj_player[0].anim,obj_player[0].animstart)],obj_player[0].dim.x,obj_player[0].dim.y);
+        }
+        
+        for(i=0;i<MAXENEMIES;i++)
+        {
+            if(obj_enemy[i].alive == true)
+            {
+                if(obj_enemy[i].type == 0)
+                    obs_drawsprite(frame,&obs_enemy1[anim_frame(obj_enemy[i].anim,obj_enemy[i].animstart)],obj_enemy[i].dim.x,obj_enemy[i].dim.y);
+                else
+                    obs_drawsprite(frame,&obs_enemy2[anim_frame(obj_enemy[i].anim,obj_enemy[i].animstart)],obj_enemy[i].dim.x,obj_enemy[i].dim.y);
+            }
+        }
+        
+        for(i=0;i<MAXEXPLOSIONS;i++)
+            if(obj_explosion[i].alive == true)
+                obs_drawsprite(frame,&obs_explosion[anim_frame(obj_explosion[i].anim,obj_explosion[i].animstart)],obj_explosion[i].dim.x,obj_explosion[i].dim.y);
+        
+        for(i=0;i<MAXLASERS;i++)
+            if(obj_player[0].laz[i].alive == true)
+                obs_drawsprite(frame,&obs_laser,obj_player[0].laz[i].dim.x,obj_player[0].laz[i].dim.y);
+        
+        for(j=0;j<MAXENEMIES;j++)
+            for(i=0;i<MAXLASERS;i++)
+                if(obj_enemy[j].laz[i].alive == true)
+                    obs_drawsprite(frame,&obs_laserenemy,obj_enemy[j].laz[i].dim.x,obj_enemy[j].laz[i].dim.y);
+    }
+    
+    memcpy(frame + obs_stack*size,frame,size);
+    
+    // The first frame after a reset fills the whole stack
+    if(obs_count == 0)
+        for(i=0;i<2*obs_stack;i++)
+            if(i != k && i != k+obs_stack)
+                memcpy(obs_frames + i*size,frame,size);
+    
+    obs_count++;
+    return obs_frames + (k+1)*size;
+}
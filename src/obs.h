@@ -0,0 +1,13 @@
+//------------------------------
+// Observation renderer
+//------------------------------
+// Draws the background, ships, explosions and lasers straight into a small
+// grayscale buffer for automated players. Sprites are downscaled once at
+// load into premultiplied luminance and coverage masks, so no SDL video
+// surface is needed. With a stack of K frames, obs_render() returns K
+// contiguous frames from oldest to newest.
+
+int obs_init(int w, int h, int stack);
+void obs_cleanup();
+void obs_reset();
+const Uint8* obs_render();
@@ -0,0 +1,302 @@
+/*
+    Espada - A retro 2D space shooter
+    Copyright (C) 2011  Justin Jacobs
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SDL/SDL.h"
+#include "SDL/SDL_ttf.h"
+#include "SDL/SDL_mixer.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "main.h"
+#include "pacer.h"
+#include "stats.h"
+
+#define PACER_MARGIN_MIN 100000
+#define PACER_MARGIN_MAX 4000000
+#define PACER_VSYNC_SAMPLES 30
+
+static Uint64 pacer_period;
+static Uint64 pacer_deadline;
+static Uint64 pacer_last;
+static Uint64 pacer_margin = 2000000;
+static Sint64 pacer_oversleep_avg;
+static Sint64 pacer_oversleep_dev;
+
+static int pacer_vsync_requested;
+static int pacer_vsync_active;
+static Uint64 pacer_flipstart;
+static Uint64 pacer_flip_total;
+static int pacer_flip_samples;
+static Uint64 pacer_vsync_interval_total;
+static int pacer_vsync_interval_samples;
+
+static int pacer_maxskip;
+static int pacer_skiprun;
+static Uint64 pacer_logicstart;
+static Uint64 pacer_drawstart;
+static Uint64 pacer_draw_avg;
+static Uint64 pacer_flip_avg;
+
+static pacer_stats pacer_st;
+
+Uint64 pacer_now() // Monotonic time in nanoseconds
+{
+#ifdef _WIN32
+    return (Uint64)SDL_GetTicks() * 1000000;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (Uint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static void pacer_sleepuntil(Uint64 t)
+{
+#ifdef _WIN32
+    Uint64 now = pacer_now();
+    if(t > now)
+        SDL_Delay((t - now) / 1000000);
+#else
+    struct timespec ts;
+    ts.tv_sec = t / 1000000000;
+    ts.tv_nsec = t % 1000000000;
+    // Only a signal is worth another try; on other errors the caller's
+    // spin-wait covers the rest
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+#endif
+}
+
+static void pacer_calibrate(Sint64 oversleep) // Track how late coarse sleeps wake up
+{
+    Sint64 diff;
+    Sint64 margin;
+    
+    pacer_oversleep_avg += (oversleep - pacer_oversleep_avg) / 16;
+    diff = oversleep - pacer_oversleep_avg;
+    if(diff < 0)
+        diff = -diff;
+    pacer_oversleep_dev += (diff - pacer_oversleep_dev) / 16;
+    
+    margin = pacer_oversleep_avg + 4*pacer_oversleep_dev + 50000;
+    if(margin < PACER_MARGIN_MIN)
+        margin = PACER_MARGIN_MIN;
+    if(margin > PACER_MARGIN_MAX)
+        margin = PACER_MARGIN_MAX;
+    pacer_margin = margin;
+}
+
+void pacer_init(int fps, int vsync, int maxskip)
+{
+    pacer_period = 1000000000 / fps;
+    pacer_last = pacer_now();
+    pacer_deadline = pacer_last + pacer_period;
+    pacer_vsync_requested = vsync;
+    pacer_vsync_active = 0;
+    pacer_flip_total = 0;
+    pacer_flip_samples = 0;
+    pacer_vsync_interval_total = 0;
+    pacer_vsync_interval_samples = 0;
+    pacer_maxskip = maxskip;
+    pacer_skiprun = 0;
+    pacer_draw_avg = 0;
+    pacer_flip_avg = 0;
+    memset(&pacer_st, 0, sizeof(pacer_st));
+}
+
+void pacer_beginlogic()
+{
+    pacer_logicstart = pacer_now();
+}
+
+void pacer_endlogic()
+{
+    Uint64 t = pacer_now() - pacer_logicstart;
+    
+    stats_observe(STATS_LOGICTIME, t);
+    pacer_st.logic_total += t;
+    if(t > pacer_st.logic_max)
+        pacer_st.logic_max = t;
+}
+
+bool pacer_shoulddraw() // Skip drawing when it would put us more than a frame behind
+{
+    Uint64 cost = pacer_draw_avg;
+    
+    if(pacer_vsync_active == 0)
+        cost += pacer_flip_avg;
+    
+    if(pacer_skiprun < pacer_maxskip && pacer_now() + cost > pacer_deadline + pacer_period)
+    {
+        pacer_skiprun++;
+        pacer_st.skipped++;
+        return false;
+    }
+    
+    pacer_skiprun = 0;
+    return true;
+}
+
+void pacer_begindraw()
+{
+    pacer_drawstart = pacer_now();
+}
+
+void pacer_enddraw()
+{
+    Uint64 t = pacer_now() - pacer_drawstart;
+    
+    pacer_draw_avg += ((Sint64)t - (Sint64)pacer_draw_avg) / 8;
+    stats_observe(STATS_DRAWTIME, t);
+    pacer_st.draw_total += t;
+    if(t > pacer_st.draw_max)
+        pacer_st.draw_max = t;
+}
+
+void pacer_beginflip()
+{
+    pacer_flipstart = pacer_now();
+}
+
+void pacer_endflip()
+{
+    Uint64 t = pacer_now() - pacer_flipstart;
+    
+    pacer_flip_avg += ((Sint64)t - (Sint64)pacer_flip_avg) / 8;
+    
+    if(pacer_vsync_requested == 0 || pacer_vsync_active == 1)
+        return;
+    
+    // A flip that waits for the refresh blocks for a sizeable part of the
+    // frame on average, since our timed frames are not in phase with it
+    pacer_flip_total += t;
+    pacer_flip_samples++;
+    if(pacer_flip_samples == PACER_VSYNC_SAMPLES)
+    {
+        if(pacer_flip_total / PACER_VSYNC_SAMPLES > pacer_period / 4)
+            pacer_vsync_active = 1;
+        else
+            pacer_vsync_requested = 0;
+    }
+}
+
+void pacer_wait()
+{
+    Uint64 now = pacer_now();
+    Uint64 target = pacer_deadline;
+    Uint64 err;
+    
+    if(pacer_vsync_active == 1)
+    {
+        // SDL_Flip() already waited for the refresh; make sure it is the one we want
+        pacer_vsync_interval_total += now - pacer_last;
+        pacer_vsync_interval_samples++;
+        if(pacer_vsync_interval_samples == 120)
+        {
+            Uint64 avg = pacer_vsync_interval_total / 120;
+            if(avg < pacer_period - pacer_period/20 || avg > pacer_period + pacer_period/20)
+            {
+                pacer_vsync_active = 0;
+                pacer_vsync_requested = 0;
+            }
+            pacer_vsync_interval_total = 0;
+            pacer_vsync_interval_samples = 0;
+        }
+        target = now;
+        if(now > pacer_last + pacer_period + pacer_period/2)
+            pacer_st.missed++;
+    }
+    else if(now >= target)
+    {
+        // Late. Keep to the schedule while frames can still be skipped to
+        // catch up, otherwise start the next frame right away
+        pacer_st.missed++;
+        if(pacer_skiprun >= pacer_maxskip || now - target > pacer_period * (pacer_maxskip+1))
+            target = now;
+    }
+    else
+    {
+        Uint64 coarse = target - pacer_margin;
+        Uint64 spinstart;
+        
+        if(now < coarse)
+        {
+            pacer_sleepuntil(coarse);
+            now = pacer_now();
+            pacer_calibrate((Sint64)(now - coarse));
+            stats_observe(STATS_OVERSLEEP, now > coarse ? now - coarse : 0);
+        }
+        
+        spinstart = now;
+        while(now < target)
+            now = pacer_now();
+        pacer_st.spin_total += now - spinstart;
+    }
+    
+    err = now > target ? now - target : 0;
+    pacer_st.error_total += err;
+    if(err > pacer_st.error_max)
+        pacer_st.error_max = err;
+    
+    stats_observe(STATS_FRAMETIME, now - pacer_last);
+    pacer_st.frametime_total += now - pacer_last;
+    if(now - pacer_last > pacer_st.frametime_max)
+        pacer_st.frametime_max = now - pacer_last;
+    pacer_st.frames++;
+    
+    pacer_last = now;
+    pacer_deadline = target + pacer_period;
+}
+
+void pacer_resync() // Start timing again from now, e.g. after the loop has been sleeping
+{
+    pacer_last = pacer_now();
+    pacer_deadline = pacer_last + pacer_period;
+}
+
+void pacer_getstats(pacer_stats* s)
+{
+    *s = pacer_st;
+    s->margin = pacer_margin;
+    s->vsync = pacer_vsync_active;
+}
+
+void pacer_report(FILE* f)
+{
+    pacer_stats s;
+    
+    pacer_getstats(&s);
+    if(s.frames == 0)
+        return;
+    
+    fprintf(f,
+    "Frames: %llu, missed deadlines: %llu (%.1f%%)\n"
+    "Pacing error avg/max: %.3f/%.3f ms, frame time avg/max: %.3f/%.3f ms\n"
+    "Spin margin: %.3f ms, spin avg: %.3f ms, vsync: %s\n"
+    "Logic avg/max: %.3f/%.3f ms, draw avg/max: %.3f/%.3f ms, skipped draws: %llu\n",
+    (unsigned long long)s.frames, (unsigned long long)s.missed, 100.0*s.missed/s.frames,
+    s.error_total/(double)s.frames/1000000.0, s.error_max/1000000.0,
+    s.frametime_total/(double)s.frames/1000000.0, s.frametime_max/1000000.0,
+    s.margin/1000000.0, s.spin_total/(double)s.frames/1000000.0,
+    s.vsync ? "on" : "off",
+    s.logic_total/(double)s.frames/1000000.0, s.logic_max/1000000.0,
+    s.frames > s.skipped ? s.draw_total/(double)(s.frames-s.skipped)/1000000.0 : 0.0, s.draw_max/1000000.0,
+    (unsigned long long)s.skipped);
+}
@@ -0,0 +1,42 @@
+//------------------------------
+// Frame pacer
+//------------------------------
+// Sleeps coarsely until shortly before each frame deadline, then spins for
+// the remainder. The spin margin tracks how late the OS wakes us up.
+// When vsync is requested and SDL_Flip() is found to block on the display
+// refresh, the pacer lets the flip do the waiting instead.
+//
+// Logic and drawing are timed separately. When a frame runs late, the
+// deadlines are kept and up to maxskip following frames skip drawing to
+// catch up, so the game runs at the same speed on slower machines.
+
+typedef struct pacer_stats{
+    Uint64 frames;
+    Uint64 missed;
+    Uint64 error_total;
+    Uint64 error_max;
+    Uint64 frametime_total;
+    Uint64 frametime_max;
+    Uint64 spin_total;
+    Uint64 skipped;
+    Uint64 logic_total;
+    Uint64 logic_max;
+    Uint64 draw_total;
+    Uint64 draw_max;
+    Uint64 margin;
+    int vsync;
+}pacer_stats;
+
+void pacer_init(int fps, int vsync, int maxskip);
+Uint64 pacer_now();
+void pacer_beginlogic();
+void pacer_endlogic();
+bool pacer_shoulddraw();
+void pacer_begindraw();
+void pacer_enddraw();
+void pacer_beginflip();
+void pacer_endflip();
+void pacer_wait();
+void pacer_resync();
+void pacer_getstats(pacer_stats* s);
+void pacer_report(FILE* f);
@@ -0,0 +1,188 @@
+/*
+    Espada - A retro 2D space shooter
+    Copyright (C) 2011  Justin Jacobs
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SDL/SDL.h"
+#include "SDL/SDL_ttf.h"
+#include "SDL/SDL_mixer.h"
+
+#include <stdio.h>
+
+#include "main.h"
+#include "path.h"
+
+// One spare entry per path repeats its last point, so that the lerp at the
+// very end reads inside the table
+static Sint32 path_x[PATHPOINTS];
+static Sint32 path_y[PATHPOINTS];
+static int path_first[MAXPATHS];
+static Sint32 path_lengths[MAXPATHS]; // 24.8 fixed point
+static int path_total = 0;
+static int path_used = 0;
+
+//------------------------------
+// Baking
+//------------------------------
+static double path_sqrt(double n) // Without libm, like vm_sine()
+{
+    double r = n > 1 ? n : 1;
+    int i;
+    
+    if(n <= 0)
+        return 0;
+    for(i=0;i<40;i++)
+        r = (r + n/r) / 2;
+    return r;
+}
+
+static Sint32 path_fixed(double d)
+{
+    return (Sint32)(d < 0 ? d*256 - 0.5 : d*256 + 0.5);
+}
+
+static bool path_emit(double x, double y)
+{
+    if(path_used == PATHPOINTS)
+        return false;
+    path_x[path_used] = path_fixed(x);
+    path_y[path_used] = path_fixed(y);
+    path_used++;
+    return true;
+}
+
+static double path_spline(int p0, int p1, int p2, int p3, double t) // Catmull-Rom, through p1 at 0 and p2 at 1
+{
+    return 0.5 * (2*p1 + (p2-p0)*t + (2*p0 - 5*p1 + 4*p2 - p3)*t*t + (3*p1 - p0 - 3*p2 + p3)*t*t*t);
+}
+
+static bool path_bakeone(const path_def* d)
+{
+    double px = d->points[0][0];
+    double py = d->points[0][1];
+    double dist = 0;
+    double next = PATHSTEP;
+    int j,s;
+    
+    if(path_emit(px, py) == false)
+        return false;
+    
+    // Walk the curve in small straight steps, dropping an entry every
+    // PATHSTEP pixels of the way
+    for(j=0;j<d->count-1;j++)
+    {
+        const Sint16* p0 = d->points[j > 0 ? j-1 : 0];
+        const Sint16* p1 = d->points[j];
+        const Sint16* p2 = d->points[j+1];
+        const Sint16* p3 = d->points[j+2 < d->count ? j+2 : d->count-1];
+        
+        for(s=1;s<=PATHSAMPLES;s++)
+        {
+            double t = (double)s / PATHSAMPLES;
+            double x = path_spline(p0[0], p1[0], p2[0], p3[0], t);
+            double y = path_spline(p0[1], p1[1], p2[1], p3[1], t);
+            double step = path_sqrt((x-px)*(x-px) + (y-py)*(y-py));
+            
+            while(step > 0 && dist + step >= next)
+            {
+                double f = (next - dist) / step;
+                if(path_emit(px + (x-px)*f, py + (y-py)*f) == false)
+                    return false;
+                next += PATHSTEP;
+            }
+            dist += step;
+            px = x;
+            py = y;
+        }
+    }
+    
+    // The spare entry
+    if(path_used == PATHPOINTS)
+        return false;
+    path_x[path_used] = path_x[path_used-1];
+    path_y[path_used] = path_y[path_used-1];
+    path_used++;
+    return true;
+}
+
+bool path_bake(const path_def* defs, int count) // Replaces any paths baked before
+{
+    int i;
+    
+    path_total = 0;
+    path_used = 0;
+    for(i=0;i<count;i++)
+    {
+        const path_def* d = &defs[i];
+        
+        if(i == MAXPATHS || d->count < 2 || d->count > PATHCONTROLS)
+        {
+            fprintf(stderr, "path %d: needs 2 to %d control points, at most %d paths\n", i, PATHCONTROLS, MAXPATHS);
+            return false;
+        }
+        path_first[i] = path_used;
+        if(path_bakeone(d) == false)
+        {
+            fprintf(stderr, "path %d: paths too long, the tables hold %d points\n", i, PATHPOINTS);
+            return false;
+        }
+        // The spare entry does not count
+        path_lengths[i] = (path_used - path_first[i] - 2) * PATHSTEP * 256;
+        if(path_lengths[i] == 0)
+        {
+            fprintf(stderr, "path %d: shorter than %d pixels\n", i, PATHSTEP);
+            return false;
+        }
+        path_total++;
+    }
+    
+    return true;
+}
+
+//------------------------------
+// Looking up
+//------------------------------
+int path_count()
+{
+    return path_total;
+}
+
+Sint32 path_length(int id) // In 24.8 fixed point pixels
+{
+    return path_lengths[id];
+}
+
+void path_eval(const int* ids, const Sint32* along, Sint32* x, Sint32* y, int count) // 0 <= along <= the path's length
+{
+    int i;
+    
+    // No branches, so that the compiler can vectorize it
+    for(i=0;i<count;i++)
+    {
+        int k = path_first[ids[i]] + (along[i] >> PATHSHIFT);
+        Sint32 f = along[i] & ((1 << PATHSHIFT) - 1);
+        x[i] = path_x[k] + (((path_x[k+1] - path_x[k]) * f) >> PATHSHIFT);
+        y[i] = path_y[k] + (((path_y[k+1] - path_y[k]) * f) >> PATHSHIFT);
+    }
+}
+
+void path_heading(int id, int speed, Sint16* vx, Sint16* vy) // Velocity in 8.8 along the last step, speed in 8.8
+{
+    int k = path_first[id] + path_lengths[id] / (PATHSTEP * 256);
+    
+    *vx = (path_x[k] - path_x[k-1]) * speed / (PATHSTEP * 256);
+    *vy = (path_y[k] - path_y[k-1]) * speed / (PATHSTEP * 256);
+}
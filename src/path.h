@@ -0,0 +1,25 @@
+//------------------------------
+// Flight paths
+//------------------------------
+// A path is a Catmull-Rom spline through a few control points, given in
+// pixels from where the enemy is when it starts flying it. At load each
+// path is baked into a table of points PATHSTEP pixels apart along the
+// curve, so that an enemy moving a set distance per tick moves at an even
+// speed however the control points are spread. Looking a point up is then
+// a fetch and a lerp between two entries, done for all enemies on paths at
+// once by path_eval(). The tables are whole 24.8 fixed point numbers, so
+// the flights are the same on every machine.
+//
+// The last entry is within PATHSTEP pixels of the last control point; an
+// enemy reaching it carries on at the same speed along path_heading().
+
+#define PATHSTEP 4         // Pixels along the curve between entries, a power of 2
+#define PATHSHIFT 10       // log2(PATHSTEP*256)
+#define PATHPOINTS 8192    // Entries for all paths together
+#define PATHSAMPLES 64     // Steps per curve segment when measuring it
+
+bool path_bake(const path_def* defs, int count);
+int path_count();
+Sint32 path_length(int id);
+void path_eval(const int* ids, const Sint32* along, Sint32* x, Sint32* y, int count);
+void path_heading(int id, int speed, Sint16* vx, Sint16* vy);
@@ -0,0 +1,117 @@
+/*
+    Espada - A retro 2D space shooter
+    Copyright (C) 2011  Justin Jacobs
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SDL/SDL.h"
+#include "SDL/SDL_ttf.h"
+#include "SDL/SDL_mixer.h"
+
+#include "main.h"
+#include "pool.h"
+#include "trace.h"
+
+static int pool_count = 1;
+static bool pool_quit = false;
+static SDL_Thread* pool_threads[MAXTHREADS];
+static SDL_sem* pool_start[MAXTHREADS];
+static SDL_sem* pool_done = NULL;
+static int pool_ids[MAXTHREADS];
+
+static void (*pool_fn)(int band, int bands, void* data);
+static void* pool_data;
+
+static int pool_worker(void* data)
+{
+    int band = *(int*)data;
+    
+    TRACE_THREAD("pool");
+    while(1)
+    {
+        SDL_SemWait(pool_start[band]);
+        if(pool_quit == true)
+            break;
+        pool_fn(band, pool_count, pool_data);
+        SDL_SemPost(pool_done);
+    }
+    
+    return 0;
+}
+
+void pool_init(int threads)
+{
+    int i;
+    
+    if(threads < 1)
+        threads = 1;
+    if(threads > MAXTHREADS)
+        threads = MAXTHREADS;
+    
+    pool_quit = false;
+    pool_done = SDL_CreateSemaphore(0);
+    pool_count = 1;
+    
+    // Band 0 always runs on the caller
+    for(i=1;i<threads;i++)
+    {
+        pool_ids[i] = i;
+        pool_start[i] = SDL_CreateSemaphore(0);
+        pool_threads[i] = SDL_CreateThread(pool_worker, &pool_ids[i]);
+        if(pool_threads[i] == NULL)
+        {
+            SDL_DestroySemaphore(pool_start[i]);
+            break;
+        }
+        pool_count++;
+    }
+}
+
+int pool_size()
+{
+    return pool_count;
+}
+
+void pool_run(void (*fn)(int band, int bands, void* data), void* data)
+{
+    int i;
+    
+    pool_fn = fn;
+    pool_data = data;
+    
+    for(i=1;i<pool_count;i++)
+        SDL_SemPost(pool_start[i]);
+    fn(0, pool_count, data);
+    for(i=1;i<pool_count;i++)
+        SDL_SemWait(pool_done);
+}
+
+void pool_cleanup()
+{
+    int i;
+    
+    pool_quit = true;
+    for(i=1;i<pool_count;i++)
+    {
+        SDL_SemPost(pool_start[i]);
+        SDL_WaitThread(pool_threads[i], NULL);
+        SDL_DestroySemaphore(pool_start[i]);
+    }
+    pool_count = 1;
+    
+    if(pool_done != NULL)
+        SDL_DestroySemaphore(pool_done);
+    pool_done = NULL;
+}
@@ -0,0 +1,13 @@
+//------------------------------
+// Worker pool
+//------------------------------
+// A fixed set of threads for splitting a frame into bands. pool_run()
+// calls fn once per band, band 0 on the calling thread, and returns when
+// all of them are done. Without pool_init() everything runs on the caller.
+
+#define MAXTHREADS 8
+
+void pool_init(int threads);
+int pool_size();
+void pool_run(void (*fn)(int band, int bands, void* data), void* data);
+void pool_cleanup();
@@ -0,0 +1,214 @@
+/*
+    Espada - A retro 2D space shooter
+    Copyright (C) 2011  Justin Jacobs
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SDL/SDL.h"
+#include "SDL/SDL_ttf.h"
+#include "SDL/SDL_mixer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "replay.h"
+
+static FILE* replay_file = NULL;
+static FILE* replay_golden = NULL;
+static bool replay_ingame = false;
+static int replay_lasttick = 0;
+static int replay_bits = 0;
+static int replay_run = 0;   // Ticks in a row with replay_bits
+
+//------------------------------
+// Recording
+//------------------------------
+static void replay_flush()
+{
+    if(replay_run > 0)
+        fprintf(replay_file, "%d %d\n", replay_run, replay_bits);
+    replay_run = 0;
+}
+
+bool replay_record(const char* file)
+{
+    char golden[300];
+    
+    snprintf(golden, sizeof(golden), "%s.golden", file);
+    replay_file = fopen(file, "w");
+    replay_golden = fopen(golden, "w");
+    if(replay_file == NULL || replay_golden == NULL)
+    {
+        fprintf(stderr, "Unable to record a replay to %s\n", file);
+        replay_stop();
+        return false;
+    }
+    
+    fprintf(replay_file, "espada replay %d\n", REPLAYVERSION);
+    replay_ingame = false;
+    return true;
+}
+
+void replay_newgame() // Called before anything is set up, while the random state is the seed
+{
+    if(replay_file == NULL)
+        return;
+    
+    replay_flush();
+    fprintf(replay_file, "game %u\n", sys_randstate);
+    replay_ingame = true;
+    replay_lasttick = 0;
+}
+
+void replay_tick() // After each call to game_logic()
+{
+    replay_hash h;
+    
+    // Only ticks that moved the game on are part of it
+    if(replay_file == NULL || replay_ingame == false || game_tick == replay_lasttick)
+        return;
+    replay_lasttick = game_tick;
+    
+    if(replay_run > 0 && game_input[0] != replay_bits)
+        replay_flush();
+    replay_bits = game_input[0];
+    replay_run++;
+    
+    replay_hashstate(&h);
+    replay_writehash(replay_golden, &h);
+}
+
+void replay_stop()
+{
+    if(replay_file != NULL)
+    {
+        replay_flush();
+        fclose(replay_file);
+    }
+    if(replay_golden != NULL)
+        fclose(replay_golden);
+    replay_file = NULL;
+    replay_golden = NULL;
+}
+
+//------------------------------
+// Playing back
+//------------------------------
+bool replay_load(const char* file, replay* r)
+{
+    FILE* f = fopen(file, "r");
+    char line[128];
+    int version = 0;
+    int size = 0;
+    int n = 1;
+    
+    memset(r, 0, sizeof(replay));
+    if(f == NULL)
+    {
+        fprintf(stderr, "Unable to open replay %s\n", file);
+        return false;
+    }
+    
+    if(fgets(line, sizeof(line), f) == NULL || sscanf(line, "espada replay %d", &version) != 1 || version != REPLAYVERSION)
+    {
+        fprintf(stderr, "%s is not a version %d replay\n", file, REPLAYVERSION);
+        fclose(f);
+        return false;
+    }
+    
+    while(fgets(line, sizeof(line), f) != NULL)
+    {
+        unsigned int seed;
+        int count,bits;
+        
+        n++;
+        if(sscanf(line, "game %u", &seed) == 1 && r->gamecount < MAXREPLAYGAMES)
+        {
+            replay_game* g = &r->games[r->gamecount++];
+            g->seed = seed;
+            g->first = r->ticks;
+            g->ticks = 0;
+        }
+        else if(sscanf(line, "%d %d", &count, &bits) == 2 && r->gamecount > 0 && count > 0 && count <= 0x1000000)
+        {
+            if(r->ticks + count > size)
+            {
+                Uint8* grown;
+                
+                while(r->ticks + count > size)
+                    size = size > 0 ? size*2 : 4096;
+                grown = realloc(r->inputs, size);
+                if(grown == NULL)
+                    break;
+                r->inputs = grown;
+            }
+            memset(r->inputs + r->ticks, bits, count);
+            r->ticks += count;
+            r->games[r->gamecount-1].ticks += count;
+        }
+        else if(line[strspn(line, " \t\r\n")] != '\0')
+            break;
+    }
+    
+    if(feof(f) == 0)
+    {
+        fprintf(stderr, "%s:%d: not a game or a run of input\n", file, n);
+        fclose(f);
+        replay_free(r);
+        return false;
+    }
+    
+    fclose(f);
+    return true;
+}
+
+void replay_free(replay* r)
+{
+    free(r->inputs);
+    r->inputs = NULL;
+    r->ticks = 0;
+    r->gamecount = 0;
+}
+
+void replay_hashstate(replay_hash* h)
+{
+    static game_state s;  // Too big for the stack
+    
+    game_savestate(&s);
+    game_statehashes(&s, h->parts);
+    h->score = obj_player[0].score;
+    h->wave = game_enemywaves;
+}
+
+void replay_writehash(FILE* f, const replay_hash* h)
+{
+    int i;
+    
+    for(i=0;i<STATEPARTS;i++)
+        fprintf(f, "%08x ", h->parts[i]);
+    fprintf(f, "%d %d\n", h->score, h->wave);
+}
+
+bool replay_readhash(FILE* f, replay_hash* h)
+{
+    int i;
+    
+    for(i=0;i<STATEPARTS;i++)
+        if(fscanf(f, "%x", &h->parts[i]) != 1)
+            return false;
+    return fscanf(f, "%d %d", &h->score, &h->wave) == 2 ? true : false;
+}
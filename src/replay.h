@@ -0,0 +1,48 @@
+//------------------------------
+// Replays
+//------------------------------
+// A replay holds the seed and the input of every logic tick of one or more
+// games, which is all it takes to play them again exactly. The file is
+// text, one line each:
+//
+//   espada replay 1
+//   game SEED      A game starts from random state SEED
+//   COUNT BITS     COUNT ticks with the ACTION_ bits BITS
+//
+// Recording also writes FILE.golden with the state after every tick: the
+// STATE_ part hashes in hex, then the score and the wave. Ticks spent
+// paused or on the title screen are left out. src/check.c plays replays
+// back headless and compares against the goldens.
+
+#define REPLAYVERSION 1
+#define MAXREPLAYGAMES 64
+
+typedef struct replay_game{
+    Uint32 seed;
+    int first;   // Index of its first tick in the inputs
+    int ticks;
+}replay_game;
+
+typedef struct replay{
+    replay_game games[MAXREPLAYGAMES];
+    int gamecount;
+    Uint8* inputs;  // Every game's ticks back to back
+    int ticks;
+}replay;
+
+typedef struct replay_hash{
+    Uint32 parts[STATEPARTS];
+    int score;
+    int wave;
+}replay_hash;
+
+bool replay_record(const char* file);
+void replay_newgame();
+void replay_tick();
+void replay_stop();
+
+bool replay_load(const char* file, replay* r);
+void replay_free(replay* r);
+void replay_hashstate(replay_hash* h);
+void replay_writehash(FILE* f, const replay_hash* h);
+bool replay_readhash(FILE* f, replay_hash* h);
@@ -0,0 +1,248 @@
+/*
+    Espada - A retro 2D space shooter
+    Copyright (C) 2011  Justin Jacobs
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SDL/SDL.h"
+#include "SDL/SDL_ttf.h"
+#include "SDL/SDL_mixer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "main.h"
+#include "pool.h"
+#include "scale.h"
+#include "trace.h"
+
+typedef struct scale_frame{
+    const Uint8* src;
+    int srcpitch;
+    Uint8* dst;
+    int dstpitch;
+    int w;
+    int h;
+}scale_frame;
+
+static int scale_factor = 1;
+static int scale_filter = SCALE_NEAREST;
+static Uint32* scale_tmp[MAXTHREADS];
+
+//------------------------------
+// Kernels
+//------------------------------
+static void scale_expandrow(const Uint32* src, Uint32* dst, int n, int k) // Repeat each pixel k times
+{
+    int x = 0;
+    int i;
+    
+    if(k == 1)
+    {
+        memcpy(dst, src, n*sizeof(Uint32));
+        return;
+    }
+
+#ifdef __SSE2__
+    if(k == 2)
+    {
+        for(;x+4<=n;x+=4)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src+x));
+            _mm_storeu_si128((__m128i*)(dst+x*2), _mm_unpacklo_epi32(v,v));
+            _mm_storeu_si128((__m128i*)(dst+x*2+4), _mm_unpackhi_epi32(v,v));
+        }
+    }
+    else if(k == 4)
+    {
+        for(;x+4<=n;x+=4)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src+x));
+            __m128i lo = _mm_unpacklo_epi32(v,v);
+            __m128i hi = _mm_unpackhi_epi32(v,v);
+            _mm_storeu_si128((__m128i*)(dst+x*4), _mm_unpacklo_epi64(lo,lo));
+            _mm_storeu_si128((__m128i*)(dst+x*4+4), _mm_unpackhi_epi64(lo,lo));
+            _mm_storeu_si128((__m128i*)(dst+x*4+8), _mm_unpacklo_epi64(hi,hi));
+            _mm_storeu_si128((__m128i*)(dst+x*4+12), _mm_unpackhi_epi64(hi,hi));
+        }
+    }
+#endif
+    
+    for(;x<n;x++)
+        for(i=0;i<k;i++)
+            dst[x*k+i] = src[x];
+}
+
+static void scale_epxpixel(const Uint32* up, const Uint32* mid, const Uint32* down, Uint32* out0, Uint32* out1, int x, int w)
+{
+    Uint32 B = up[x];
+    Uint32 H = down[x];
+    Uint32 E = mid[x];
+    Uint32 D = mid[x > 0 ? x-1 : x];
+    Uint32 F = mid[x < w-1 ? x+1 : x];
+    
+    if(B != H && D != F)
+    {
+        out0[x*2] = D == B ? D : E;
+        out0[x*2+1] = B == F ? F : E;
+        out1[x*2] = D == H ? D : E;
+        out1[x*2+1] = H == F ? F : E;
+    }
+    else
+    {
+        out0[x*2] = E;
+        out0[x*2+1] = E;
+        out1[x*2] = E;
+        out1[x*2+1] = E;
+    }
+}
+
+static void scale_epxrow(const Uint32* up, const Uint32* mid, const Uint32* down, Uint32* out0, Uint32* out1, int w) // Scale2x one row into two
+{
+    int x = 1;
+    
+    scale_epxpixel(up, mid, down, out0, out1, 0, w);
+
+#ifdef __SSE2__
+    __m128i ones = _mm_set1_epi32(-1);
+    
+    for(;x+4<w;x+=4)
+    {
+        __m128i B = _mm_loadu_si128((const __m128i*)(up+x));
+        __m128i H = _mm_loadu_si128((const __m128i*)(down+x));
+        __m128i E = _mm_loadu_si128((const __m128i*)(mid+x));
+        __m128i D = _mm_loadu_si128((const __m128i*)(mid+x-1));
+        __m128i F = _mm_loadu_si128((const __m128i*)(mid+x+1));
+        __m128i ok = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi32(B,H),_mm_cmpeq_epi32(D,F)),ones);
+        __m128i m0 = _mm_and_si128(ok,_mm_cmpeq_epi32(D,B));
+        __m128i m1 = _mm_and_si128(ok,_mm_cmpeq_epi32(B,F));
+        __m128i m2 = _mm_and_si128(ok,_mm_cmpeq_epi32(D,H));
+        __m128i m3 = _mm_and_si128(ok,_mm_cmpeq_epi32(H,F));
+        __m128i e0 = _mm_or_si128(_mm_and_si128(m0,D),_mm_andnot_si128(m0,E));
+        __m128i e1 = _mm_or_si128(_mm_and_si128(m1,F),_mm_andnot_si128(m1,E));
+        __m128i e2 = _mm_or_si128(_mm_and_si128(m2,D),_mm_andnot_si128(m2,E));
+        __m128i e3 = _mm_or_si128(_mm_and_si128(m3,F),_mm_andnot_si128(m3,E));
+        
+        _mm_storeu_si128((__m128i*)(out0+x*2), _mm_unpacklo_epi32(e0,e1));
+        _mm_storeu_si128((__m128i*)(out0+x*2+4), _mm_unpackhi_epi32(e0,e1));
+        _mm_storeu_si128((__m128i*)(out1+x*2), _mm_unpacklo_epi32(e2,e3));
+        _mm_storeu_si128((__m128i*)(out1+x*2+4), _mm_unpackhi_epi32(e2,e3));
+    }
+#endif
+    
+    for(;x<w;x++)
+        scale_epxpixel(up, mid, down, out0, out1, x, w);
+}
+
+static void scale_run(int band, int bands, void* data)
+{
+    scale_frame* b = data;
+    Uint32* tmp = scale_tmp[band];
+    int f = scale_factor;
+    int y0 = b->h*band/bands;
+    int y1 = b->h*(band+1)/bands;
+    int y,i;
+    
+    TRACE_BEGIN("scale_band");
+    for(y=y0;y<y1;y++)
+    {
+        const Uint32* mid = (const Uint32*)(b->src + y*b->srcpitch);
+        Uint8* out = b->dst + y*f*b->dstpitch;
+        
+        if(scale_filter == SCALE_SCALE2X && f % 2 == 0)
+        {
+            // Scale2x makes two rows, the rest of the factor is plain repetition
+            const Uint32* up = y > 0 ? (const Uint32*)(b->src + (y-1)*b->srcpitch) : mid;
+            const Uint32* down = y < b->h-1 ? (const Uint32*)(b->src + (y+1)*b->srcpitch) : mid;
+            int k = f/2;
+            
+            scale_epxrow(up, mid, down, tmp, tmp + b->w*2, b->w);
+            scale_expandrow(tmp, (Uint32*)out, b->w*2, k);
+            for(i=1;i<k;i++)
+                memcpy(out + i*b->dstpitch, out, b->w*f*sizeof(Uint32));
+            out += k*b->dstpitch;
+            scale_expandrow(tmp + b->w*2, (Uint32*)out, b->w*2, k);
+            for(i=1;i<k;i++)
+                memcpy(out + i*b->dstpitch, out, b->w*f*sizeof(Uint32));
+        }
+        else
+        {
+            scale_expandrow(mid, (Uint32*)out, b->w, f);
+            for(i=1;i<f;i++)
+                memcpy(out + i*b->dstpitch, out, b->w*f*sizeof(Uint32));
+        }
+    }
+    TRACE_END("scale_band");
+}
+
+bool scale_init(int factor, int filter)
+{
+    int i;
+    
+    if(factor < 1 || factor > MAXSCALE)
+        return false;
+    
+    scale_factor = factor;
+    scale_filter = filter;
+    
+    // One row of scratch per band, the bands come from the shared pool
+    for(i=0;i<MAXTHREADS;i++)
+    {
+        scale_tmp[i] = malloc(SCREEN_WIDTH*4*sizeof(Uint32));
+        if(scale_tmp[i] == NULL)
+        {
+            fprintf(stderr, "Unable to allocate the scaler buffers\n");
+            scale_cleanup();
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+void scale_blit(SDL_Surface* src, SDL_Surface* dst)
+{
+    scale_frame frame;
+    
+    if(SDL_MUSTLOCK(dst))
+        SDL_LockSurface(dst);
+    
+    frame.src = src->pixels;
+    frame.srcpitch = src->pitch;
+    frame.dst = dst->pixels;
+    frame.dstpitch = dst->pitch;
+    frame.w = src->w;
+    frame.h = src->h;
+    pool_run(scale_run, &frame);
+    
+    if(SDL_MUSTLOCK(dst))
+        SDL_UnlockSurface(dst);
+}
+
+void scale_cleanup()
+{
+    int i;
+    
+    for(i=0;i<MAXTHREADS;i++)
+    {
+        free(scale_tmp[i]);
+        scale_tmp[i] = NULL;
+    }
+}
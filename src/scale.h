@@ -0,0 +1,16 @@
+//------------------------------
+// Output scaler
+//------------------------------
+// Scales the 640x480 frame up to the window by an integer factor, either
+// with plain pixel doubling or with Scale2x (EPX) edge smoothing for the
+// first 2x. Both surfaces must be 32bpp in the same format. The rows are
+// split into bands that are scaled in parallel on the worker pool.
+
+#define SCALE_NEAREST 0
+#define SCALE_SCALE2X 1
+
+#define MAXSCALE 4
+
+bool scale_init(int factor, int filter);
+void scale_blit(SDL_Surface* src, SDL_Surface* dst);
+void scale_cleanup();
@@ -0,0 +1,306 @@
+/*
+    Espada - A retro 2D space shooter
+    Copyright (C) 2011  Justin Jacobs
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SDL/SDL.h"
+#include "SDL/SDL_ttf.h"
+#include "SDL/SDL_mixer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "pacer.h"
+#include "soak.h"
+
+int soak_surfaces = 0;
+int soak_chunks = 0;
+
+static Uint64 soak_allocs = 0;
+static Uint64 soak_allocs_total = 0;
+static Uint64 soak_frees_total = 0;
+static __thread bool soak_onmain = false;
+
+static bool soak_running = false;
+static Uint64 soak_begin = 0;
+static Uint64 soak_end = 0;
+static Uint64 soak_next = 0;
+static Uint64 soak_frames = 0;
+static soak_sample soak_first;
+static soak_sample soak_steady;
+static soak_sample soak_last;
+static int soak_samples = 0;
+static int soak_overtimer = 0;
+
+//------------------------------
+// Heap counting
+//------------------------------
+#if defined(__GLIBC__) && !defined(ESPADA_LIB)
+extern void* __libc_malloc(size_t n);
+extern void* __libc_calloc(size_t n, size_t size);
+extern void* __libc_realloc(void* p, size_t n);
+extern void* __libc_memalign(size_t align, size_t n);
+extern void __libc_free(void* p);
+
+static inline void soak_countalloc()
+{
+    __atomic_add_fetch(&soak_allocs_total, 1, __ATOMIC_RELAXED);
+    if(soak_onmain == true)
+        soak_allocs++;
+}
+
+void* malloc(size_t n)
+{
+    soak_countalloc();
+    return __libc_malloc(n);
+}
+
+void* calloc(size_t n, size_t size)
+{
+    soak_countalloc();
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* p, size_t n)
+{
+    // Counted as a free of the old block and an allocation of the new one
+    if(p == NULL || n > 0)
+        soak_countalloc();
+    if(p != NULL)
+        __atomic_add_fetch(&soak_frees_total, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(p, n);
+}
+
+void* memalign(size_t align, size_t n)
+{
+    soak_countalloc();
+    return __libc_memalign(align, n);
+}
+
+int posix_memalign(void** p, size_t align, size_t n)
+{
+    soak_countalloc();
+    *p = __libc_memalign(align, n);
+    return *p != NULL || n == 0 ? 0 : ENOMEM;
+}
+
+void* aligned_alloc(size_t align, size_t n)
+{
+    soak_countalloc();
+    return __libc_memalign(align, n);
+}
+
+void free(void* p)
+{
+    if(p != NULL)
+        __atomic_add_fetch(&soak_frees_total, 1, __ATOMIC_RELAXED);
+    __libc_free(p);
+}
+#endif
+
+//------------------------------
+// Autoplay
+//------------------------------
+void soak_autoplay()
+{
+    player* p = &obj_player[0];
+    int cx = p->dim.x + p->dim.w/2;
+    int threat = -1;
+    int target = -1;
+    int i,j;
+    
+    // Start a game from the title, and go back to it a while after dying
+    if(gamestate_title == true)
+    {
+        game_newgame();
+        return;
+    }
+    if(gamestate_over == true)
+    {
+        if(++soak_overtimer > 120)
+        {
+            soak_overtimer = 0;
+            game_titlescreen();
+        }
+        return;
+    }
+    if(gamestate_pause == true || p->alive == false)
+        return;
+    
+    // Anything coming down on the ship is a threat, the nearest one counts
+    for(j=0;j<MAXENEMIES;j++)
+    {
+        if(obj_enemy[j].alive == true && obj_enemy[j].dim.y > p->dim.y - 200 && obj_enemy[j].dim.y < p->dim.y + p->dim.h
+           && obj_enemy[j].dim.x < p->dim.x + p->dim.w + 16 && obj_enemy[j].dim.x + obj_enemy[j].dim.w > p->dim.x - 16)
+            threat = obj_enemy[j].dim.x + obj_enemy[j].dim.w/2;
+        for(i=0;i<MAXLASERS;i++)
+        {
+            laser* l = &obj_enemy[j].laz[i];
+            if(l->alive == true && l->dim.y > p->dim.y - 160 && l->dim.y < p->dim.y + p->dim.h
+               && l->dim.x < p->dim.x + p->dim.w + 12 && l->dim.x + l->dim.w > p->dim.x - 12)
+                threat = l->dim.x + l->dim.w/2;
+        }
+        
+        // Line up under the closest enemy that is on screen
+        if(obj_enemy[j].alive == true && obj_enemy[j].dim.y >= 0)
+        {
+            int ex = obj_enemy[j].dim.x + obj_enemy[j].dim.w/2;
+            if(target < 0 || abs(ex - cx) < abs(target - cx))
+                target = ex;
+        }
+    }
+    
+    action_moveleft = false;
+    action_moveright = false;
+    action_moveup = false;
+    action_movedown = p->dim.y + p->dim.h < SCREEN_BOTTOM ? true : false;
+    action_fire = true;
+    
+    if(threat >= 0)
+    {
+        // Dodge away from it, unless the wall is in the way
+        if((threat < cx && p->dim.x + p->dim.w < SCREEN_WIDTH - 8) || p->dim.x < 8)
+            action_moveright = true;
+        else
+            action_moveleft = true;
+    }
+    else if(target >= 0 && abs(target - cx) > 8)
+    {
+        if(target < cx)
+            action_moveleft = true;
+        else
+            action_moveright = true;
+    }
+}
+
+//------------------------------
+// Soak mode
+//------------------------------
+static long soak_rss()
+{
+#ifdef __linux__
+    long pages = -1;
+    FILE* f = fopen("/proc/self/statm", "r");
+    
+    if(f == NULL)
+        return -1;
+    if(fscanf(f, "%*d %ld", &pages) != 1)
+        pages = -1;
+    fclose(f);
+    return pages < 0 ? -1 : pages * (sysconf(_SC_PAGESIZE) / 1024);
+#else
+    return -1;
+#endif
+}
+
+static void soak_sampleinto(soak_sample* s, Uint64 now)
+{
+    s->seconds = (now - soak_begin) / 1000000000.0;
+    s->frames = soak_frames;
+    s->rss = soak_rss();
+    s->allocs = soak_allocs;
+    s->allocs_total = __atomic_load_n(&soak_allocs_total, __ATOMIC_RELAXED);
+    s->live = (Sint64)s->allocs_total - (Sint64)__atomic_load_n(&soak_frees_total, __ATOMIC_RELAXED);
+    s->surfaces = soak_surfaces;
+    s->chunks = soak_chunks;
+}
+
+static void soak_print(FILE* f, const soak_sample* s, const soak_sample* prev)
+{
+    Uint64 frames = s->frames - prev->frames;
+    
+    fprintf(f, "Soak %.2fh: %llu frames, RSS %ld kB, allocs/frame %.3f (all threads %.3f), live blocks %lld, surfaces %d, chunks %d\n",
+            s->seconds/3600.0, (unsigned long long)s->frames, s->rss,
+            frames ? (s->allocs - prev->allocs)/(double)frames : 0.0,
+            frames ? (s->allocs_total - prev->allocs_total)/(double)frames : 0.0,
+            (long long)s->live, s->surfaces, s->chunks);
+    fflush(f);
+}
+
+void soak_start(double hours)
+{
+    soak_onmain = true;
+    soak_begin = pacer_now();
+    soak_end = soak_begin + (Uint64)(hours * 3600.0 * 1000000000.0);
+    soak_next = soak_begin + (Uint64)SOAK_INTERVAL * 1000000000;
+    soak_frames = 0;
+    soak_samples = 0;
+    soak_sampleinto(&soak_first, soak_begin);
+    soak_steady = soak_first;
+    soak_last = soak_first;
+    soak_running = true;
+}
+
+bool soak_frame() // Once per frame, false once the time is up
+{
+    Uint64 now;
+    soak_sample s;
+    
+    if(soak_running == false)
+        return true;
+    soak_frames++;
+    
+    now = pacer_now();
+    if(now < soak_next && now < soak_end)
+        return true;
+    
+    // Sampling and printing allocate, which is not the game's doing
+    soak_onmain = false;
+    soak_sampleinto(&s, now);
+    soak_print(stdout, &s, &soak_last);
+    soak_onmain = true;
+    soak_last = s;
+    if(++soak_samples == SOAK_WARMUP)
+        soak_steady = s;
+    soak_next += (Uint64)SOAK_INTERVAL * 1000000000;
+    
+    return now < soak_end ? true : false;
+}
+
+bool soak_report(FILE* f) // Prints the verdict, false if it failed
+{
+    const soak_sample* a = &soak_steady;
+    const soak_sample* b = &soak_last;
+    Uint64 frames = b->frames - a->frames;
+    double perframe;
+    bool pass = true;
+    
+    if(soak_running == false)
+        return true;
+    soak_running = false;
+    soak_onmain = false;
+    
+    if(frames == 0)
+    {
+        fprintf(f, "Soak: too short to reach a steady state\n");
+        return true;
+    }
+    
+    perframe = (b->allocs - a->allocs)/(double)frames;
+    fprintf(f, "Soak steady state over %llu frames: allocs/frame %.4f, growth in RSS %ld kB, live blocks %lld, surfaces %d, chunks %d\n",
+            (unsigned long long)frames, perframe, b->rss - a->rss,
+            (long long)(b->live - a->live), b->surfaces - a->surfaces, b->chunks - a->chunks);
+    
+    // Other threads and the heap as a whole are reported, but only the
+    // main loop is held to zero
+    if(b->allocs > a->allocs || b->surfaces > a->surfaces || b->chunks > a->chunks)
+        pass = false;
+    fprintf(f, "Soak %s\n", pass == true ? "passed" : "FAILED");
+    return pass;
+}
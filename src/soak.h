@@ -0,0 +1,34 @@
+//------------------------------
+// Soak testing
+//------------------------------
+// An autoplay agent that dodges and shoots through the action_ flags, and
+// starts a new game whenever the last one ends. In soak mode the game runs
+// uncapped for a number of hours and prints, once a minute, the resident
+// set size, heap allocations per frame and the number of live surfaces,
+// sound chunks and heap blocks. The run fails if the main loop still
+// allocates once warmed up, or if any of the live counts grows.
+//
+// Heap calls are counted by wrapping malloc and friends, which needs
+// glibc; elsewhere the allocation figures stay at zero.
+
+#define SOAK_INTERVAL 60  // Seconds between samples
+#define SOAK_WARMUP 1     // Samples before the steady state starts
+
+typedef struct soak_sample{
+    double seconds;
+    Uint64 frames;
+    long rss;             // Kilobytes, -1 if unknown
+    Uint64 allocs;        // Heap allocations on the main thread
+    Uint64 allocs_total;  // On every thread
+    Sint64 live;          // Heap blocks not yet freed
+    int surfaces;
+    int chunks;
+}soak_sample;
+
+extern int soak_surfaces;
+extern int soak_chunks;
+
+void soak_autoplay();
+void soak_start(double hours);
+bool soak_frame();
+bool soak_report(FILE* f);
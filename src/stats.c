@@ -0,0 +1,332 @@
+/*
+    Espada - A retro 2D space shooter
+    Copyright (C) 2011  Justin Jacobs
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SDL/SDL.h"
+#include "SDL/SDL_ttf.h"
+#include "SDL/SDL_mixer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#include "main.h"
+#include "pacer.h"
+#include "capture.h"
+#include "events.h"
+#include "mixer.h"
+#include "stats.h"
+#include "trace.h"
+
+#define STATS_TIMEOUT 1000   // Milliseconds a client gets to send and receive
+#define STATS_REQUEST 4096
+#define STATS_RESPONSE 16384
+
+typedef struct stats_histogram{
+    Uint64 buckets[STATS_BUCKETS];
+    Uint64 sum;
+}stats_histogram;
+
+typedef struct stats_metric{
+    const char* name;
+    const char* help;
+    bool counter;  // Otherwise a gauge
+}stats_metric;
+
+static const stats_metric stats_histogramnames[STATS_HISTOGRAMS] = {
+    {"espada_frame_seconds","Time from one frame to the next",false},
+    {"espada_logic_seconds","Time spent in the game logic per frame",false},
+    {"espada_draw_seconds","Time spent drawing per drawn frame",false},
+    {"espada_oversleep_seconds","How late coarse sleeps woke up",false}
+};
+
+static const stats_metric stats_names[STATS_VALUES] = {
+    {"espada_frames_total","Frames run",true},
+    {"espada_frames_missed_total","Frames that missed their deadline",true},
+    {"espada_frames_skipped_total","Frames that went undrawn to keep up",true},
+    {"espada_events_dropped_total","Game events lost to a full queue",true},
+    {"espada_capture_dropped_total","Captured frames lost to a full queue",true},
+    {"espada_explosions_dropped_total","Explosions lost to a full pool",true},
+    {"espada_enemies","Enemies alive",false},
+    {"espada_lasers","Lasers in flight",false},
+    {"espada_explosions","Explosions playing",false},
+    {"espada_wave","Current wave",false},
+    {"espada_audio_channels","Sounds playing",false}
+};
+
+// Upper bounds of the buckets, in nanoseconds
+static const Uint64 stats_bounds[STATS_BUCKETS-1] = {
+    500000, 1000000, 2000000, 4000000, 8000000, 16666667, 33333333, 66666667, 100000000
+};
+
+static stats_histogram stats_histograms[STATS_HISTOGRAMS];
+static Uint64 stats_values[STATS_VALUES];
+
+#ifndef _WIN32
+static int stats_socket = -1;
+static char stats_path[108];
+static SDL_Thread* stats_thread = NULL;
+static bool stats_quit = false;
+#endif
+
+//------------------------------
+// Recording
+//------------------------------
+void stats_observe(int histogram, Uint64 ns)
+{
+    stats_histogram* h = &stats_histograms[histogram];
+    int b = 0;
+    
+    while(b < STATS_BUCKETS-1 && ns > stats_bounds[b])
+        b++;
+    __atomic_add_fetch(&h->buckets[b], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&h->sum, ns, __ATOMIC_RELAXED);
+}
+
+void stats_count(int counter)
+{
+    __atomic_add_fetch(&stats_values[counter], 1, __ATOMIC_RELAXED);
+}
+
+static void stats_set(int value, Uint64 v)
+{
+    __atomic_store_n(&stats_values[value], v, __ATOMIC_RELAXED);
+}
+
+void stats_frame() // Publish what the other modules keep for themselves
+{
+    pacer_stats ps;
+    events_stats es;
+    capture_stats cs;
+    int lasers = 0;
+    int explosions = 0;
+    int i,j;
+    
+    pacer_getstats(&ps);
+    events_getstats(&es);
+    capture_getstats(&cs);
+    stats_set(STATS_FRAMES, ps.frames);
+    stats_set(STATS_MISSED, ps.missed);
+    stats_set(STATS_SKIPPED, ps.skipped);
+    stats_set(STATS_EVENTSDROPPED, es.dropped);
+    stats_set(STATS_CAPTUREDROPPED, cs.dropped);
+    
+    for(i=0;i<MAXLASERS;i++)
+    {
+        for(j=0;j<MAXPLAYERS;j++)
+            lasers += obj_player[j].laz[i].alive == true ? 1 : 0;
+        for(j=0;j<MAXENEMIES;j++)
+            lasers += obj_enemy[j].laz[i].alive == true ? 1 : 0;
+    }
+    for(i=0;i<MAXEXPLOSIONS;i++)
+        explosions += obj_explosion[i].alive == true ? 1 : 0;
+    
+    stats_set(STATS_ENEMIES, game_enemytotal);
+    stats_set(STATS_LASERS, lasers);
+    stats_set(STATS_EXPLOSIONS, explosions);
+    stats_set(STATS_WAVE, game_enemywaves);
+    stats_set(STATS_CHANNELS, Mix_Playing(-1) + mixer_playing());
+}
+
+//------------------------------
+// Serving
+//------------------------------
+#ifndef _WIN32
+static int stats_format(char* out, int size) // The Prometheus text exposition
+{
+    int n = 0;
+    int i,b;
+    
+    for(i=0;i<STATS_VALUES && n < size;i++)
+    {
+        const stats_metric* m = &stats_names[i];
+        n += snprintf(out+n, size-n, "# HELP %s %s\n# TYPE %s %s\n%s %llu\n",
+                      m->name, m->help, m->name, m->counter == true ? "counter" : "gauge", m->name,
+                      (unsigned long long)__atomic_load_n(&stats_values[i], __ATOMIC_RELAXED));
+    }
+    
+    for(i=0;i<STATS_HISTOGRAMS && n < size;i++)
+    {
+        const stats_metric* m = &stats_histogramnames[i];
+        stats_histogram* h = &stats_histograms[i];
+        Uint64 total = 0;
+        
+        n += snprintf(out+n, size-n, "# HELP %s %s\n# TYPE %s histogram\n", m->name, m->help, m->name);
+        for(b=0;b<STATS_BUCKETS && n < size;b++)
+        {
+            total += __atomic_load_n(&h->buckets[b], __ATOMIC_RELAXED);
+            if(b < STATS_BUCKETS-1)
+                n += snprintf(out+n, size-n, "%s_bucket{le=\"%g\"} %llu\n", m->name,
+                              stats_bounds[b]/1000000000.0, (unsigned long long)total);
+            else
+                n += snprintf(out+n, size-n, "%s_bucket{le=\"+Inf\"} %llu\n", m->name, (unsigned long long)total);
+        }
+        // The count is the +Inf bucket, so the two always agree
+        if(n < size)
+            n += snprintf(out+n, size-n, "%s_sum %.9f\n%s_count %llu\n",
+                          m->name, __atomic_load_n(&h->sum, __ATOMIC_RELAXED)/1000000000.0,
+                          m->name, (unsigned long long)total);
+    }
+    
+    return n < size ? n : size-1;
+}
+
+static bool stats_wait(int fd, short events, Uint64 deadline)
+{
+    struct pollfd p;
+    Uint64 now = pacer_now();
+    
+    if(now >= deadline)
+        return false;
+    p.fd = fd;
+    p.events = events;
+    return poll(&p, 1, (deadline - now) / 1000000 + 1) == 1 ? true : false;
+}
+
+static void stats_answer(int fd)
+{
+    static char request[STATS_REQUEST];
+    static char body[STATS_RESPONSE];
+    static char head[256];
+    Uint64 deadline = pacer_now() + (Uint64)STATS_TIMEOUT*1000000;
+    int got = 0;
+    int len,sent,r;
+    
+    // Read up to the end of the headers; what was asked for makes no difference
+    request[0] = '\0';
+    while(got < STATS_REQUEST-1 && strstr(request, "\r\n\r\n") == NULL && strstr(request, "\n\n") == NULL)
+    {
+        if(stats_wait(fd, POLLIN, deadline) == false)
+            return;
+        r = read(fd, request+got, STATS_REQUEST-1-got);
+        if(r <= 0)
+            return;
+        got += r;
+        request[got] = '\0';
+    }
+    
+    len = stats_format(body, sizeof(body));
+    snprintf(head, sizeof(head),
+             "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %d\r\nConnection: close\r\n\r\n", len);
+    
+    for(sent=0;sent<(int)strlen(head);sent+=r)
+    {
+        if(stats_wait(fd, POLLOUT, deadline) == false)
+            return;
+        r = write(fd, head+sent, strlen(head)-sent);
+        if(r <= 0)
+            return;
+    }
+    for(sent=0;sent<len;sent+=r)
+    {
+        if(stats_wait(fd, POLLOUT, deadline) == false)
+            return;
+        r = write(fd, body+sent, len-sent);
+        if(r <= 0)
+            return;
+    }
+}
+
+static int stats_server(void* data)
+{
+    TRACE_THREAD("stats");
+    while(stats_quit == false)
+    {
+        int fd;
+        
+        // Wake up now and then to see if it is time to stop
+        if(stats_wait(stats_socket, POLLIN, pacer_now() + 100000000) == false)
+            continue;
+        fd = accept(stats_socket, NULL, NULL);
+        if(fd < 0)
+            continue;
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        stats_answer(fd);
+        close(fd);
+    }
+    
+    return 0;
+}
+#endif
+
+bool stats_serve(const char* path)
+{
+#ifndef _WIN32
+    struct sockaddr_un addr;
+    
+    if(strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Metrics socket path too long: %s\n", path);
+        return false;
+    }
+    
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    strcpy(stats_path, path);
+    
+    // A socket left over from an earlier run would make bind() fail
+    unlink(path);
+    stats_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(stats_socket < 0 || bind(stats_socket, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(stats_socket, 4) != 0)
+    {
+        fprintf(stderr, "Unable to listen on %s for metrics\n", path);
+        stats_stop();
+        return false;
+    }
+    fcntl(stats_socket, F_SETFL, fcntl(stats_socket, F_GETFL) | O_NONBLOCK);
+    
+    stats_quit = false;
+    stats_thread = SDL_CreateThread(stats_server, NULL);
+    if(stats_thread == NULL)
+    {
+        fprintf(stderr, "Unable to start the metrics thread\n");
+        stats_stop();
+        return false;
+    }
+    
+    return true;
+#else
+    fprintf(stderr, "Metrics are not supported on this platform\n");
+    return false;
+#endif
+}
+
+void stats_stop()
+{
+#ifndef _WIN32
+    stats_quit = true;
+    if(stats_thread != NULL)
+        SDL_WaitThread(stats_thread, NULL);
+    stats_thread = NULL;
+    
+    if(stats_socket >= 0)
+    {
+        close(stats_socket);
+        unlink(stats_path);
+    }
+    stats_socket = -1;
+#endif
+}
@@ -0,0 +1,40 @@
+//------------------------------
+// Metrics
+//------------------------------
+// Counters, gauges and histograms for monitoring, kept with relaxed
+// atomics so that the game never waits on a reader. stats_serve() starts a
+// thread that answers HTTP requests on a Unix domain socket with all of
+// them in Prometheus text format, e.g.
+//
+//   curl --unix-socket /tmp/espada.sock http://localhost/metrics
+//
+// The pacer records the frame timings; stats_frame() publishes everything
+// else from the main loop once per frame.
+
+// Histograms, in nanoseconds
+#define STATS_FRAMETIME 0
+#define STATS_LOGICTIME 1
+#define STATS_DRAWTIME 2
+#define STATS_OVERSLEEP 3
+#define STATS_HISTOGRAMS 4
+#define STATS_BUCKETS 10   // The last one is +Inf
+
+// Counters and gauges
+#define STATS_FRAMES 0
+#define STATS_MISSED 1
+#define STATS_SKIPPED 2
+#define STATS_EVENTSDROPPED 3
+#define STATS_CAPTUREDROPPED 4
+#define STATS_EXPLOSIONSDROPPED 5
+#define STATS_ENEMIES 6
+#define STATS_LASERS 7
+#define STATS_EXPLOSIONS 8
+#define STATS_WAVE 9
+#define STATS_CHANNELS 10
+#define STATS_VALUES 11
+
+bool stats_serve(const char* path);
+void stats_observe(int histogram, Uint64 ns);
+void stats_count(int counter);
+void stats_frame();
+void stats_stop();
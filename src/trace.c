@@ -0,0 +1,216 @@
+/*
+    Espada - A retro 2D space shooter
+    Copyright (C) 2011  Justin Jacobs
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SDL/SDL.h"
+#include "SDL/SDL_ttf.h"
+#include "SDL/SDL_mixer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "pacer.h"
+#include "trace.h"
+
+typedef struct trace_record{
+    Uint64 time;
+    const char* name;
+    char type;
+}trace_record;
+
+typedef struct trace_ring{
+    trace_record* events;
+    Uint32 head;
+    Uint32 summed;  // Events already added up by trace_totals()
+    char name[32];
+}trace_ring;
+
+bool trace_on = false;
+
+static char trace_file[256];
+static Uint64 trace_origin = 0;
+static trace_ring trace_rings[MAXTRACETHREADS];
+static int trace_ringcount = 0;
+static SDL_mutex* trace_lock = NULL;
+static __thread trace_ring* trace_local = NULL;
+
+static trace_ring* trace_register() // First event on this thread
+{
+    trace_ring* r = NULL;
+    
+    SDL_mutexP(trace_lock);
+    if(trace_ringcount < MAXTRACETHREADS)
+    {
+        r = &trace_rings[trace_ringcount];
+        r->events = malloc(TRACEEVENTS*sizeof(trace_record));
+        if(r->events != NULL)
+        {
+            r->head = 0;
+            r->summed = 0;
+            sprintf(r->name, "thread %d", trace_ringcount+1);
+            trace_ringcount++;
+        }
+        else
+            r = NULL;
+    }
+    SDL_mutexV(trace_lock);
+    
+    trace_local = r;
+    return r;
+}
+
+bool trace_start(const char* file)
+{
+    trace_file[0] = '\0';
+    if(file != NULL)
+    {
+        FILE* f = fopen(file, "w");
+        
+        // Fail now rather than after the whole session
+        if(f == NULL)
+            return false;
+        fclose(f);
+        
+        strncpy(trace_file, file, sizeof(trace_file)-1);
+    }
+    
+    trace_lock = SDL_CreateMutex();
+    trace_origin = pacer_now();
+    trace_on = true;
+    trace_thread("main");
+    return true;
+}
+
+void trace_thread(const char* name)
+{
+    trace_ring* r;
+    
+    if(trace_on == false)
+        return;
+    r = trace_local != NULL ? trace_local : trace_register();
+    if(r != NULL)
+        snprintf(r->name, sizeof(r->name), "%s", name);
+}
+
+void trace_event(const char* name, char type)
+{
+    trace_ring* r = trace_local;
+    trace_record* e;
+    
+    if(r == NULL && (r = trace_register()) == NULL)
+        return;
+    
+    e = &r->events[r->head & (TRACEEVENTS-1)];
+    e->time = pacer_now();
+    e->name = name;
+    e->type = type;
+    r->head++;
+}
+
+int trace_totals(trace_total* totals, int count, int max) // Call between spans, often enough that the ring never wraps
+{
+    trace_ring* r = trace_local;
+    const trace_record* open[32];
+    int depth = 0;
+    int i;
+    Uint32 n;
+    
+    if(r == NULL)
+        return count;
+    
+    n = r->head - r->summed > TRACEEVENTS ? r->head - TRACEEVENTS : r->summed;
+    for(;n<r->head;n++)
+    {
+        const trace_record* e = &r->events[n & (TRACEEVENTS-1)];
+        const trace_record* b;
+        
+        if(e->type == TRACE_BEGIN_EVENT && depth < 32)
+            open[depth++] = e;
+        if(e->type != TRACE_END_EVENT || depth == 0)
+            continue;
+        
+        // Spans nest, so an end closes the newest begin
+        b = open[--depth];
+        for(i=0;i<count;i++)
+            if(totals[i].name == e->name || strcmp(totals[i].name, e->name) == 0)
+                break;
+        if(i == count)
+        {
+            if(count == max)
+                continue;
+            totals[count].name = e->name;
+            totals[count].ns = 0;
+            totals[count].count = 0;
+            count++;
+        }
+        totals[i].ns += e->time - b->time;
+        totals[i].count++;
+    }
+    r->summed = r->head;
+    
+    return count;
+}
+
+void trace_stop() // The other threads must be idle by now
+{
+    FILE* f = NULL;
+    int i;
+    Uint32 n;
+    bool first = true;
+    
+    if(trace_on == false)
+        return;
+    trace_on = false;
+    
+    if(trace_file[0] != '\0')
+        f = fopen(trace_file, "w");
+    if(f != NULL)
+    {
+        fprintf(f, "{\"traceEvents\":[\n");
+        for(i=0;i<trace_ringcount;i++)
+        {
+            trace_ring* r = &trace_rings[i];
+            
+            fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                    first == true ? "" : ",\n", i+1, r->name);
+            first = false;
+            
+            // Only the newest events are left once a ring has wrapped
+            n = r->head > TRACEEVENTS ? r->head - TRACEEVENTS : 0;
+            for(;n<r->head;n++)
+            {
+                trace_record* e = &r->events[n & (TRACEEVENTS-1)];
+                Uint64 t = e->time - trace_origin;
+                
+                fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu.%03u,\"pid\":1,\"tid\":%d%s}",
+                        e->name, e->type, (unsigned long long)(t/1000), (unsigned)(t%1000), i+1,
+                        e->type == TRACE_INSTANT_EVENT ? ",\"s\":\"t\"" : "");
+            }
+        }
+        fprintf(f, "\n]}\n");
+        fclose(f);
+    }
+    
+    for(i=0;i<trace_ringcount;i++)
+        free(trace_rings[i].events);
+    trace_ringcount = 0;
+    trace_local = NULL;
+    SDL_DestroyMutex(trace_lock);
+    trace_lock = NULL;
+}
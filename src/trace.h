@@ -0,0 +1,47 @@
+//------------------------------
+// Tracing
+//------------------------------
+// Records spans and instant events into a ring buffer per thread and writes
+// them as Chrome trace-event JSON, which chrome://tracing and Perfetto open.
+// Recording an event is a timestamp and three stores, and nothing happens
+// at all until trace_start(). Names must be string literals.
+//
+// trace_totals() adds up the spans instead, for measuring in-process (see
+// src/check.c); trace_start(NULL) records without writing a file.
+//
+// Building with -DESPADA_NOTRACE (make NOTRACE=1) compiles the macros out.
+
+#define MAXTRACETHREADS 16
+#define TRACEEVENTS 65536 // Per thread, a power of two
+
+#define TRACE_BEGIN_EVENT 'B'
+#define TRACE_END_EVENT 'E'
+#define TRACE_INSTANT_EVENT 'i'
+
+#ifndef ESPADA_NOTRACE
+#define TRACE_BEGIN(name) do{ if(trace_on == true) trace_event(name, TRACE_BEGIN_EVENT); }while(0)
+#define TRACE_END(name) do{ if(trace_on == true) trace_event(name, TRACE_END_EVENT); }while(0)
+#define TRACE_INSTANT(name) do{ if(trace_on == true) trace_event(name, TRACE_INSTANT_EVENT); }while(0)
+#define TRACE_SPAN(call) do{ TRACE_BEGIN(#call); call; TRACE_END(#call); }while(0)
+#define TRACE_THREAD(name) trace_thread(name)
+#else
+#define TRACE_BEGIN(name) ((void)0)
+#define TRACE_END(name) ((void)0)
+#define TRACE_INSTANT(name) ((void)0)
+#define TRACE_SPAN(call) call
+#define TRACE_THREAD(name) ((void)0)
+#endif
+
+typedef struct trace_total{
+    const char* name;
+    Uint64 ns;
+    int count;
+}trace_total;
+
+extern bool trace_on;
+
+bool trace_start(const char* file);
+void trace_thread(const char* name);
+void trace_event(const char* name, char type);
+int trace_totals(trace_total* totals, int count, int max);
+void trace_stop();
@@ -0,0 +1,132 @@
+/*
+    Espada - A retro 2D space shooter
+    Copyright (C) 2011  Justin Jacobs
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SDL/SDL.h"
+#include "SDL/SDL_ttf.h"
+#include "SDL/SDL_mixer.h"
+
+#include <stdio.h>
+
+#include "main.h"
+#include "ui.h"
+
+static ui_menu* ui_menus = NULL;
+static int ui_menucount = 0;
+static int ui_current = 0;
+
+static void ui_render(ui_item* item)
+{
+    char tempstr[64];
+    
+    if(item->text != NULL)
+    {
+        // Nothing to do unless the value shown has changed
+        if(item->value == NULL || *item->value == item->textvalue)
+            return;
+        image_free(item->text);
+        item->text = NULL;
+    }
+    
+    if(item->value != NULL)
+    {
+        snprintf(tempstr,sizeof(tempstr),"%s%d",item->label,*item->value);
+        item->textvalue = *item->value;
+    }
+    else
+        snprintf(tempstr,sizeof(tempstr),"%s",item->label);
+    
+    item->text = image_text(tempstr);
+}
+
+void ui_setmenus(ui_menu* menus, int count)
+{
+    ui_menus = menus;
+    ui_menucount = count;
+    ui_current = 0;
+}
+
+int ui_input(SDLKey key) // Returns the id of an activated action, or -1
+{
+    ui_menu* menu = &ui_menus[ui_current];
+    ui_item* item = &menu->items[menu->selection];
+    int v;
+    
+    if(key == SDLK_DOWN && menu->selection+1 < menu->count)
+        menu->selection += 1;
+    if(key == SDLK_UP && menu->selection > 0)
+        menu->selection -= 1;
+    
+    if(item->type == UI_VALUE && (key == SDLK_LEFT || key == SDLK_RIGHT))
+    {
+        v = *item->value + (key == SDLK_LEFT ? -1 : 1);
+        if(v >= item->min && v <= item->max)
+        {
+            *item->value = v;
+            if(item->changed != NULL)
+                item->changed();
+        }
+    }
+    
+    if(key == 'z')
+    {
+        if(item->type == UI_ACTION)
+            return item->id;
+        if(item->type == UI_SUBMENU && item->id < ui_menucount)
+        {
+            ui_current = item->id;
+            ui_menus[ui_current].selection = 0;
+        }
+    }
+    
+    return -1;
+}
+
+void ui_draw(int x, int y, SDL_Surface* cursor, SDL_Surface* dest)
+{
+    ui_menu* menu = &ui_menus[ui_current];
+    int i;
+    
+    for(i=0;i<menu->count;i++)
+    {
+        ui_render(&menu->items[i]);
+        if(menu->items[i].text != NULL)
+            image_apply(x, y+(i*UI_SPACING), 255, menu->items[i].text, dest, NULL);
+    }
+    
+    image_apply(x-20, y+(menu->selection*UI_SPACING), 255, cursor, dest, NULL);
+}
+
+void ui_invalidate() // Drop every cached text, e.g. after the font changes
+{
+    int i,j;
+    
+    for(i=0;i<ui_menucount;i++)
+    {
+        for(j=0;j<ui_menus[i].count;j++)
+        {
+            if(ui_menus[i].items[j].text != NULL)
+                image_free(ui_menus[i].items[j].text);
+            ui_menus[i].items[j].text = NULL;
+        }
+    }
+}
+
+void ui_cleanup()
+{
+    ui_invalidate();
+}
@@ -0,0 +1,35 @@
+//------------------------------
+// Menus
+//------------------------------
+// A menu is a table of items. Every item keeps its rendered text and only
+// renders it again when the value it shows has changed, so drawing a menu
+// is just blits.
+
+#define UI_ACTION 0     // Z returns the item's id
+#define UI_SUBMENU 1    // Z opens the menu numbered by id
+#define UI_VALUE 2      // Left/right steps *value between min and max
+#define UI_SPACING 20
+
+typedef struct ui_item{
+    int type;
+    char* label;
+    int id;
+    int* value;
+    int min;
+    int max;
+    void (*changed)();
+    SDL_Surface* text;
+    int textvalue;
+}ui_item;
+
+typedef struct ui_menu{
+    ui_item* items;
+    int count;
+    int selection;
+}ui_menu;
+
+void ui_setmenus(ui_menu* menus, int count);
+int ui_input(SDLKey key);
+void ui_draw(int x, int y, SDL_Surface* cursor, SDL_Surface* dest);
+void ui_invalidate();
+void ui_cleanup();
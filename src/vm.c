@@ -0,0 +1,614 @@
+/*
+    Espada - A retro 2D space shooter
+    Copyright (C) 2011  Justin Jacobs
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SDL/SDL.h"
+#include "SDL/SDL_ttf.h"
+#include "SDL/SDL_mixer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "path.h"
+#include "vm.h"
+
+// The low 4 bits of the first byte are the opcode, bits 4 and up say which
+// of the value operands are registers (1 byte) rather than numbers (2 bytes)
+#define VM_END 0
+#define VM_SET 1
+#define VM_ADD 2
+#define VM_RAND 3
+#define VM_JMP 4
+#define VM_JZ 5
+#define VM_LOOP 6
+#define VM_WAIT 7
+#define VM_MOVE 8
+#define VM_CURVE 9
+#define VM_AIM 10
+#define VM_FIRE 11
+#define VM_PATH 12
+
+#define VMLABELS 32
+#define VMFIXUPS 64
+#define VMBATCH 64   // Enemies on paths looked up at once
+
+typedef struct vm_instruction{
+    const char* name;
+    int op;
+    const char* args; // r register, v number, f pixels, a degrees, l label
+}vm_instruction;
+
+static const vm_instruction vm_instructions[] = {
+    {"end",VM_END,""},
+    {"set",VM_SET,"rv"},
+    {"add",VM_ADD,"rv"},
+    {"rand",VM_RAND,"rvv"},
+    {"jmp",VM_JMP,"l"},
+    {"jz",VM_JZ,"rl"},
+    {"loop",VM_LOOP,"rl"},
+    {"wait",VM_WAIT,"v"},
+    {"move",VM_MOVE,"ff"},
+    {"curve",VM_CURVE,"a"},
+    {"aim",VM_AIM,"f"},
+    {"fire",VM_FIRE,""},
+    {"path",VM_PATH,"vfv"}
+};
+
+static Uint8 vm_code[VMCODESIZE];
+static int vm_codesize = 1; // Offset 0 is an end, for enemies without a script
+static Sint16 vm_sin[VMANGLES]; // 1.14 fixed point
+
+//------------------------------
+// Compiling
+//------------------------------
+static double vm_sine(double x) // For 0 <= x <= pi/2, without libm
+{
+    double x2 = x*x;
+    return x*(1 - x2/6*(1 - x2/20*(1 - x2/42*(1 - x2/72*(1 - x2/110)))));
+}
+
+void vm_reset()
+{
+    int i;
+    
+    vm_codesize = 1;
+    vm_code[0] = VM_END;
+    
+    // Built from a quarter turn so that the symmetry is exact
+    for(i=0;i<=VMANGLES/4;i++)
+    {
+        int s = (int)(vm_sine(i*3.14159265358979323846*2/VMANGLES)*16384 + 0.5);
+        vm_sin[i] = s;
+        vm_sin[VMANGLES/2-i] = s;
+        vm_sin[(VMANGLES/2+i)%VMANGLES] = -s;
+        vm_sin[(VMANGLES-i)%VMANGLES] = -s;
+    }
+}
+
+static bool vm_emit(int byte)
+{
+    if(vm_codesize == VMCODESIZE)
+        return false;
+    vm_code[vm_codesize++] = byte;
+    return true;
+}
+
+static char* vm_token(char** p) // Next word on the line, NULL at the end
+{
+    char* s = *p;
+    
+    while(*s == ' ' || *s == '\t' || *s == ',')
+        s++;
+    if(*s == '\0')
+        return NULL;
+    *p = s;
+    while(**p != '\0' && **p != ' ' && **p != '\t' && **p != ',')
+        (*p)++;
+    if(**p != '\0')
+        *(*p)++ = '\0';
+    return s;
+}
+
+static int vm_register(const char* s) // 0 to VMREGS-1, -1 if s is not one
+{
+    if(s[0] == 'r' && s[1] >= '0' && s[1] < '0'+VMREGS && s[2] == '\0')
+        return s[1]-'0';
+    return -1;
+}
+
+int vm_compile(const char* source, const char* name) // Returns the entry point, 0 on errors
+{
+    char labels[VMLABELS][16];
+    int labelpc[VMLABELS];
+    int labelcount = 0;
+    char fixups[VMFIXUPS][16];
+    int fixuppc[VMFIXUPS];
+    int fixupline[VMFIXUPS];
+    int fixupcount = 0;
+    int entry = vm_codesize;
+    int line = 0;
+    const char* error = NULL;
+    int i,j;
+    
+    while(*source != '\0' && error == NULL)
+    {
+        char text[128];
+        char* p = text;
+        char* word;
+        const vm_instruction* ins = NULL;
+        int n = strcspn(source, "\n");
+        int opat,values;
+        
+        line++;
+        if(n >= (int)sizeof(text))
+            n = sizeof(text)-1;
+        memcpy(text, source, n);
+        text[n] = '\0';
+        source += strcspn(source, "\n");
+        if(*source == '\n')
+            source++;
+        if(strchr(text, ';') != NULL)
+            *strchr(text, ';') = '\0';
+        
+        word = vm_token(&p);
+        if(word == NULL)
+            continue;
+        
+        // Labels point at the next instruction
+        if(word[strlen(word)-1] == ':')
+        {
+            word[strlen(word)-1] = '\0';
+            if(labelcount == VMLABELS || strlen(word) >= sizeof(labels[0]))
+            {
+                error = "too many labels or label too long";
+                break;
+            }
+            strcpy(labels[labelcount], word);
+            labelpc[labelcount++] = vm_codesize;
+            word = vm_token(&p);
+            if(word == NULL)
+                continue;
+        }
+        
+        for(i=0;i<(int)(sizeof(vm_instructions)/sizeof(vm_instruction));i++)
+            if(strcmp(word, vm_instructions[i].name) == 0)
+                ins = &vm_instructions[i];
+        if(ins == NULL)
+        {
+            error = "unknown instruction";
+            break;
+        }
+        
+        opat = vm_codesize;
+        values = 0;
+        if(vm_emit(ins->op) == false)
+            error = "script too long";
+        for(i=0;ins->args[i] != '\0' && error == NULL;i++)
+        {
+            char* end;
+            double d;
+            int r;
+            
+            word = vm_token(&p);
+            if(word == NULL)
+            {
+                error = "missing operand";
+                break;
+            }
+            r = vm_register(word);
+            
+            if(ins->args[i] == 'r')
+            {
+                if(r < 0)
+                    error = "expected a register";
+                else if(vm_emit(r) == false)
+                    error = "script too long";
+            }
+            else if(ins->args[i] == 'l')
+            {
+                if(fixupcount == VMFIXUPS || strlen(word) >= sizeof(fixups[0]))
+                    error = "too many jumps or label too long";
+                else
+                {
+                    strcpy(fixups[fixupcount], word);
+                    fixuppc[fixupcount] = vm_codesize;
+                    fixupline[fixupcount++] = line;
+                    if(vm_emit(0) == false || vm_emit(0) == false)
+                        error = "script too long";
+                }
+            }
+            else if(r >= 0)
+            {
+                vm_code[opat] |= 16 << values;
+                if(vm_emit(r) == false)
+                    error = "script too long";
+            }
+            else
+            {
+                d = strtod(word, &end);
+                if(*end != '\0' || end == word)
+                {
+                    error = "expected a number or register";
+                    break;
+                }
+                if(ins->args[i] == 'f')
+                    d *= 256;
+                else if(ins->args[i] == 'a')
+                    d *= VMANGLES/360.0;
+                else if(d != (int)d)
+                    error = "expected a whole number";
+                d = d < 0 ? d-0.5 : d+0.5;
+                if(d < -32768 || d > 32767)
+                    error = "number out of range";
+                else if(vm_emit((int)d & 255) == false || vm_emit(((int)d >> 8) & 255) == false)
+                    error = "script too long";
+            }
+            if(ins->args[i] != 'r' && ins->args[i] != 'l')
+                values++;
+        }
+        if(error == NULL && vm_token(&p) != NULL)
+            error = "too many operands";
+    }
+    
+    // Falling off the end of a script ends it
+    if(error == NULL && vm_emit(VM_END) == false)
+        error = "script too long";
+    
+    for(i=0;i<fixupcount && error == NULL;i++)
+    {
+        for(j=0;j<labelcount;j++)
+            if(strcmp(fixups[i], labels[j]) == 0)
+                break;
+        if(j == labelcount)
+        {
+            line = fixupline[i];
+            error = "unknown label";
+            break;
+        }
+        vm_code[fixuppc[i]] = labelpc[j] & 255;
+        vm_code[fixuppc[i]+1] = labelpc[j] >> 8;
+    }
+    
+    if(error != NULL)
+    {
+        fprintf(stderr, "%s:%d: %s\n", name, line, error);
+        vm_codesize = entry;
+        return 0;
+    }
+    return entry;
+}
+
+//------------------------------
+// Running
+//------------------------------
+void vm_start(vm_context* c, int entry)
+{
+    memset(c, 0, sizeof(vm_context));
+    c->pc = entry;
+}
+
+static inline int vm_value(const Uint8** p, int isreg, const vm_context* c)
+{
+    const Uint8* b = *p;
+    
+    if(isreg != 0)
+    {
+        *p = b+1;
+        return c->r[b[0]];
+    }
+    *p = b+2;
+    return (Sint16)(b[0] | b[1] << 8);
+}
+
+static inline int vm_label(const Uint8** p)
+{
+    const Uint8* b = *p;
+    
+    *p = b+2;
+    return b[0] | b[1] << 8;
+}
+
+static int vm_sqrt(int n)
+{
+    int r = 0;
+    int bit = 1 << 30;
+    
+    while(bit > n)
+        bit >>= 2;
+    while(bit != 0)
+    {
+        if(n >= r + bit)
+        {
+            n -= r + bit;
+            r = (r >> 1) + bit;
+        }
+        else
+            r >>= 1;
+        bit >>= 2;
+    }
+    return r;
+}
+
+static int vm_rand(Uint32* state, int low, int high) // Same generator as sys_rand()
+{
+    Uint32 s = *state;
+    s ^= s << 13;
+    s ^= s >> 17;
+    s ^= s << 5;
+    *state = s;
+    return s % (high - low + 1) + low;
+}
+
+static void vm_aim(vm_context* c, const SDL_Rect* body, const SDL_Rect* targets, int count, int speed)
+{
+    int best = -1;
+    int bestdx = 0;
+    int bestdy = 0;
+    int i,len;
+    
+    // The nearest target, centre to centre
+    for(i=0;i<count;i++)
+    {
+        int dx = targets[i].x + targets[i].w/2 - (body->x + body->w/2);
+        int dy = targets[i].y + targets[i].h/2 - (body->y + body->h/2);
+        if(best < 0 || dx*dx + dy*dy < best)
+        {
+            best = dx*dx + dy*dy;
+            bestdx = dx;
+            bestdy = dy;
+        }
+    }
+    
+    if(best < 0)
+        return;
+    len = vm_sqrt(best);
+    if(len == 0)
+        return;
+    c->vx = bestdx*speed/len;
+    c->vy = bestdy*speed/len;
+}
+
+void vm_think(vm_context* c, const SDL_Rect* body, const SDL_Rect* targets, int count, Uint32* rng)
+{
+    int budget = VMBUDGET;
+    
+    while(c->pc != 0 && c->wait <= 0)
+    {
+        const Uint8* p = vm_code + c->pc;
+        int regs = p[0] >> 4;
+        int op = p[0] & 15;
+        int next = -1;
+        int r,a,b;
+        
+        if(budget-- == 0)
+        {
+            c->wait = 1;
+            break;
+        }
+        p++;
+        
+        switch(op)
+        {
+            case VM_END:
+                next = 0;
+                break;
+            case VM_SET:
+                r = *p++;
+                c->r[r] = vm_value(&p, regs & 1, c);
+                break;
+            case VM_ADD:
+                r = *p++;
+                c->r[r] += vm_value(&p, regs & 1, c);
+                break;
+            case VM_RAND:
+                r = *p++;
+                a = vm_value(&p, regs & 1, c);
+                b = vm_value(&p, regs & 2, c);
+                c->r[r] = vm_rand(rng, a, b);
+                break;
+            case VM_JMP:
+                next = vm_label(&p);
+                break;
+            case VM_JZ:
+                r = *p++;
+                a = vm_label(&p);
+                if(c->r[r] == 0)
+                    next = a;
+                break;
+            case VM_LOOP:
+                r = *p++;
+                a = vm_label(&p);
+                if(--c->r[r] != 0)
+                    next = a;
+                break;
+            case VM_WAIT:
+                a = vm_value(&p, regs & 1, c);
+                c->wait = a > 0 ? a : 1;
+                break;
+            case VM_MOVE:
+                a = vm_value(&p, regs & 1, c);
+                b = vm_value(&p, regs & 2, c);
+                c->vx = (regs & 1) ? a*256 : a;
+                c->vy = (regs & 2) ? b*256 : b;
+                c->path = 0;
+                break;
+            case VM_CURVE:
+                a = vm_value(&p, regs & 1, c);
+                c->turn = (regs & 1) ? a*VMANGLES/360 : a;
+                break;
+            case VM_AIM:
+                a = vm_value(&p, regs & 1, c);
+                vm_aim(c, body, targets, count, (regs & 1) ? a*256 : a);
+                c->path = 0;
+                break;
+            case VM_FIRE:
+                c->fire++;
+                break;
+            case VM_PATH:
+                a = vm_value(&p, regs & 1, c);
+                b = vm_value(&p, regs & 2, c);
+                r = vm_value(&p, regs & 4, c);
+                b = (regs & 2) ? b*256 : b;
+                if(a < 0 || a >= path_count() || b <= 0)
+                    break;
+                c->path = a+1;
+                c->speed = b;
+                c->ox = body->x;
+                c->oy = body->y;
+                c->along = -r*b;
+                c->length = path_length(a);
+                c->vx = 0;
+                c->vy = 0;
+                c->turn = 0;
+                break;
+        }
+        
+        c->pc = next >= 0 ? next : p - vm_code;
+    }
+}
+
+static void vm_bounce(vm_context* c, SDL_Rect* body) // Off the sides, and the tick is over
+{
+    if(body->x < 0)
+    {
+        body->x = 0;
+        c->fx = 0;
+        if(c->vx < 0)
+            c->vx = -c->vx;
+    }
+    else if(body->x + body->w > SCREEN_WIDTH)
+    {
+        body->x = SCREEN_WIDTH - body->w;
+        c->fx = 0;
+        if(c->vx > 0)
+            c->vx = -c->vx;
+    }
+    
+    if(c->wait > 0)
+        c->wait--;
+}
+
+static Sint32 vm_along(vm_context* c) // One tick along the path, where to look it up
+{
+    Sint32 length = c->length;
+    
+    c->along += c->speed;
+    if(c->along < 0)
+        return 0;
+    if(c->along < length)
+        return c->along;
+    
+    // Off the end, carry on the way it was heading
+    path_heading(c->path-1, c->speed, &c->vx, &c->vy);
+    c->path = 0;
+    return length;
+}
+
+static void vm_land(vm_context* c, SDL_Rect* body, Sint32 x, Sint32 y) // Put the body where the path says
+{
+    x += c->ox*256;
+    y += c->oy*256;
+    body->x = x >> 8;
+    body->y = y >> 8;
+    c->fx = x & 255;
+    c->fy = y & 255;
+}
+
+void vm_move(vm_context* c, SDL_Rect* body) // One tick along the velocity or path, bouncing off the sides
+{
+    int x,y;
+    
+    if(c->path != 0)
+    {
+        int id = c->path-1;
+        Sint32 along = vm_along(c);
+        Sint32 px,py;
+        
+        path_eval(&id, &along, &px, &py, 1);
+        vm_land(c, body, px, py);
+        vm_bounce(c, body);
+        return;
+    }
+    
+    if(c->turn != 0)
+    {
+        int s = vm_sin[c->turn & (VMANGLES-1)];
+        int co = vm_sin[(c->turn + VMANGLES/4) & (VMANGLES-1)];
+        int vx = c->vx;
+        int vy = c->vy;
+        c->vx = (vx*co - vy*s + 8192) >> 14;
+        c->vy = (vx*s + vy*co + 8192) >> 14;
+    }
+    
+    x = body->x*256 + c->fx + c->vx;
+    y = body->y*256 + c->fy + c->vy;
+    body->x = x >> 8;
+    body->y = y >> 8;
+    c->fx = x & 255;
+    c->fy = y & 255;
+    vm_bounce(c, body);
+}
+
+void vm_run(enemy* enemies, int count) // One tick for every live enemy
+{
+    SDL_Rect targets[MAXPLAYERS];
+    int targetcount = 0;
+    int flying[VMBATCH];
+    int ids[VMBATCH];
+    Sint32 along[VMBATCH];
+    Sint32 x[VMBATCH];
+    Sint32 y[VMBATCH];
+    int i,j,n;
+    
+    for(i=0;i<game_players;i++)
+        if(obj_player[i].alive == true)
+            targets[targetcount++] = obj_player[i].dim;
+    
+    // Scripts first, so the moves below run without branching on opcodes
+    for(i=0;i<count;i++)
+        if(enemies[i].alive == true && enemies[i].vm.pc != 0 && enemies[i].vm.wait <= 0)
+            vm_think(&enemies[i].vm, &enemies[i].dim, targets, targetcount, &sys_randstate);
+    
+    // Enemies on paths are looked up together, VMBATCH at a time
+    for(i=0;i<count;)
+    {
+        for(n=0;i<count && n<VMBATCH;i++)
+        {
+            if(enemies[i].alive != true)
+                continue;
+            if(enemies[i].vm.path == 0)
+            {
+                vm_move(&enemies[i].vm, &enemies[i].dim);
+                continue;
+            }
+            flying[n] = i;
+            ids[n] = enemies[i].vm.path-1;
+            along[n] = vm_along(&enemies[i].vm);
+            n++;
+        }
+        
+        path_eval(ids, along, x, y, n);
+        for(j=0;j<n;j++)
+        {
+            enemy* e = &enemies[flying[j]];
+            vm_land(&e->vm, &e->dim, x[j], y[j]);
+            vm_bounce(&e->vm, &e->dim);
+        }
+    }
+}
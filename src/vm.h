@@ -0,0 +1,44 @@
+//------------------------------
+// Enemy behavior scripts
+//------------------------------
+// Scripts are compiled once at load into one shared block of bytecode, and
+// each enemy keeps its place in it in a vm_context. vm_run() interprets
+// every live enemy whose wait is over in one pass, then moves them all by
+// their velocities in a second pass, looking up those flying paths all
+// together (see path.h). Enemies bounce off the sides.
+// vm_think() and vm_move() are the two halves for one enemy, for callers
+// that keep their enemies elsewhere (the batched environments).
+//
+// One instruction per line, "label:" before it, ';' to the end of the line
+// is a comment. v is a number or one of the registers r0 to r3, which
+// hold whole numbers and start at 0:
+//
+//   set r v        r = v
+//   add r v        r += v
+//   rand r lo hi   r = a random number from lo to hi
+//   jmp label
+//   jz r label     Jump if r is 0
+//   loop r label   r -= 1, jump unless that made it 0
+//   wait v         Keep moving for v ticks before going on
+//   move vx vy     Velocity in pixels per tick, fractions allowed
+//   curve deg      Turn the velocity by deg degrees every tick
+//   aim speed      Head for the nearest player at speed pixels per tick
+//   fire           Shoot once
+//   path n speed delay
+//                  Fly path n from here at speed pixels per tick, after
+//                  holding still for delay ticks; move and aim leave it
+//   end            Stop the script, the enemy keeps its velocity
+//
+// A script runs at most VMBUDGET instructions per tick before it waits a
+// tick anyway, so a loop without a wait cannot hang the game.
+
+#define VMCODESIZE 4096
+#define VMBUDGET 64
+#define VMANGLES 1024  // Steps in a full turn
+
+void vm_reset();
+int vm_compile(const char* source, const char* name);
+void vm_start(vm_context* c, int entry);
+void vm_think(vm_context* c, const SDL_Rect* body, const SDL_Rect* targets, int count, Uint32* rng);
+void vm_move(vm_context* c, SDL_Rect* body);
+void vm_run(enemy* enemies, int count);